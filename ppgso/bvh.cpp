@@ -0,0 +1,153 @@
+#include <algorithm>
+#include <numeric>
+
+#include "bvh.h"
+
+using namespace std;
+using namespace glm;
+using namespace ppgso;
+
+// Number of bins used to evaluate the surface area heuristic along each axis
+const int SAH_BINS = 16;
+// Relative cost of visiting a node compared to intersecting one primitive
+const float SAH_TRAVERSAL_COST = 1.0f;
+// Leaves are never larger than this
+const uint32_t MAX_LEAF_SIZE = 8;
+// Below this depth the SAH split is replaced with a median split so the traversal stack can not overflow
+const uint32_t MAX_SAH_DEPTH = 32;
+
+void BVH::build(const vector<Box> &boxes) {
+  nodes.clear();
+  indices.resize(boxes.size());
+  iota(indices.begin(), indices.end(), 0);
+  if (boxes.empty()) return;
+
+  // Split decisions are made using primitive centers
+  vector<vec3> centers(boxes.size());
+  for (size_t i = 0; i < boxes.size(); ++i)
+    centers[i] = boxes[i].center();
+
+  // A binary tree has at most 2n - 1 nodes
+  nodes.reserve(2 * boxes.size() - 1);
+  buildNode(boxes, centers, 0, (uint32_t) boxes.size(), 0);
+  nodes.shrink_to_fit();
+}
+
+void BVH::refit(const vector<Box> &boxes) {
+  // Children are always stored after their parent, so walking backwards updates children first
+  for (size_t i = nodes.size(); i-- > 0;) {
+    Node &node = nodes[i];
+    Box bounds;
+    if (node.count > 0) {
+      for (uint32_t j = node.offset; j < node.offset + node.count; ++j)
+        bounds.extend(boxes[indices[j]]);
+    } else {
+      for (auto child : {i + 1, (size_t) node.offset}) {
+        bounds.extend(nodes[child].min);
+        bounds.extend(nodes[child].max);
+      }
+    }
+    node.min = bounds.min;
+    node.max = bounds.max;
+  }
+}
+
+uint32_t BVH::buildNode(const vector<Box> &boxes, const vector<vec3> &centers, uint32_t first, uint32_t count, uint32_t depth) {
+  uint32_t index = (uint32_t) nodes.size();
+  nodes.emplace_back();
+
+  // Bounds of the node and of primitive centers
+  Box bounds, centerBounds;
+  for (uint32_t i = first; i < first + count; ++i) {
+    bounds.extend(boxes[indices[i]]);
+    centerBounds.extend(centers[indices[i]]);
+  }
+  nodes[index].min = bounds.min;
+  nodes[index].max = bounds.max;
+
+  // Split along the longest axis of the center bounds
+  vec3 extent = centerBounds.max - centerBounds.min;
+  int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+
+  // Single primitive or a small group with coinciding centers, nothing to split
+  if (count == 1 || (extent[axis] <= 0 && count <= MAX_LEAF_SIZE)) {
+    nodes[index].offset = first;
+    nodes[index].count = count;
+    return index;
+  }
+
+  uint32_t *begin = indices.data() + first;
+  uint32_t *end = begin + count;
+  uint32_t *middle;
+
+  if (depth < MAX_SAH_DEPTH && extent[axis] > 0) {
+    // Bin primitives by their centers
+    struct Bin {
+      Box bounds;
+      uint32_t count = 0;
+    } bins[SAH_BINS];
+
+    float scale = SAH_BINS / extent[axis];
+    auto binIndex = [&](uint32_t primitive) {
+      int b = (int) ((centers[primitive][axis] - centerBounds.min[axis]) * scale);
+      return std::min(b, SAH_BINS - 1);
+    };
+
+    for (uint32_t *i = begin; i < end; ++i) {
+      auto &bin = bins[binIndex(*i)];
+      bin.bounds.extend(boxes[*i]);
+      bin.count++;
+    }
+
+    // Sweep from the right to collect the cost of all right partitions
+    float rightArea[SAH_BINS];
+    uint32_t rightCount[SAH_BINS];
+    Box accumulated;
+    uint32_t accumulatedCount = 0;
+    for (int b = SAH_BINS - 1; b > 0; --b) {
+      accumulated.extend(bins[b].bounds);
+      accumulatedCount += bins[b].count;
+      rightArea[b] = accumulated.area();
+      rightCount[b] = accumulatedCount;
+    }
+
+    // Sweep from the left and pick the cheapest split plane
+    float bestCost = numeric_limits<float>::infinity();
+    int bestSplit = -1;
+    accumulated = Box{};
+    accumulatedCount = 0;
+    for (int b = 1; b < SAH_BINS; ++b) {
+      accumulated.extend(bins[b - 1].bounds);
+      accumulatedCount += bins[b - 1].count;
+      if (accumulatedCount == 0 || rightCount[b] == 0) continue;
+      float cost = accumulated.area() * accumulatedCount + rightArea[b] * rightCount[b];
+      if (cost < bestCost) {
+        bestCost = cost;
+        bestSplit = b;
+      }
+    }
+
+    // Compare against the cost of intersecting all primitives in a leaf
+    float area = bounds.area();
+    float leafCost = (float) count;
+    float splitCost = SAH_TRAVERSAL_COST + (area > 0 ? bestCost / area : 0);
+    if (bestSplit < 0 || (count <= MAX_LEAF_SIZE && leafCost <= splitCost)) {
+      nodes[index].offset = first;
+      nodes[index].count = count;
+      return index;
+    }
+
+    middle = partition(begin, end, [&](uint32_t primitive) { return binIndex(primitive) < bestSplit; });
+  } else {
+    // Median split guarantees logarithmic depth
+    middle = begin + count / 2;
+    nth_element(begin, middle, end, [&](uint32_t a, uint32_t b) { return centers[a][axis] < centers[b][axis]; });
+  }
+
+  auto leftCount = (uint32_t) (middle - begin);
+  buildNode(boxes, centers, first, leftCount, depth + 1);
+  uint32_t right = buildNode(boxes, centers, first + leftCount, count - leftCount, depth + 1);
+  nodes[index].offset = right;
+  nodes[index].count = 0;
+  return index;
+}
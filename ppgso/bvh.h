@@ -0,0 +1,296 @@
+#pragma once
+#include <vector>
+#include <limits>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include <glm/glm.hpp>
+
+#include "simd.h"
+
+namespace ppgso {
+
+  /*!
+   * Bounding volume hierarchy over a set of primitives described only by their axis aligned bounding boxes.
+   *
+   * The tree is built using the surface area heuristic (SAH) and stored as a flat array of nodes in depth first order,
+   * so the left child of an interior node is always the next node in the array.
+   */
+  class BVH {
+  public:
+    /*!
+     * Axis aligned bounding box in single precision
+     */
+    struct Box {
+      glm::vec3 min{std::numeric_limits<float>::infinity()};
+      glm::vec3 max{-std::numeric_limits<float>::infinity()};
+
+      Box() = default;
+
+      /*!
+       * Create a box from bounds of any precision, the bounds are rounded outwards so the box stays conservative
+       * @param lo Minimum corner
+       * @param hi Maximum corner
+       */
+      template<typename T, glm::precision P>
+      Box(const glm::tvec3<T, P> &lo, const glm::tvec3<T, P> &hi) {
+        for (int i = 0; i < 3; ++i) {
+          min[i] = roundOut((float) lo[i], false);
+          max[i] = roundOut((float) hi[i], true);
+        }
+      }
+
+      /*!
+       * Step to the neighbouring float towards positive or negative infinity, same as std::nextafter for finite values
+       * outside of the denormal range but inlined, refitting calls this six times per primitive and the libm call
+       * dominated its cost
+       * @param value Value to round
+       * @param up true to step towards positive infinity
+       * @return Neighbouring float, infinities are returned unchanged
+       */
+      static float roundOut(float value, bool up) {
+        if (std::isinf(value) || std::isnan(value)) return value;
+        // Zero and denormals step to the smallest normal float, slab tests against denormal bounds are many times slower
+        if (std::abs(value) < std::numeric_limits<float>::min())
+          return up ? std::numeric_limits<float>::min() : -std::numeric_limits<float>::min();
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(float));
+        bits = (value > 0) == up ? bits + 1 : bits - 1;
+        std::memcpy(&value, &bits, sizeof(float));
+        return value;
+      }
+
+      /*!
+       * Grow the box to contain another box
+       * @param box Box to include
+       */
+      void extend(const Box &box) {
+        min = glm::min(min, box.min);
+        max = glm::max(max, box.max);
+      }
+
+      /*!
+       * Grow the box to contain a point
+       * @param point Point to include
+       */
+      void extend(const glm::vec3 &point) {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+      }
+
+      /*!
+       * Compute the surface area of the box, used by the SAH cost function
+       * @return Surface area or 0 for an empty box
+       */
+      float area() const {
+        glm::vec3 d = max - min;
+        if (d.x < 0 || d.y < 0 || d.z < 0) return 0;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+      }
+
+      /*!
+       * Center of the box
+       * @return Point in the middle of the box
+       */
+      glm::vec3 center() const {
+        return (min + max) * 0.5f;
+      }
+    };
+
+    /*!
+     * Flattened tree node, 32 bytes so two nodes fit in a cache line
+     * Interior node has count == 0, the left child follows the node and offset points to the right child
+     * Leaf node references count primitives starting at offset in the indices array
+     */
+    struct Node {
+      glm::vec3 min;
+      uint32_t offset;
+      glm::vec3 max;
+      uint32_t count;
+    };
+
+    /*!
+     * Build the hierarchy, any previous content is discarded
+     * @param boxes Bounding boxes of the primitives, primitives are referenced by their index in this vector
+     */
+    void build(const std::vector<Box> &boxes);
+
+    /*!
+     * Update the node bounds for primitives that moved, the tree structure is kept so refitting is much cheaper than
+     * building. Traversal stays correct for any motion but gets slower as the layout drifts from the one that was built.
+     * @param boxes Bounding boxes of the same primitives that were used to build the hierarchy
+     */
+    void refit(const std::vector<Box> &boxes);
+
+    /*!
+     * Find all primitives whose bounds are hit by the ray closer than distance, near nodes are visited first
+     * @param origin Ray origin
+     * @param direction Ray direction
+     * @param distance Closest hit distance found so far, nodes further away are skipped. The intersect callback is expected to lower it.
+     * @param intersect Callback invoked with index of each candidate primitive
+     */
+    template<typename T, glm::precision P, typename Intersect>
+    void traverse(const glm::tvec3<T, P> &origin, const glm::tvec3<T, P> &direction, const T &distance, Intersect &&intersect) const {
+      if (nodes.empty()) return;
+
+      const glm::tvec3<T, P> invDirection = T(1) / direction;
+
+      // Fixed size stack is enough for any tree built from 32bit indices
+      uint32_t stack[64];
+      int top = 0;
+      uint32_t current = 0;
+
+      while (true) {
+        const Node &node = nodes[current];
+        if (node.count > 0) {
+          for (uint32_t i = node.offset; i < node.offset + node.count; ++i)
+            intersect(indices[i]);
+        } else {
+          T nearLeft = slab(nodes[current + 1], origin, invDirection, distance);
+          T nearRight = slab(nodes[node.offset], origin, invDirection, distance);
+          uint32_t left = current + 1, right = node.offset;
+          if (nearLeft > nearRight) {
+            std::swap(nearLeft, nearRight);
+            std::swap(left, right);
+          }
+          if (nearLeft < std::numeric_limits<T>::infinity()) {
+            // Postpone the far child and descend into the near one
+            if (nearRight < std::numeric_limits<T>::infinity())
+              stack[top++] = right;
+            current = left;
+            continue;
+          }
+        }
+        if (top == 0) break;
+        current = stack[--top];
+      }
+    }
+
+    /*!
+     * Check if any primitive blocks the ray closer than distance, used for shadow rays where the closest hit is not needed
+     * Children are visited in array order and traversal stops as soon as the callback reports a hit
+     * @param origin Ray origin
+     * @param direction Ray direction
+     * @param distance Only primitives closer than this distance are of interest
+     * @param intersect Callback invoked with index of each candidate primitive, returns true if the primitive blocks the ray
+     * @return true if the callback returned true for any primitive
+     */
+    template<typename T, glm::precision P, typename Intersect>
+    bool traverseAny(const glm::tvec3<T, P> &origin, const glm::tvec3<T, P> &direction, T distance, Intersect &&intersect) const {
+      if (nodes.empty()) return false;
+
+      const glm::tvec3<T, P> invDirection = T(1) / direction;
+
+      uint32_t stack[64];
+      int top = 0;
+      uint32_t current = 0;
+
+      while (true) {
+        const Node &node = nodes[current];
+        if (slab(node, origin, invDirection, distance) < std::numeric_limits<T>::infinity()) {
+          if (node.count > 0) {
+            for (uint32_t i = node.offset; i < node.offset + node.count; ++i)
+              if (intersect(indices[i])) return true;
+          } else {
+            stack[top++] = node.offset;
+            current = current + 1;
+            continue;
+          }
+        }
+        if (top == 0) break;
+        current = stack[--top];
+      }
+      return false;
+    }
+
+    /*!
+     * Packet variant of traverse, a node is visited when any ray of the packet hits its bounds
+     * @param origin Ray origins, one lane per ray for each axis
+     * @param direction Ray directions, one lane per ray for each axis
+     * @param distance Closest hit distance found so far for each ray
+     * @param intersect Callback invoked with index of each candidate primitive
+     */
+    template<typename Lanes, typename Intersect>
+    void traverse(const Lanes (&origin)[3], const Lanes (&direction)[3], const Lanes &distance, Intersect &&intersect) const {
+      using T = typename Lanes::Scalar;
+      if (nodes.empty()) return;
+
+      const Lanes invDirection[3] = {Lanes{1} / direction[0], Lanes{1} / direction[1], Lanes{1} / direction[2]};
+
+      uint32_t stack[64];
+      int top = 0;
+      uint32_t current = 0;
+
+      while (true) {
+        const Node &node = nodes[current];
+        if (node.count > 0) {
+          for (uint32_t i = node.offset; i < node.offset + node.count; ++i)
+            intersect(indices[i]);
+        } else {
+          T nearLeft = slab(nodes[current + 1], origin, invDirection, distance);
+          T nearRight = slab(nodes[node.offset], origin, invDirection, distance);
+          uint32_t left = current + 1, right = node.offset;
+          if (nearLeft > nearRight) {
+            std::swap(nearLeft, nearRight);
+            std::swap(left, right);
+          }
+          if (nearLeft < std::numeric_limits<T>::infinity()) {
+            if (nearRight < std::numeric_limits<T>::infinity())
+              stack[top++] = right;
+            current = left;
+            continue;
+          }
+        }
+        if (top == 0) break;
+        current = stack[--top];
+      }
+    }
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> indices;
+
+  private:
+    /*!
+     * Ray to box slab test
+     * @return Entry distance of the ray into the node bounds or infinity when the box is missed
+     */
+    template<typename T, glm::precision P>
+    static T slab(const Node &node, const glm::tvec3<T, P> &origin, const glm::tvec3<T, P> &invDirection, T distance) {
+      glm::tvec3<T, P> t0 = (glm::tvec3<T, P>(node.min) - origin) * invDirection;
+      glm::tvec3<T, P> t1 = (glm::tvec3<T, P>(node.max) - origin) * invDirection;
+      T enter = 0, exit = distance;
+      for (int axis = 0; axis < 3; ++axis) {
+        // 0 * inf is NaN when the ray runs along a face its origin lies on, the axis does not limit such rays
+        bool along = t0[axis] != t0[axis] || t1[axis] != t1[axis];
+        enter = along ? enter : std::max(enter, std::min(t0[axis], t1[axis]));
+        exit = along ? exit : std::min(exit, std::max(t0[axis], t1[axis]));
+      }
+      return enter <= exit ? enter : std::numeric_limits<T>::infinity();
+    }
+
+    /*!
+     * Packet to box slab test
+     * @return Closest entry distance of rays that hit the node bounds or infinity when all rays miss
+     */
+    template<typename Lanes>
+    static typename Lanes::Scalar slab(const Node &node, const Lanes (&origin)[3], const Lanes (&invDirection)[3], const Lanes &distance) {
+      using T = typename Lanes::Scalar;
+      const Lanes infinity{std::numeric_limits<T>::infinity()};
+      Lanes enter{0}, exit = distance;
+      for (int axis = 0; axis < 3; ++axis) {
+        Lanes t0 = (Lanes{node.min[axis]} - origin[axis]) * invDirection[axis];
+        Lanes t1 = (Lanes{node.max[axis]} - origin[axis]) * invDirection[axis];
+        // Ordered comparisons are false for NaN, lanes running along a face their origin lies on keep their range
+        Lanes ordered = (t0 <= infinity) & (t1 <= infinity);
+        enter = simd::select(ordered, simd::max(enter, simd::min(t0, t1)), enter);
+        exit = simd::select(ordered, simd::min(exit, simd::max(t0, t1)), exit);
+      }
+      Lanes hit = enter <= exit;
+      if (!simd::bits(hit)) return std::numeric_limits<T>::infinity();
+      return simd::hmin(simd::select(hit, enter, infinity));
+    }
+
+    uint32_t buildNode(const std::vector<Box> &boxes, const std::vector<glm::vec3> &centers, uint32_t first, uint32_t count, uint32_t depth);
+  };
+}
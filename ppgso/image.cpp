@@ -25,7 +25,7 @@ void Image::setPixel(int x, int y, const Image::Pixel& color) {
 }
 
 void Image::clear(const Image::Pixel &color) {
-  framebuffer = vector<Pixel>(framebuffer.size(), color);
+  fill(framebuffer.begin(), framebuffer.end(), color);
 }
 
 void Image::setPixel(int x, int y, int r, int g, int b) {
@@ -0,0 +1,87 @@
+#include <chrono>
+#include <algorithm>
+
+#include "image_writer.h"
+#include "image_bmp.h"
+
+using namespace std;
+using namespace ppgso;
+
+ImageWriter::ImageWriter(size_t queueSize) : queueSize{std::max(queueSize, (size_t) 1)} {
+  thread = std::thread{&ImageWriter::worker, this};
+}
+
+ImageWriter::~ImageWriter() {
+  {
+    lock_guard<std::mutex> lock{mutex};
+    stop = true;
+  }
+  added.notify_all();
+  thread.join();
+}
+
+void ImageWriter::save(Image image, const string &bmp) {
+  unique_lock<std::mutex> lock{mutex};
+  rethrow();
+
+  auto begin = chrono::steady_clock::now();
+  removed.wait(lock, [&] { return jobs.size() < queueSize || error; });
+  waitTime += chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+  rethrow();
+
+  jobs.push_back({move(image), bmp});
+  added.notify_one();
+}
+
+void ImageWriter::finish() {
+  unique_lock<std::mutex> lock{mutex};
+  removed.wait(lock, [&] { return (jobs.empty() && !writing) || error; });
+  rethrow();
+}
+
+double ImageWriter::getWaitTime() const {
+  lock_guard<std::mutex> lock{mutex};
+  return waitTime;
+}
+
+double ImageWriter::getWriteTime() const {
+  lock_guard<std::mutex> lock{mutex};
+  return writeTime;
+}
+
+void ImageWriter::worker() {
+  unique_lock<std::mutex> lock{mutex};
+  while (true) {
+    added.wait(lock, [&] { return !jobs.empty() || stop; });
+    // Remaining images are written before the thread stops
+    if (jobs.empty()) return;
+
+    Job job = move(jobs.front());
+    jobs.pop_front();
+    writing = true;
+    lock.unlock();
+
+    auto begin = chrono::steady_clock::now();
+    exception_ptr failure;
+    try {
+      image::saveBMP(job.image, job.bmp);
+    } catch (...) {
+      failure = current_exception();
+    }
+    double time = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+    lock.lock();
+    writing = false;
+    writeTime += time;
+    if (failure && !error) error = failure;
+    removed.notify_all();
+  }
+}
+
+void ImageWriter::rethrow() {
+  if (!error) return;
+  // Report the error only once
+  auto failure = error;
+  error = nullptr;
+  rethrow_exception(failure);
+}
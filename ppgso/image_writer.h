@@ -0,0 +1,77 @@
+#pragma once
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+
+#include "image.h"
+
+namespace ppgso {
+
+  /*!
+   * Saves images as BMP files on a background thread, so encoding and disk writes of one frame overlap with
+   * rendering of the next one.
+   *
+   * At most queueSize images wait to be written, save blocks while the queue is full so a slow disk can not use up
+   * memory. Errors of the background thread are rethrown by the next call to save or finish.
+   */
+  class ImageWriter {
+  public:
+    /*!
+     * Start the writer thread
+     * @param queueSize Number of images that can wait to be written
+     */
+    ImageWriter(size_t queueSize = 2);
+
+    /*!
+     * Write all queued images and stop the thread, errors are ignored so call finish to check for them
+     */
+    ~ImageWriter();
+
+    ImageWriter(const ImageWriter &) = delete;
+    ImageWriter &operator=(const ImageWriter &) = delete;
+
+    /*!
+     * Queue an image to be saved
+     * @param image Image to save, moved into the queue
+     * @param bmp Name of the BMP file to save the image to
+     */
+    void save(Image image, const std::string &bmp);
+
+    /*!
+     * Wait until all queued images are written
+     */
+    void finish();
+
+    /*!
+     * Time in seconds the callers of save spent waiting for space in the queue
+     */
+    double getWaitTime() const;
+
+    /*!
+     * Time in seconds the background thread spent writing images
+     */
+    double getWriteTime() const;
+
+  private:
+    struct Job {
+      Image image;
+      std::string bmp;
+    };
+
+    void worker();
+    void rethrow();
+
+    size_t queueSize;
+    std::deque<Job> jobs;
+    bool writing = false, stop = false;
+    std::exception_ptr error;
+    double waitTime = 0, writeTime = 0;
+
+    mutable std::mutex mutex;
+    std::condition_variable added, removed;
+    std::thread thread;
+  };
+}
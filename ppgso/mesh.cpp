@@ -7,23 +7,14 @@ using namespace std;
 using namespace glm;
 using namespace ppgso;
 
-Mesh::Mesh(const string &obj_file) {
-  // Load OBJ file
-  shapes.clear();
-  materials.clear();
-  string err = tinyobj::LoadObj(shapes, materials, obj_file.c_str());
-
-  if (!err.empty()) {
-    stringstream msg;
-    msg << err << endl << "Failed to load OBJ file " << obj_file << "!" << endl;
-    throw runtime_error(msg.str());
-  }
+Mesh::Mesh(const string &obj_file) : Mesh{MeshFile::load(obj_file)} {}
 
+Mesh::Mesh(const MeshFile &file) {
   // Initialize OpenGL Buffers
-  for(auto& shape : shapes) {
+  for(auto& shape : file.getShapes()) {
     gl_buffer buffer;
 
-    if(!shape.mesh.positions.empty()) {
+    if(shape.vertexCount) {
       // Generate a vertex array object
       glGenVertexArrays(1, &buffer.vao);
       glBindVertexArray(buffer.vao);
@@ -31,31 +22,28 @@ Mesh::Mesh(const string &obj_file) {
       // Generate and upload a buffer with vertex positions to GPU
       glGenBuffers(1, &buffer.vbo);
       glBindBuffer(GL_ARRAY_BUFFER, buffer.vbo);
-      glBufferData(GL_ARRAY_BUFFER, shape.mesh.positions.size() * sizeof(float), shape.mesh.positions.data(),
-                   GL_STATIC_DRAW);
+      glBufferData(GL_ARRAY_BUFFER, shape.vertexCount * 3 * sizeof(float), shape.positions, GL_STATIC_DRAW);
 
       // Bind the buffer to "Position" attribute in program
       glEnableVertexAttribArray(0);
       glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
     }
 
-    if(!shape.mesh.texcoords.empty()) {
+    if(shape.texCoords) {
       // Generate and upload a buffer with texture coordinates to GPU
       glGenBuffers(1, &buffer.tbo);
       glBindBuffer(GL_ARRAY_BUFFER, buffer.tbo);
-      glBufferData(GL_ARRAY_BUFFER, shape.mesh.texcoords.size() * sizeof(float), shape.mesh.texcoords.data(),
-                   GL_STATIC_DRAW);
+      glBufferData(GL_ARRAY_BUFFER, shape.vertexCount * 2 * sizeof(float), shape.texCoords, GL_STATIC_DRAW);
 
       glEnableVertexAttribArray(1);
       glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
     }
 
-    if(!shape.mesh.normals.empty()) {
+    if(shape.normals) {
       // Generate and upload a buffer with texture coordinates to GPU
       glGenBuffers(1, &buffer.nbo);
       glBindBuffer(GL_ARRAY_BUFFER, buffer.nbo);
-      glBufferData(GL_ARRAY_BUFFER, shape.mesh.normals.size() * sizeof(float), shape.mesh.normals.data(),
-                   GL_STATIC_DRAW);
+      glBufferData(GL_ARRAY_BUFFER, shape.vertexCount * 3 * sizeof(float), shape.normals, GL_STATIC_DRAW);
 
       glEnableVertexAttribArray(2);
       glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
@@ -64,8 +52,8 @@ Mesh::Mesh(const string &obj_file) {
     // Generate and upload a buffer with indices to GPU
     glGenBuffers(1, &buffer.ibo);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer.ibo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, shape.mesh.indices.size() * sizeof(unsigned int), shape.mesh.indices.data(), GL_STATIC_DRAW);
-    buffer.size = (GLsizei) shape.mesh.indices.size();
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, shape.indexCount * sizeof(uint32_t), shape.indices, GL_STATIC_DRAW);
+    buffer.size = (GLsizei) shape.indexCount;
 
     // Copy it to the end of the buffers vector
     buffers.push_back(buffer);
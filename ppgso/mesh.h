@@ -11,7 +11,7 @@
 
 #include "shader.h"
 #include "texture.h"
-#include "tiny_obj_loader.h"
+#include "mesh_file.h"
 
 namespace ppgso {
 
@@ -21,24 +21,30 @@ namespace ppgso {
       GLuint vao, vbo, tbo, nbo, ibo = 0;
       GLsizei size = 0;
     };
-    std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> materials;
     std::vector<gl_buffer> buffers;
 
   public:
 
     /*!
-     * Load 3D geometry from a na Wavefront .obj file.
+     * Load 3D geometry from a na Wavefront .obj file or a binary .mesh file.
+     * Obj files are loaded through their .mesh cache, see MeshFile::load.
      *
      * The shader program passed to the object will be bound to the geometry as follows:
      * vec3 Position - Vertex position, position 0
      * vec2 TexCoord - Texture coordinate, position 1
      * vec3 Normal - Normal vector, position 2
      *
-     * @param obj - File path to the obj file to load.
+     * @param obj - File path to the obj or mesh file to load.
      */
     Mesh(const std::string &obj);
 
+    /*!
+     * Upload geometry of a mapped mesh file, the streams are passed to the GPU as they are stored in the file.
+     *
+     * @param file - Mesh file to upload.
+     */
+    Mesh(const MeshFile &file);
+
     ~Mesh();
 
     /*!
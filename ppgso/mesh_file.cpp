@@ -0,0 +1,333 @@
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <atomic>
+
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "mesh_file.h"
+#include "tiny_obj_loader.h"
+
+using namespace std;
+using namespace glm;
+using namespace ppgso;
+
+namespace {
+
+  const char MAGIC[8] = {'P', 'P', 'G', 'S', 'O', 'M', 'S', 'H'};
+
+  // Streams start at multiples of this, so they can be read with aligned loads
+  const size_t ALIGNMENT = 16;
+
+  /*!
+   * Start of the file, followed by shapeCount entries of FileShape
+   */
+  struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t shapeCount;
+    // Modification time in nanoseconds and size of the obj file the mesh was converted from
+    int64_t sourceTime;
+    uint64_t sourceSize;
+  };
+
+  /*!
+   * Entry of the shape table, offsets are in bytes from the start of the file and 0 for missing streams
+   */
+  struct FileShape {
+    uint64_t name, positions, normals, texCoords, indices;
+    uint32_t nameLength, vertexCount, indexCount, reserved;
+    float min[3], max[3];
+  };
+
+  static_assert(sizeof(FileHeader) == 32 && sizeof(FileShape) == 80, "Mesh file layout must not depend on the compiler");
+
+  /*!
+   * Map the contents of a file into memory, files that are not mapped by the system are read into a buffer
+   * @param file File path to map
+   * @param length Size of the file in bytes
+   * @return Contents of the file, released when the last reference is gone
+   */
+  shared_ptr<const char> mapFile(const string &file, size_t &length) {
+#ifdef _WIN32
+    ifstream stream{file, ios::binary};
+    if (!stream) throw runtime_error("Cannot open file [" + file + "]");
+    stream.seekg(0, ios::end);
+    length = (size_t) stream.tellg();
+    stream.seekg(0, ios::beg);
+    shared_ptr<char> buffer{new char[std::max(length, (size_t) 1)], default_delete<char[]>()};
+    if (!stream.read(buffer.get(), (streamsize) length)) throw runtime_error("Failed to read " + file);
+    return buffer;
+#else
+    int fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0) throw runtime_error("Cannot open file [" + file + "]");
+    struct stat status;
+    if (fstat(fd, &status) != 0 || status.st_size == 0) {
+      close(fd);
+      throw runtime_error(file + " is not a mesh file");
+    }
+    length = (size_t) status.st_size;
+    void *address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (address == MAP_FAILED) throw runtime_error("Failed to map " + file);
+
+    size_t size = length;
+    return {(const char *) address, [size](const char *pointer) { munmap((void *) pointer, size); }};
+#endif
+  }
+
+  /*!
+   * Modification time of a file in nanoseconds, so edits within the same second that keep the size are noticed where
+   * the system records the fraction
+   */
+  int64_t modificationTime(const struct stat &status) {
+#if defined(__APPLE__)
+    return (int64_t) status.st_mtimespec.tv_sec * 1000000000 + status.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+    return (int64_t) status.st_mtime * 1000000000;
+#else
+    return (int64_t) status.st_mtim.tv_sec * 1000000000 + status.st_mtim.tv_nsec;
+#endif
+  }
+
+  /*!
+   * Check that a range of bytes lies inside the file and is aligned for the values stored in it
+   */
+  bool inside(uint64_t offset, uint64_t bytes, size_t length, size_t alignment) {
+    return offset % alignment == 0 && offset <= length && bytes <= length - offset;
+  }
+
+  /*!
+   * Lower case extension of a file path including the dot, empty when there is none
+   */
+  string extension(const string &file) {
+    auto dot = file.find_last_of('.');
+    if (dot == string::npos || file.find_first_of("/\\", dot) != string::npos) return {};
+    string result = file.substr(dot);
+    std::transform(result.begin(), result.end(), result.begin(), [](char c) { return (char) tolower(c); });
+    return result;
+  }
+}
+
+MeshFile::MeshFile(const string &file) {
+  data = mapFile(file, length);
+  parse(file);
+}
+
+MeshFile::MeshFile(shared_ptr<const char> contents, size_t size, const string &file)
+        : data{move(contents)}, length{size} {
+  parse(file);
+}
+
+void MeshFile::parse(const string &file) {
+  FileHeader header;
+  if (length < sizeof(header)) throw runtime_error(file + " is not a mesh file");
+  memcpy(&header, data.get(), sizeof(header));
+  if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) throw runtime_error(file + " is not a mesh file");
+  if (header.version != VERSION) {
+    stringstream msg;
+    msg << file << " has mesh file version " << header.version << ", expected " << VERSION;
+    throw runtime_error(msg.str());
+  }
+  sourceTime = header.sourceTime;
+  sourceSize = header.sourceSize;
+
+  // Streams must lie inside the file and indices must refer to vertices of their shape, the renderers index the
+  // mapped streams without further checks
+  if (!inside(sizeof(header), (uint64_t) header.shapeCount * sizeof(FileShape), length, 1))
+    throw runtime_error(file + " is truncated");
+  shapes.reserve(header.shapeCount);
+  for (uint32_t i = 0; i < header.shapeCount; ++i) {
+    FileShape entry;
+    memcpy(&entry, data.get() + sizeof(header) + i * sizeof(FileShape), sizeof(entry));
+    uint64_t vertices = entry.vertexCount;
+    bool valid = inside(entry.name, entry.nameLength, length, 1) &&
+                 inside(entry.positions, vertices * 3 * sizeof(float), length, sizeof(float)) &&
+                 inside(entry.normals, entry.normals ? vertices * 3 * sizeof(float) : 0, length, sizeof(float)) &&
+                 inside(entry.texCoords, entry.texCoords ? vertices * 2 * sizeof(float) : 0, length, sizeof(float)) &&
+                 inside(entry.indices, (uint64_t) entry.indexCount * sizeof(uint32_t), length, sizeof(uint32_t));
+    if (!valid) throw runtime_error(file + " is truncated");
+
+    auto base = data.get();
+    auto indices = (const uint32_t *) (base + entry.indices);
+    uint32_t largest = 0;
+    for (uint32_t k = 0; k < entry.indexCount; ++k)
+      largest = std::max(largest, indices[k]);
+    if (entry.indexCount > 0 && largest >= entry.vertexCount) {
+      stringstream msg;
+      msg << file << " has index " << largest << " in shape " << i << " with " << entry.vertexCount << " vertices";
+      throw runtime_error(msg.str());
+    }
+
+    Shape shape;
+    shape.name.assign(base + entry.name, entry.nameLength);
+    shape.positions = (const float *) (base + entry.positions);
+    shape.normals = entry.normals ? (const float *) (base + entry.normals) : nullptr;
+    shape.texCoords = entry.texCoords ? (const float *) (base + entry.texCoords) : nullptr;
+    shape.indices = indices;
+    shape.vertexCount = entry.vertexCount;
+    shape.indexCount = entry.indexCount;
+    shape.min = {entry.min[0], entry.min[1], entry.min[2]};
+    shape.max = {entry.max[0], entry.max[1], entry.max[2]};
+    shapes.push_back(move(shape));
+  }
+}
+
+MeshFile MeshFile::load(const string &file) {
+  if (extension(file) == ".mesh") return MeshFile{file};
+
+  struct stat status;
+  if (stat(file.c_str(), &status) != 0) throw runtime_error("Cannot open file [" + file + "]");
+
+  // Missing, damaged or outdated caches are rebuilt
+  string cache = cachePath(file);
+  try {
+    MeshFile cached{cache};
+    if (cached.sourceTime == modificationTime(status) && cached.sourceSize == (uint64_t) status.st_size)
+      return cached;
+  } catch (const runtime_error &) {
+  }
+
+  // The cache only speeds up the next start, meshes in read only directories are converted every time
+  auto converted = convert(file);
+  try {
+    converted.save(cache);
+  } catch (const runtime_error &) {
+  }
+  return converted;
+}
+
+MeshFile MeshFile::convert(const string &obj) {
+  // Stamp taken before parsing, a file changed meanwhile gets converted again by the next load
+  struct stat status;
+  if (stat(obj.c_str(), &status) != 0) throw runtime_error("Cannot open file [" + obj + "]");
+
+  vector<tinyobj::shape_t> objShapes;
+  vector<tinyobj::material_t> materials;
+  string err = tinyobj::LoadObjParallel(objShapes, materials, obj.c_str());
+  if (!err.empty()) {
+    stringstream msg;
+    msg << err << endl << "Failed to load OBJ file " << obj << "!" << endl;
+    throw runtime_error(msg.str());
+  }
+
+  // Lay out the header, the shape table and the aligned streams
+  auto align = [](size_t offset) { return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT; };
+  vector<FileShape> table(objShapes.size());
+  size_t size = sizeof(FileHeader) + table.size() * sizeof(FileShape);
+  for (size_t i = 0; i < objShapes.size(); ++i) {
+    auto &mesh = objShapes[i].mesh;
+    auto &entry = table[i];
+    size_t vertices = mesh.positions.size() / 3;
+    entry = {};
+    entry.vertexCount = (uint32_t) vertices;
+    entry.indexCount = (uint32_t) mesh.indices.size();
+    entry.nameLength = (uint32_t) objShapes[i].name.size();
+    entry.name = size;
+    size = align(size + entry.nameLength);
+    entry.positions = size;
+    size = align(size + vertices * 3 * sizeof(float));
+    if (!mesh.normals.empty()) {
+      entry.normals = size;
+      size = align(size + vertices * 3 * sizeof(float));
+    }
+    if (!mesh.texcoords.empty()) {
+      entry.texCoords = size;
+      size = align(size + vertices * 2 * sizeof(float));
+    }
+    entry.indices = size;
+    size = align(size + mesh.indices.size() * sizeof(uint32_t));
+
+    vec3 min{0}, max{0};
+    for (size_t v = 0; v < vertices; ++v) {
+      vec3 position{mesh.positions[3 * v], mesh.positions[3 * v + 1], mesh.positions[3 * v + 2]};
+      min = v ? glm::min(min, position) : position;
+      max = v ? glm::max(max, position) : position;
+    }
+    for (int k = 0; k < 3; ++k) {
+      entry.min[k] = min[k];
+      entry.max[k] = max[k];
+    }
+  }
+
+  // Zero filled so padding and the normals or texture coordinates of faces that did not have them are zero
+  shared_ptr<char> buffer{new char[size](), default_delete<char[]>()};
+  FileHeader header;
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.shapeCount = (uint32_t) table.size();
+  header.sourceTime = modificationTime(status);
+  header.sourceSize = (uint64_t) status.st_size;
+  memcpy(buffer.get(), &header, sizeof(header));
+  if (!table.empty()) memcpy(buffer.get() + sizeof(header), table.data(), table.size() * sizeof(FileShape));
+
+  auto copy = [&](uint64_t offset, const void *source, size_t bytes) {
+    if (bytes) memcpy(buffer.get() + offset, source, bytes);
+  };
+  for (size_t i = 0; i < objShapes.size(); ++i) {
+    auto &mesh = objShapes[i].mesh;
+    auto &entry = table[i];
+    size_t vertices = entry.vertexCount;
+    copy(entry.name, objShapes[i].name.data(), entry.nameLength);
+    copy(entry.positions, mesh.positions.data(), vertices * 3 * sizeof(float));
+    if (entry.normals)
+      copy(entry.normals, mesh.normals.data(), std::min(mesh.normals.size(), vertices * 3) * sizeof(float));
+    if (entry.texCoords)
+      copy(entry.texCoords, mesh.texcoords.data(), std::min(mesh.texcoords.size(), vertices * 2) * sizeof(float));
+    copy(entry.indices, mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t));
+  }
+
+  return {move(buffer), size, obj};
+}
+
+string MeshFile::cachePath(const string &obj) {
+  if (extension(obj) == ".obj") return obj.substr(0, obj.size() - 4) + ".mesh";
+  return obj + ".mesh";
+}
+
+void MeshFile::save(const string &file) const {
+  // Written to a file of this process next to the destination and renamed over it, so loads and saves running at the
+  // same time in other processes see either the old or the new file
+  static atomic<unsigned int> counter{0};
+#ifdef _WIN32
+  string temporary = file + "." + to_string(_getpid()) + "." + to_string(counter++) + ".tmp";
+#else
+  string temporary = file + "." + to_string(getpid()) + "." + to_string(counter++) + ".tmp";
+  // Created like any other file so the cache gets the permissions the umask of the user allows
+  int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+  if (fd < 0) throw runtime_error("Failed to write " + file);
+  close(fd);
+#endif
+  {
+    ofstream stream{temporary, ios::binary | ios::trunc};
+    stream.write(data.get(), (streamsize) length);
+    if (!stream) {
+      stream.close();
+      remove(temporary.c_str());
+      throw runtime_error("Failed to write " + file);
+    }
+  }
+
+#ifdef _WIN32
+  // Plain rename does not replace existing files on Windows
+  bool moved = MoveFileExA(temporary.c_str(), file.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+  bool moved = rename(temporary.c_str(), file.c_str()) == 0;
+#endif
+  if (!moved) {
+    remove(temporary.c_str());
+    throw runtime_error("Failed to write " + file);
+  }
+}
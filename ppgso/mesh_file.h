@@ -0,0 +1,109 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+namespace ppgso {
+
+  /*!
+   * Triangle meshes stored in a binary file that is mapped into memory and used without parsing.
+   *
+   * The file starts with a versioned header and a table of shapes. Each shape has its bounding box, separate position,
+   * normal and texture coordinate streams and an index buffer laid out like tinyobj::mesh_t, so the streams can be
+   * passed to glBufferData or read by the CPU renderers in place. Values are stored in the byte order of the machine
+   * that wrote the file.
+   *
+   * Wavefront .obj files are converted when they are first loaded and cached next to them in a .mesh file, the cache is
+   * rebuilt when the modification time or size of the .obj file changes.
+   */
+  class MeshFile {
+  public:
+    // Increased whenever the layout changes, caches of other versions are rebuilt
+    static constexpr uint32_t VERSION = 2;
+
+    /*!
+     * Shape with pointers to its streams inside the file
+     */
+    struct Shape {
+      std::string name;
+      // Three floats per vertex
+      const float *positions;
+      // Three floats per vertex or nullptr when the shape has no normals
+      const float *normals;
+      // Two floats per vertex or nullptr when the shape has no texture coordinates
+      const float *texCoords;
+      // Three indices per triangle
+      const uint32_t *indices;
+      size_t vertexCount, indexCount;
+      glm::vec3 min, max;
+    };
+
+    /*!
+     * Map a binary mesh file, throws std::runtime_error when it can not be read or is not a valid mesh file.
+     * The indices are checked once here, which reads the index buffers but not the vertex streams.
+     * @param file File path to the .mesh file
+     */
+    explicit MeshFile(const std::string &file);
+
+    /*!
+     * Load a .mesh file or a Wavefront .obj file through its cache, throws std::runtime_error when the file can not
+     * be loaded. The cache is written when it is missing or out of date, a cache that can not be written is skipped.
+     * @param file File path to the .obj or .mesh file
+     * @return Mesh file mapped from the cache or converted in memory
+     */
+    static MeshFile load(const std::string &file);
+
+    /*!
+     * Parse a Wavefront .obj file and convert it in memory, throws std::runtime_error when it can not be loaded
+     * @param obj File path to the obj file
+     * @return Mesh file that can be saved as the cache of the obj file
+     */
+    static MeshFile convert(const std::string &obj);
+
+    /*!
+     * Name of the cache file of an obj file, the .obj extension is replaced by .mesh
+     * @param obj File path to the obj file
+     */
+    static std::string cachePath(const std::string &obj);
+
+    /*!
+     * Write the mesh to a file, the file is replaced at once so readers never see it half written.
+     * Throws std::runtime_error when the file can not be written.
+     * @param file File path to write to
+     */
+    void save(const std::string &file) const;
+
+    /*!
+     * Shapes of the mesh, their streams stay valid as long as a copy of this mesh file exists
+     */
+    const std::vector<Shape> &getShapes() const {
+      return shapes;
+    }
+
+    /*!
+     * Size of the file in bytes
+     */
+    size_t size() const {
+      return length;
+    }
+
+  private:
+    // Memory mapping or buffer holding the file contents, shared by copies
+    std::shared_ptr<const char> data;
+    size_t length = 0;
+    int64_t sourceTime = 0;
+    uint64_t sourceSize = 0;
+    std::vector<Shape> shapes;
+
+    MeshFile(std::shared_ptr<const char> data, size_t length, const std::string &file);
+
+    /*!
+     * Check the header and ranges and collect the shapes, throws std::runtime_error for invalid files
+     * @param file File path used in error messages
+     */
+    void parse(const std::string &file);
+  };
+}
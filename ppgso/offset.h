@@ -0,0 +1,61 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include <glm/glm.hpp>
+
+namespace ppgso {
+
+  /*!
+   * Constants for offsetRay, tuned for the precision of the scalar type
+   */
+  template<typename T>
+  struct OffsetTraits;
+
+  template<>
+  struct OffsetTraits<float> {
+    using Int = int32_t;
+    static constexpr float origin = 1.0f / 32.0f;
+    static constexpr float floatScale = 1.0f / 65536.0f;
+    static constexpr float intScale = 256.0f;
+  };
+
+  template<>
+  struct OffsetTraits<double> {
+    using Int = int64_t;
+    static constexpr double origin = 1.0 / 32.0;
+    static constexpr double floatScale = 1.0 / 65536.0 / 536870912.0;
+    static constexpr double intScale = 256.0;
+  };
+
+  /*!
+   * Move a point on a surface slightly along the normal so rays starting there do not hit the surface again
+   *
+   * Uses the method by Wächter and Binder "A Fast and Robust Method for Avoiding Self-Intersection". The point is
+   * moved by a fixed number of units in the last place, so the offset scales with the magnitude of the coordinates
+   * and stays correct for both float and double. Coordinates close to zero are offset by a small constant instead.
+   * @param point Point on the surface
+   * @param normal Normal pointing to the side the ray will continue to
+   * @return Point to use as a ray origin
+   */
+  template<typename T, glm::precision P>
+  inline glm::tvec3<T, P> offsetRay(const glm::tvec3<T, P> &point, const glm::tvec3<T, P> &normal) {
+    using Traits = OffsetTraits<T>;
+    using Int = typename Traits::Int;
+    glm::tvec3<T, P> result;
+    for (int i = 0; i < 3; ++i) {
+      if (std::abs(point[i]) < Traits::origin) {
+        result[i] = point[i] + Traits::floatScale * normal[i];
+        continue;
+      }
+      // Step over the representable values in the direction of the normal
+      auto step = (Int) (Traits::intScale * normal[i]);
+      Int bits;
+      std::memcpy(&bits, &point[i], sizeof(T));
+      bits += point[i] < 0 ? -step : step;
+      std::memcpy(&result[i], &bits, sizeof(T));
+    }
+    return result;
+  }
+}
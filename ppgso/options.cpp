@@ -0,0 +1,159 @@
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdlib>
+#include <cerrno>
+#include <cstdio>
+
+#include "options.h"
+
+using namespace std;
+using namespace ppgso;
+
+namespace {
+  unsigned long long toNumber(const string &option, const string &value, unsigned long long minimum) {
+    char *end;
+    errno = 0;
+    auto number = strtoull(value.c_str(), &end, 10);
+    if (value.empty() || value[0] == '-' || *end != '\0' || errno != 0 || number < minimum) {
+      stringstream msg;
+      msg << "Invalid value '" << value << "' for " << option;
+      throw runtime_error(msg.str());
+    }
+    return number;
+  }
+
+  double toReal(const string &option, const string &value) {
+    char *end;
+    errno = 0;
+    auto number = strtod(value.c_str(), &end);
+    if (value.empty() || *end != '\0' || errno != 0 || !(number >= 0)) {
+      stringstream msg;
+      msg << "Invalid value '" << value << "' for " << option;
+      throw runtime_error(msg.str());
+    }
+    return number;
+  }
+
+  string listCounts(const vector<unsigned int> &counts) {
+    stringstream list;
+    for (size_t i = 0; i < counts.size(); ++i)
+      list << (i == 0 ? "" : i + 1 == counts.size() ? " or " : ", ") << counts[i];
+    return list.str();
+  }
+}
+
+bool RenderOptions::flag(const string &name) const {
+  return find(flags.begin(), flags.end(), name) != flags.end();
+}
+
+bool RenderOptions::accepts(const string &name) const {
+  auto option = name == "--width" || name == "--height" ? "--size" : name;
+  return find(accepted.begin(), accepted.end(), option) != accepted.end();
+}
+
+string RenderOptions::frameOutput(unsigned int frame) const {
+  if (frames == 1 && firstFrame == 0) return output;
+
+  char number[16];
+  snprintf(number, sizeof(number), "_%04u", frame);
+  auto extension = output.find_last_of('.');
+  if (extension == string::npos || output.find('/', extension) != string::npos) return output + number;
+  return output.substr(0, extension) + number + output.substr(extension);
+}
+
+RenderOptions ppgso::parseOptions(int argc, char *argv[], const RenderOptions &defaults, const vector<string> &flags) {
+  RenderOptions options = defaults;
+  options.flags.clear();
+
+  for (int i = 1; i < argc; ++i) {
+    string option = argv[i];
+    if (option == "--help" || find(flags.begin(), flags.end(), option) != flags.end()) {
+      options.flags.push_back(option);
+      continue;
+    }
+
+    if (i + 1 >= argc)
+      throw runtime_error(option.compare(0, 2, "--") == 0 ? "Unknown option or missing value for " + option
+                                                          : "Unknown argument " + option);
+    string value = argv[++i];
+    if (!defaults.accepts(option)) {
+      throw runtime_error("Unknown option " + option);
+    } else if (option == "--width") {
+      options.width = (int) toNumber(option, value, 1);
+    } else if (option == "--height") {
+      options.height = (int) toNumber(option, value, 1);
+    } else if (option == "--size") {
+      auto separator = value.find('x');
+      if (separator == string::npos)
+        throw runtime_error("Invalid value '" + value + "' for --size, expected WIDTHxHEIGHT");
+      options.width = (int) toNumber(option, value.substr(0, separator), 1);
+      options.height = (int) toNumber(option, value.substr(separator + 1), 1);
+    } else if (option == "--spp") {
+      options.samples = (unsigned int) toNumber(option, value, 1);
+      auto &counts = defaults.sampleCounts;
+      if (!counts.empty() && find(counts.begin(), counts.end(), options.samples) == counts.end())
+        throw runtime_error("Unsupported value '" + value + "' for --spp, expected " + listCounts(counts));
+    } else if (option == "--depth") {
+      options.depth = (unsigned int) toNumber(option, value, 1);
+    } else if (option == "--threads") {
+      options.threads = (unsigned int) toNumber(option, value, 0);
+    } else if (option == "--tile") {
+      options.tileSize = (int) toNumber(option, value, 1);
+    } else if (option == "--seed") {
+      options.seed = toNumber(option, value, 0);
+    } else if (option == "--frames") {
+      options.frames = (unsigned int) toNumber(option, value, 1);
+    } else if (option == "--first-frame") {
+      options.firstFrame = (unsigned int) toNumber(option, value, 0);
+    } else if (option == "--pass-spp") {
+      options.passSamples = (unsigned int) toNumber(option, value, 1);
+    } else if (option == "--threshold") {
+      options.threshold = toReal(option, value);
+    } else if (option == "--scene") {
+      options.scene = value;
+    } else if (option == "--output") {
+      options.output = value;
+    } else {
+      throw runtime_error("Unknown option " + option);
+    }
+  }
+  return options;
+}
+
+void ppgso::printOptions(ostream &output, const string &program, const RenderOptions &defaults,
+                         const vector<pair<string, string>> &flags) {
+  output << "Usage: " << program << " [options]" << endl;
+  if (defaults.accepts("--scene"))
+    output << "  --scene FILE     Scene file to render instead of the built in scene" << endl;
+  if (defaults.accepts("--output"))
+    output << "  --output FILE    Output BMP image (" << defaults.output << ")" << endl;
+  if (defaults.accepts("--size"))
+    output << "  --size WxH       Image resolution, also --width and --height (" << defaults.width << "x" << defaults.height << ")" << endl;
+  if (defaults.accepts("--spp")) {
+    output << "  --spp N          Samples per pixel";
+    if (!defaults.sampleCounts.empty()) output << ", " << listCounts(defaults.sampleCounts);
+    output << " (" << defaults.samples << ")" << endl;
+  }
+  if (defaults.accepts("--depth"))
+    output << "  --depth N        Maximum number of ray bounces (" << defaults.depth << ")" << endl;
+  if (defaults.accepts("--threads"))
+    output << "  --threads N      Number of threads, 0 for all cores (" << defaults.threads << ")" << endl;
+  if (defaults.accepts("--tile"))
+    output << "  --tile N         Tile size in pixels (" << defaults.tileSize << ")" << endl;
+  if (defaults.accepts("--seed"))
+    output << "  --seed N         Seed of the random sequences (" << defaults.seed << ")" << endl;
+  if (defaults.accepts("--frames"))
+    output << "  --frames N       Number of animation frames to render, assets are loaded only once (" << defaults.frames << ")" << endl;
+  if (defaults.accepts("--first-frame"))
+    output << "  --first-frame N  Frame the sequence starts at (" << defaults.firstFrame << ")" << endl;
+  if (defaults.accepts("--pass-spp"))
+    output << "  --pass-spp N     Samples per pixel added by each progressive pass (" << defaults.passSamples << ")" << endl;
+  if (defaults.accepts("--threshold"))
+    output << "  --threshold X    Pixel noise at which tiles stop sampling, 0 to disable (" << defaults.threshold << ")" << endl;
+  for (auto &flag : flags) {
+    output << "  " << flag.first;
+    for (auto i = flag.first.size(); i < 17; ++i) output << ' ';
+    output << flag.second << endl;
+  }
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <ostream>
+#include <cstdint>
+
+namespace ppgso {
+
+  /*!
+   * Render settings shared by the command line of the raw renderers
+   */
+  struct RenderOptions {
+    int width = 512, height = 512;
+    unsigned int samples = 4, depth = 5;
+    unsigned int threads = 0;
+    int tileSize = 16;
+    uint64_t seed = 1;
+    unsigned int frames = 1, firstFrame = 0;
+    // Progressive rendering adds passSamples per pass and stops sampling tiles whose noise is below threshold
+    unsigned int passSamples = 4;
+    double threshold = 0;
+    std::string scene, output;
+    std::vector<std::string> flags;
+    // Common options the program honours, the others are rejected and left out of the help. --size also covers
+    // --width and --height
+    std::vector<std::string> accepted = {"--scene", "--output", "--size", "--spp", "--depth", "--threads", "--tile",
+                                         "--seed", "--frames", "--first-frame", "--pass-spp", "--threshold"};
+    // Supported numbers of samples per pixel, empty when any number is supported
+    std::vector<unsigned int> sampleCounts;
+
+    /*!
+     * Check if the program honours a common option
+     * @param name Name of the option including the dashes
+     * @return true if the option is listed in accepted
+     */
+    bool accepts(const std::string &name) const;
+
+    /*!
+     * Check if a switch without value such as --float was passed
+     * @param name Name of the switch including the dashes
+     * @return true if the switch was passed
+     */
+    bool flag(const std::string &name) const;
+
+    /*!
+     * Output file of a frame, sequences insert the zero padded frame number before the extension
+     * @param frame Frame of the sequence
+     * @return File path to write the frame to
+     */
+    std::string frameOutput(unsigned int frame) const;
+  };
+
+  /*!
+   * Parse the command line, throws std::runtime_error for unknown arguments and invalid values
+   *
+   * Recognized options are --width, --height, --size WxH, --spp, --depth, --threads, --tile, --seed, --frames,
+   * --first-frame, --pass-spp, --threshold, --scene and --output followed by a value, options missing from RenderOptions::accepted of the defaults
+   * and sample counts missing from RenderOptions::sampleCounts are rejected. Switches listed in flags and --help are
+   * stored in RenderOptions::flags.
+   * @param argc Number of arguments as passed to main
+   * @param argv Arguments as passed to main
+   * @param defaults Settings used for options missing on the command line
+   * @param flags Switches accepted by the program
+   * @return Parsed settings
+   */
+  RenderOptions parseOptions(int argc, char *argv[], const RenderOptions &defaults, const std::vector<std::string> &flags = {});
+
+  /*!
+   * Print the command line help
+   * @param output Stream to print to
+   * @param program Name of the program
+   * @param defaults Settings printed as default values, only the accepted options are listed
+   * @param flags Switches accepted by the program with their description
+   */
+  void printOptions(std::ostream &output, const std::string &program, const RenderOptions &defaults,
+                    const std::vector<std::pair<std::string, std::string>> &flags = {});
+}
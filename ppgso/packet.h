@@ -0,0 +1,119 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+#include "simd.h"
+
+namespace ppgso {
+
+  /*!
+   * SIMD lanes used for packets of rays in precision T, an AVX register holds four double or eight float rays
+   */
+  template<typename T>
+  struct PacketLanes;
+
+  template<>
+  struct PacketLanes<double> {
+    using type = simd::double4;
+  };
+
+  template<>
+  struct PacketLanes<float> {
+    using type = simd::float8;
+  };
+
+  /*!
+   * Packet of rays traced together, stored as structure of arrays with one SIMD lane per ray
+   * Packets cover blocks of WIDTH x 2 pixels, 2x2 in double and 4x2 in float precision
+   */
+  template<typename T>
+  struct RayPacket {
+    using Lanes = typename PacketLanes<T>::type;
+    static const int SIZE = Lanes::SIZE;
+    static const int WIDTH = SIZE / 2;
+    Lanes origin[3], direction[3];
+
+    RayPacket() = default;
+
+    /*!
+     * Transpose individual rays into the packet
+     * @param origins Origins of SIZE rays
+     * @param directions Directions of SIZE rays
+     */
+    template<glm::precision P>
+    RayPacket(const glm::tvec3<T, P> *origins, const glm::tvec3<T, P> *directions) {
+      for (int axis = 0; axis < 3; ++axis) {
+        T o[SIZE], d[SIZE];
+        for (int i = 0; i < SIZE; ++i) {
+          o[i] = origins[i][axis];
+          d[i] = directions[i][axis];
+        }
+        origin[axis] = Lanes::load(o);
+        direction[axis] = Lanes::load(d);
+      }
+    }
+  };
+
+  /*!
+   * Sphere geometry stored as structure of arrays so a sphere can be broadcast to all lanes of a packet
+   */
+  template<typename T>
+  struct SphereArrays {
+    using Lanes = typename PacketLanes<T>::type;
+    std::vector<T> x, y, z, radius;
+
+    /*!
+     * Append a sphere
+     * @param center Center of the sphere
+     * @param r Radius of the sphere
+     */
+    template<glm::precision P>
+    void push_back(const glm::tvec3<T, P> &center, T r) {
+      x.push_back(center.x);
+      y.push_back(center.y);
+      z.push_back(center.z);
+      radius.push_back(r);
+    }
+
+    /*!
+     * Intersect all rays of a packet with a single sphere
+     * The discriminant is computed from the distance of the sphere center to the ray like in the single ray test, so
+     * large spheres keep their precision in float lanes
+     * @param packet Rays to test
+     * @param index Index of the sphere to test
+     * @param epsilon Hits closer than epsilon are ignored
+     * @param distance Closest hit distance of each ray, updated for lanes where this sphere is closer
+     * @param hit Index of the closest sphere for each ray, updated together with distance
+     */
+    void intersect(const RayPacket<T> &packet, uint32_t index, T epsilon, Lanes &distance, Lanes &hit) const {
+      Lanes ocx = packet.origin[0] - Lanes{x[index]};
+      Lanes ocy = packet.origin[1] - Lanes{y[index]};
+      Lanes ocz = packet.origin[2] - Lanes{z[index]};
+      const Lanes &dx = packet.direction[0], &dy = packet.direction[1], &dz = packet.direction[2];
+
+      Lanes a = dx * dx + dy * dy + dz * dz;
+      Lanes b = ocx * dx + ocy * dy + ocz * dz;
+      // Divisions are slow, the reciprocal of a is shared by all three of them
+      Lanes inverseA = Lanes{1} / a;
+      Lanes s = b * inverseA;
+      Lanes lx = ocx - dx * s, ly = ocy - dy * s, lz = ocz - dz * s;
+      Lanes dis = a * (Lanes{radius[index] * radius[index]} - (lx * lx + ly * ly + lz * lz));
+
+      // Skip the expensive part when all rays miss
+      Lanes valid = dis > Lanes{0};
+      if (!simd::bits(valid)) return;
+
+      // Near intersection is used when in front of the ray, otherwise the far one
+      Lanes e = simd::sqrt(simd::max(dis, Lanes{0}));
+      Lanes tNear = (-b - e) * inverseA;
+      Lanes tFar = (-b + e) * inverseA;
+      Lanes t = select(tNear > Lanes{epsilon}, tNear, tFar);
+
+      valid = valid & (t > Lanes{epsilon}) & (t < distance);
+      distance = select(valid, t, distance);
+      hit = select(valid, Lanes::index(index), hit);
+    }
+  };
+}
@@ -4,12 +4,23 @@
 #include <glm/gtc/random.hpp>
 #include <glm/gtx/compatibility.hpp>
 
+#include "bvh.h"
 #include "mesh.h"
+#include "mesh_file.h"
+#include "offset.h"
+#include "options.h"
+#include "packet.h"
+#include "random.h"
+#include "sampling.h"
+#include "scene_file.h"
+#include "scheduler.h"
 #include "shader.h"
 #include "image.h"
 #include "image_bmp.h"
 #include "image_raw.h"
+#include "image_writer.h"
 #include "texture.h"
+#include "triangles.h"
 #include "window.h"
 
 namespace ppgso {
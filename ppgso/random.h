@@ -0,0 +1,70 @@
+#pragma once
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+namespace ppgso {
+
+  /*!
+   * Small random number generator using the PCG32 algorithm by Melissa O'Neill.
+   *
+   * Unlike glm::linearRand, which relies on the global std::rand state, each instance owns its state. The sequence is
+   * fully determined by the seed and stream, so using one stream per pixel makes renders reproducible no matter
+   * how many threads render the image or in which order, and threads never contend for a shared state.
+   */
+  class Random {
+  public:
+    /*!
+     * Initialize the generator
+     * @param seed Seed common for the whole render
+     * @param stream Independent sequence to select, for example the pixel index
+     */
+    Random(uint64_t seed = 0, uint64_t stream = 0) {
+      increment = (stream << 1u) | 1u;
+      state = 0;
+      next();
+      state += seed;
+      next();
+    }
+
+    /*!
+     * Generate next 32bit random number
+     * @return Uniformly distributed random integer
+     */
+    uint32_t next() {
+      uint64_t old = state;
+      state = old * 6364136223846793005ULL + increment;
+      auto xorShifted = (uint32_t) (((old >> 18u) ^ old) >> 27u);
+      auto rotation = (uint32_t) (old >> 59u);
+      return (xorShifted >> rotation) | (xorShifted << ((32 - rotation) & 31));
+    }
+
+    /*!
+     * Generate a uniformly distributed number, mirrors glm::linearRand
+     * @param min Minimum value
+     * @param max Maximum value
+     * @return Random number in range <min, max)
+     */
+    double linearRand(double min, double max) {
+      return min + (max - min) * (next() * (1.0 / 4294967296.0));
+    }
+
+    /*!
+     * Generate a random point on the surface of a sphere, mirrors glm::sphericalRand
+     * @param radius Radius of the sphere
+     * @return Uniformly distributed point on the sphere
+     */
+    glm::dvec3 sphericalRand(double radius) {
+      double z = linearRand(-1.0, 1.0);
+      double phi = linearRand(0.0, glm::two_pi<double>());
+      double r = std::sqrt(std::max(0.0, 1.0 - z * z));
+      return glm::dvec3{r * std::cos(phi), r * std::sin(phi), z} * radius;
+    }
+
+  private:
+    uint64_t state, increment;
+  };
+}
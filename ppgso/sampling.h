@@ -0,0 +1,185 @@
+#pragma once
+#include <cmath>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include "random.h"
+
+namespace ppgso {
+  namespace sampling {
+
+    /*!
+     * Build two tangent vectors that together with the normal form an orthonormal basis
+     * Uses the branchless construction by Duff et al. "Building an Orthonormal Basis, Revisited"
+     * @param normal Normalized vector
+     * @param tangent Output vector perpendicular to normal
+     * @param bitangent Output vector perpendicular to both normal and tangent
+     */
+    inline void orthonormalBasis(const glm::dvec3 &normal, glm::dvec3 &tangent, glm::dvec3 &bitangent) {
+      double sign = std::copysign(1.0, normal.z);
+      double a = -1.0 / (sign + normal.z);
+      double b = normal.x * normal.y * a;
+      tangent = {1.0 + sign * normal.x * normal.x * a, sign * b, -sign * normal.x};
+      bitangent = {b, sign + normal.y * normal.y * a, -normal.y};
+    }
+
+    /*!
+     * Generate a direction on a hemisphere distributed proportionally to the cosine of the angle with its normal
+     * Uses Malley's method, a uniformly distributed point on a disk is projected up to the hemisphere, so no samples
+     * are rejected and only two random numbers are needed. Matches the Lambertian reflectance, so the reflected
+     * color of a diffuse surface is just its albedo.
+     * @param normal Normalized vector that defines the hemisphere
+     * @param u Uniformly distributed point in the unit square, for example from stratified
+     * @return Normalized direction on the hemisphere
+     */
+    inline glm::dvec3 cosineHemisphere(const glm::dvec3 &normal, const glm::dvec2 &u) {
+      double r = std::sqrt(u.x);
+      double phi = u.y * glm::two_pi<double>();
+      double x = r * std::cos(phi), y = r * std::sin(phi);
+      double z = std::sqrt(std::max(0.0, 1.0 - x * x - y * y));
+      glm::dvec3 tangent, bitangent;
+      orthonormalBasis(normal, tangent, bitangent);
+      return tangent * x + bitangent * y + normal * z;
+    }
+
+    /*!
+     * Generate a cosine distributed direction on a hemisphere from fresh random numbers
+     * @param normal Normalized vector that defines the hemisphere
+     * @param random Random number generator to use
+     * @return Normalized direction on the hemisphere
+     */
+    inline glm::dvec3 cosineHemisphere(const glm::dvec3 &normal, Random &random) {
+      double u = random.linearRand(0.0, 1.0);
+      return cosineHemisphere(normal, {u, random.linearRand(0.0, 1.0)});
+    }
+
+    /*!
+     * Probability density of cosineHemisphere with respect to solid angle
+     * @param cosTheta Cosine of the angle between the direction and the normal
+     * @return Density of the direction
+     */
+    inline double cosineHemispherePdf(double cosTheta) {
+      return std::max(cosTheta, 0.0) * glm::one_over_pi<double>();
+    }
+
+    /*!
+     * Generate a direction uniformly distributed inside a cone, used to sample directions towards a sphere
+     * @param axis Normalized axis of the cone
+     * @param cosThetaMax Cosine of the cone half angle
+     * @param u Uniformly distributed point in the unit square, for example from stratified
+     * @return Normalized direction inside the cone
+     */
+    inline glm::dvec3 uniformCone(const glm::dvec3 &axis, double cosThetaMax, const glm::dvec2 &u) {
+      double cosTheta = 1.0 - u.x * (1.0 - cosThetaMax);
+      double sinTheta = std::sqrt(std::max(0.0, 1.0 - cosTheta * cosTheta));
+      double phi = u.y * glm::two_pi<double>();
+      glm::dvec3 tangent, bitangent;
+      orthonormalBasis(axis, tangent, bitangent);
+      return tangent * (sinTheta * std::cos(phi)) + bitangent * (sinTheta * std::sin(phi)) + axis * cosTheta;
+    }
+
+    /*!
+     * Generate a direction uniformly distributed inside a cone from fresh random numbers
+     * @param axis Normalized axis of the cone
+     * @param cosThetaMax Cosine of the cone half angle
+     * @param random Random number generator to use
+     * @return Normalized direction inside the cone
+     */
+    inline glm::dvec3 uniformCone(const glm::dvec3 &axis, double cosThetaMax, Random &random) {
+      double u = random.linearRand(0.0, 1.0);
+      return uniformCone(axis, cosThetaMax, {u, random.linearRand(0.0, 1.0)});
+    }
+
+    /*!
+     * Probability density of uniformCone with respect to solid angle
+     * @param cosThetaMax Cosine of the cone half angle
+     * @return Density of any direction inside the cone
+     */
+    inline double uniformConePdf(double cosThetaMax) {
+      return 1.0 / (glm::two_pi<double>() * (1.0 - cosThetaMax));
+    }
+
+    /*!
+     * Samples of one pixel that share the cells of stratified, the scramble is drawn once for all of them
+     */
+    struct Strata {
+      unsigned int sample = 0;  // Index of the sample
+      unsigned int count = 1;   // Number of samples sharing the cells, 1 gives plain random points
+      uint32_t scramble = 0;    // Random value that selects the order of the cells in each dimension
+    };
+
+    /*!
+     * Pseudo random permutation of the integers 0 to count - 1 without storing it
+     * Uses the hash based permutation by Kensler "Correlated Multi-Jittered Sampling"
+     * @param index Integer to permute
+     * @param count Number of integers in the permutation
+     * @param seed Value selecting the permutation
+     * @return Position of index in the permutation
+     */
+    inline uint32_t permute(uint32_t index, uint32_t count, uint32_t seed) {
+      uint32_t mask = count - 1;
+      mask |= mask >> 1;
+      mask |= mask >> 2;
+      mask |= mask >> 4;
+      mask |= mask >> 8;
+      mask |= mask >> 16;
+      // Cycle walking, values outside the range are hashed again until they fall inside
+      do {
+        index ^= seed; index *= 0xe170893d;
+        index ^= seed >> 16; index ^= (index & mask) >> 4;
+        index ^= seed >> 8; index *= 0x0929eb3f;
+        index ^= seed >> 23; index ^= (index & mask) >> 1;
+        index *= 1 | seed >> 27; index *= 0x6935fa69;
+        index ^= (index & mask) >> 11; index *= 0x74dcb303;
+        index ^= (index & mask) >> 2; index *= 0x9e501cc3;
+        index ^= (index & mask) >> 2; index *= 0xc860a3df;
+        index &= mask; index ^= index >> 5;
+      } while (index >= count);
+      return (index + seed) % count;
+    }
+
+    /*!
+     * Generate a point in one cell of the unit square, the samples of the strata together cover the square evenly
+     * A square count splits the square into a grid, other counts into vertical strips. Each dimension visits the cells
+     * in its own random order selected by the scramble, so like in Latin hypercube sampling the decisions of one
+     * sample stay independent of each other and only their distribution over the samples is stratified.
+     * @param strata Sample and the samples it shares the cells with
+     * @param dimension Index of the decision the point is used for
+     * @param random Random number generator used for the position inside the cell
+     * @return Point in the unit square
+     */
+    inline glm::dvec2 stratified(const Strata &strata, unsigned int dimension, Random &random) {
+      double x = random.linearRand(0.0, 1.0), y = random.linearRand(0.0, 1.0);
+      if (strata.count <= 1) return {x, y};
+      // Mix the dimension into the scramble so every dimension gets an independent permutation
+      uint32_t seed = strata.scramble + dimension * 0x9e3779b9u;
+      seed ^= seed >> 16; seed *= 0x85ebca6b;
+      seed ^= seed >> 13; seed *= 0xc2b2ae35;
+      seed ^= seed >> 16;
+      uint32_t cell = permute(strata.sample, strata.count, seed);
+      auto columns = (unsigned int) std::lround(std::sqrt((double) strata.count));
+      if (columns * columns != strata.count) return {(cell + x) / strata.count, y};
+      return {(cell % columns + x) / columns, (cell / columns + y) / columns};
+    }
+
+    /*!
+     * Probability density of uniformly distributed directions on a hemisphere with respect to solid angle
+     */
+    inline double uniformHemispherePdf() {
+      return 1.0 / glm::two_pi<double>();
+    }
+
+    /*!
+     * Weight of a sample for multiple importance sampling of two strategies using the power heuristic
+     * @param pdf Density of the strategy that generated the sample
+     * @param otherPdf Density of the other strategy for the same sample
+     * @return Weight in range <0, 1>
+     */
+    inline double powerHeuristic(double pdf, double otherPdf) {
+      double a = pdf * pdf, b = otherPdf * otherPdf;
+      return a + b > 0 ? a / (a + b) : 0.0;
+    }
+  }
+}
@@ -0,0 +1,196 @@
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "scene_file.h"
+
+using namespace std;
+using namespace glm;
+using namespace ppgso;
+
+namespace {
+
+  /*!
+   * Splits a single line into whitespace separated tokens without copying them
+   */
+  class LineParser {
+  public:
+    LineParser(const string &name, unsigned long line, const char *text) : name{name}, line{line}, position{text} {}
+
+    /*!
+     * Move to the next token, returns false at the end of the line or at a comment
+     */
+    bool next() {
+      while (*position == ' ' || *position == '\t' || *position == '\r') ++position;
+      if (*position == '\0' || *position == '#') return false;
+      token = position;
+      while (*position != '\0' && *position != ' ' && *position != '\t' && *position != '\r' && *position != '#')
+        ++position;
+      length = (size_t) (position - token);
+      return true;
+    }
+
+    bool is(const char *keyword) const {
+      return strlen(keyword) == length && strncmp(token, keyword, length) == 0;
+    }
+
+    string word() {
+      if (!next()) fail("Missing value");
+      return {token, length};
+    }
+
+    double number() {
+      if (!next()) fail("Missing number");
+      char *end;
+      double value = strtod(token, &end);
+      if (end != position) fail("Invalid number '" + string{token, length} + "'");
+      return value;
+    }
+
+    dvec3 vector() {
+      double x = number();
+      double y = number();
+      return {x, y, number()};
+    }
+
+    [[noreturn]] void fail(const string &message) const {
+      stringstream msg;
+      msg << name << ":" << line << ": " << message;
+      throw runtime_error(msg.str());
+    }
+
+    [[noreturn]] void unknown() const {
+      fail("Unknown keyword '" + string{token, length} + "'");
+    }
+
+  private:
+    const string &name;
+    unsigned long line;
+    const char *position;
+    const char *token = nullptr;
+    size_t length = 0;
+  };
+
+  string resolve(const string &directory, const string &file) {
+    if (directory.empty() || file.empty() || file[0] == '/') return file;
+    return directory + "/" + file;
+  }
+}
+
+scene::Description scene::parse(istream &input, const string &name, const string &directory) {
+  Description scene;
+  unordered_map<string, uint32_t> materials;
+  auto material = [&](LineParser &parser) {
+    auto found = materials.find(parser.word());
+    if (found == materials.end()) parser.fail("Undefined material");
+    return found->second;
+  };
+
+  string text;
+  unsigned long line = 0;
+  while (getline(input, text)) {
+    LineParser parser{name, ++line, text.c_str()};
+    if (!parser.next()) continue;
+
+    if (parser.is("camera")) {
+      auto &camera = scene.camera;
+      while (parser.next()) {
+        if (parser.is("position")) camera.position = parser.vector();
+        else if (parser.is("target")) camera.target = parser.vector();
+        else if (parser.is("up")) camera.up = parser.vector();
+        else if (parser.is("fov")) camera.fov = parser.number();
+        else if (parser.is("near")) camera.near = parser.number();
+        else if (parser.is("far")) camera.far = parser.number();
+        else parser.unknown();
+      }
+    } else if (parser.is("material")) {
+      Material m;
+      m.name = parser.word();
+      while (parser.next()) {
+        if (parser.is("emission")) m.emission = parser.vector();
+        else if (parser.is("diffuse")) m.diffuse = parser.vector();
+        else if (parser.is("reflectivity")) m.reflectivity = parser.number();
+        else if (parser.is("transparency")) m.transparency = parser.number();
+        else if (parser.is("ior")) m.refractionIndex = parser.number();
+        else if (parser.is("shininess")) m.shininess = parser.number();
+        else if (parser.is("texture")) m.texture = resolve(directory, parser.word());
+        else parser.unknown();
+      }
+      // Redefining a material only affects the entries that follow
+      materials[m.name] = (uint32_t) scene.materials.size();
+      scene.materials.push_back(m);
+    } else if (parser.is("sphere")) {
+      Sphere sphere{{0, 0, 0}, 1, 0};
+      bool hasMaterial = false;
+      while (parser.next()) {
+        if (parser.is("center")) sphere.center = parser.vector();
+        else if (parser.is("radius")) sphere.radius = parser.number();
+        else if (parser.is("material")) {
+          sphere.material = material(parser);
+          hasMaterial = true;
+        } else parser.unknown();
+      }
+      if (!hasMaterial) parser.fail("Sphere without material");
+      scene.spheres.push_back(sphere);
+    } else if (parser.is("light")) {
+      Light light{{0, 0, 0}, {1, 1, 1}};
+      while (parser.next()) {
+        if (parser.is("position")) light.position = parser.vector();
+        else if (parser.is("color")) light.color = parser.vector();
+        else if (parser.is("attenuation")) light.attenuation = parser.vector();
+        else parser.unknown();
+      }
+      scene.lights.push_back(light);
+    } else if (parser.is("mesh")) {
+      Mesh mesh{resolve(directory, parser.word()), mat4{1.0f}, 0};
+      bool hasMaterial = false;
+      while (parser.next()) {
+        if (parser.is("material")) {
+          mesh.material = material(parser);
+          hasMaterial = true;
+        } else if (parser.is("translate")) {
+          mesh.transform = translate(mesh.transform, vec3{parser.vector()});
+        } else if (parser.is("rotate")) {
+          auto angle = (float) radians(parser.number());
+          mesh.transform = rotate(mesh.transform, angle, vec3{parser.vector()});
+        } else if (parser.is("scale")) {
+          mesh.transform = scale(mesh.transform, vec3{parser.vector()});
+        } else if (parser.is("spin")) {
+          mesh.spin = parser.number();
+        } else {
+          parser.unknown();
+        }
+      }
+      if (!hasMaterial) parser.fail("Mesh without material");
+      scene.meshes.push_back(mesh);
+    } else {
+      parser.unknown();
+    }
+  }
+  return scene;
+}
+
+scene::Description scene::load(const string &file) {
+  ifstream input{file};
+  if (!input) {
+    stringstream msg;
+    msg << "Failed to open scene file " << file << "!" << endl;
+    throw runtime_error(msg.str());
+  }
+
+  auto separator = file.find_last_of('/');
+  return parse(input, file, separator == string::npos ? "" : file.substr(0, separator));
+}
+
+mat4 scene::turntable(const mat4 &transform, double spin, unsigned int frame) {
+  if (spin == 0) return transform;
+  // Rotate around the vertical axis passing through the transformed origin of the mesh
+  vec3 pivot{transform[3]};
+  auto angle = (float) radians(spin * frame);
+  return translate(mat4{1.0f}, pivot) * rotate(mat4{1.0f}, angle, vec3{0, 1, 0}) * translate(mat4{1.0f}, -pivot) * transform;
+}
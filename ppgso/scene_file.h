@@ -0,0 +1,109 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <istream>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+namespace ppgso {
+namespace scene {
+
+  /*!
+   * Surface properties, each renderer uses the subset it understands
+   */
+  struct Material {
+    std::string name;
+    glm::dvec3 emission{0, 0, 0}, diffuse{0, 0, 0};
+    double reflectivity = 0;
+    double transparency = 0, refractionIndex = 1;
+    double shininess = 1;
+    std::string texture;
+  };
+
+  /*!
+   * Camera looking from position at target, fov is the vertical field of view in degrees
+   */
+  struct Camera {
+    glm::dvec3 position{0, 0, 25}, target{0, 0, 0}, up{0, 1, 0};
+    double fov = 53.13010235415598;
+    double near = 1, far = 100;
+  };
+
+  /*!
+   * Sphere referencing a material by its index in Description::materials
+   */
+  struct Sphere {
+    glm::dvec3 center;
+    double radius;
+    uint32_t material;
+  };
+
+  /*!
+   * Point light with constant, linear and quadratic attenuation
+   */
+  struct Light {
+    glm::dvec3 position, color;
+    glm::dvec3 attenuation{1, 0, 0};
+  };
+
+  /*!
+   * Wavefront .obj file placed in the scene using a transformation
+   * Animated sequences turn the mesh around the vertical axis through its origin by spin degrees each frame
+   */
+  struct Mesh {
+    std::string file;
+    glm::mat4 transform;
+    uint32_t material;
+    double spin = 0;
+  };
+
+  /*!
+   * Renderer independent content of a scene file
+   */
+  struct Description {
+    Camera camera;
+    std::vector<Material> materials;
+    std::vector<Sphere> spheres;
+    std::vector<Light> lights;
+    std::vector<Mesh> meshes;
+  };
+
+  /*!
+   * Load a scene file, throws std::runtime_error with the file name and line when the file can not be parsed.
+   *
+   * The file is read line by line, each line holds one entry followed by keyword value pairs in any order.
+   * Empty lines and text following # are ignored. Materials are referenced by name and have to be defined before use.
+   *
+   *   camera position 0 0 25 target 0 0 0 up 0 1 0 fov 53.13 near 1 far 100
+   *   material <name> emission r g b diffuse r g b reflectivity x transparency x ior x shininess x texture file.bmp
+   *   sphere center x y z radius r material <name>
+   *   light position x y z color r g b attenuation constant linear quadratic
+   *   mesh file.obj material <name> translate x y z rotate degrees x y z scale x y z spin degrees
+   *
+   * Mesh transformations are combined in the order they are written, so the last one is applied to the vertices first.
+   * Relative texture and mesh paths are resolved against the directory of the scene file.
+   * @param file File path to the scene file
+   * @return Parsed scene
+   */
+  Description load(const std::string &file);
+
+  /*!
+   * Parse a scene from a stream, see load for the format
+   * @param input Stream to read the scene from
+   * @param name Name used in error messages
+   * @param directory Directory prepended to relative texture and mesh paths, empty to keep them unchanged
+   * @return Parsed scene
+   */
+  Description parse(std::istream &input, const std::string &name, const std::string &directory = "");
+
+  /*!
+   * Compute the transformation of a mesh spinning on a turntable
+   * @param transform Transformation of the mesh in the first frame
+   * @param spin Rotation in degrees added each frame around the vertical axis through the origin of the mesh
+   * @param frame Frame of the sequence
+   * @return Transformation of the mesh in the frame
+   */
+  glm::mat4 turntable(const glm::mat4 &transform, double spin, unsigned int frame);
+}
+}
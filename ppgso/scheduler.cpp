@@ -0,0 +1,176 @@
+#include <chrono>
+#include <algorithm>
+#include <iomanip>
+
+#include "scheduler.h"
+
+using namespace std;
+using namespace ppgso;
+
+TileScheduler::TileScheduler(unsigned int threadCount, int tileSize) : tileSize{std::max(tileSize, 1)} {
+  if (threadCount == 0)
+    threadCount = std::max(thread::hardware_concurrency(), 1u);
+
+  for (unsigned int i = 0; i < threadCount; ++i)
+    queues.emplace_back(new Queue);
+  statistics.resize(threadCount);
+
+  // Thread 0 is the thread calling run
+  for (unsigned int i = 1; i < threadCount; ++i)
+    threads.emplace_back(&TileScheduler::worker, this, i);
+}
+
+TileScheduler::~TileScheduler() {
+  {
+    lock_guard<std::mutex> lock{mutex};
+    stop = true;
+  }
+  start.notify_all();
+  for (auto &thread : threads)
+    thread.join();
+}
+
+void TileScheduler::run(int width, int height, const Task &job) {
+  vector<Tile> tiles;
+  for (int y = 0; y < height; y += tileSize)
+    for (int x = 0; x < width; x += tileSize)
+      tiles.push_back({x, y, std::min(tileSize, width - x), std::min(tileSize, height - y)});
+  dispatch(tiles, job);
+}
+
+void TileScheduler::runRange(int count, int chunkSize, const Task &job) {
+  chunkSize = std::max(chunkSize, 1);
+  vector<Tile> tiles;
+  for (int x = 0; x < count; x += chunkSize)
+    tiles.push_back({x, 0, std::min(chunkSize, count - x), 1});
+  dispatch(tiles, job);
+}
+
+void TileScheduler::dispatch(const vector<Tile> &tiles, const Task &job) {
+  auto threadCount = getThreadCount();
+
+  // Hand out contiguous runs of tiles so each thread starts on a coherent region of the image
+  for (unsigned int i = 0; i < threadCount; ++i) {
+    auto first = tiles.begin() + tiles.size() * i / threadCount;
+    auto last = tiles.begin() + tiles.size() * (i + 1) / threadCount;
+    queues[i]->tiles.assign(first, last);
+  }
+
+  // Busy time before this run, the rest of the run time is idle
+  vector<double> busy(threadCount);
+  for (unsigned int i = 0; i < threadCount; ++i)
+    busy[i] = statistics[i].busy;
+  auto begin = chrono::steady_clock::now();
+
+  // Wake up the workers and take part in the work
+  {
+    lock_guard<std::mutex> lock{mutex};
+    task = &job;
+    running = threadCount - 1;
+    generation++;
+  }
+  start.notify_all();
+
+  process(0);
+
+  unique_lock<std::mutex> lock{mutex};
+  finish.wait(lock, [&] { return running == 0; });
+  task = nullptr;
+
+  // Threads that run out of work idle until the slowest thread finishes
+  double duration = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+  for (unsigned int i = 0; i < threadCount; ++i)
+    statistics[i].idle += std::max(0.0, duration - (statistics[i].busy - busy[i]));
+}
+
+unsigned int TileScheduler::getThreadCount() const {
+  return (unsigned int) queues.size();
+}
+
+int TileScheduler::getTileSize() const {
+  return tileSize;
+}
+
+const vector<TileScheduler::Statistics> &TileScheduler::getStatistics() const {
+  return statistics;
+}
+
+void TileScheduler::resetStatistics() {
+  statistics.assign(statistics.size(), Statistics{});
+}
+
+void TileScheduler::printStatistics(ostream &output) const {
+  auto flags = output.flags();
+  auto precision = output.precision();
+  for (unsigned int i = 0; i < statistics.size(); ++i) {
+    auto &s = statistics[i];
+    double total = s.busy + s.idle;
+    output << "Thread " << setw(3) << i << ": " << setw(5) << s.tiles << " tiles (" << s.stolen << " stolen), "
+           << fixed << setprecision(3) << "busy " << s.busy << " s, idle " << s.idle << " s, "
+           << setprecision(1) << (total > 0 ? 100.0 * s.busy / total : 0.0) << "% utilization" << endl;
+  }
+  output.flags(flags);
+  output.precision(precision);
+}
+
+void TileScheduler::worker(unsigned int thread) {
+  unsigned long seen = 0;
+  while (true) {
+    {
+      unique_lock<std::mutex> lock{mutex};
+      start.wait(lock, [&] { return stop || generation != seen; });
+      if (stop) return;
+      seen = generation;
+    }
+
+    process(thread);
+
+    {
+      lock_guard<std::mutex> lock{mutex};
+      running--;
+    }
+    finish.notify_one();
+  }
+}
+
+void TileScheduler::process(unsigned int thread) {
+  auto &stats = statistics[thread];
+
+  Tile tile;
+  bool stolen;
+  while (pop(thread, tile, stolen)) {
+    auto begin = chrono::steady_clock::now();
+    (*task)(tile, thread);
+    stats.busy += chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    stats.tiles++;
+    if (stolen) stats.stolen++;
+  }
+}
+
+bool TileScheduler::pop(unsigned int thread, Tile &tile, bool &stolen) {
+  // Take the next tile from the own queue
+  {
+    auto &queue = *queues[thread];
+    lock_guard<std::mutex> lock{queue.mutex};
+    if (!queue.tiles.empty()) {
+      tile = queue.tiles.front();
+      queue.tiles.pop_front();
+      stolen = false;
+      return true;
+    }
+  }
+
+  // Steal from the back of the other queues, furthest away from where their owners work
+  auto threadCount = getThreadCount();
+  for (unsigned int i = 1; i < threadCount; ++i) {
+    auto &queue = *queues[(thread + i) % threadCount];
+    lock_guard<std::mutex> lock{queue.mutex};
+    if (!queue.tiles.empty()) {
+      tile = queue.tiles.back();
+      queue.tiles.pop_back();
+      stolen = true;
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,122 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <ostream>
+
+namespace ppgso {
+
+  /*!
+   * Rectangular region of an image that is processed as a single unit of work
+   */
+  struct Tile {
+    int x, y, width, height;
+  };
+
+  /*!
+   * Thread pool that splits an image into tiles and processes them in parallel.
+   *
+   * Each thread owns a queue of tiles that it processes front to back, threads that run out of work steal tiles
+   * from the back of other queues so expensive regions of the image do not leave cores idle at the end of a frame.
+   * The calling thread takes part in the work as thread 0.
+   */
+  class TileScheduler {
+  public:
+    /*!
+     * Time spent by a single thread, accumulated over all runs
+     */
+    struct Statistics {
+      double busy = 0, idle = 0;
+      unsigned int tiles = 0, stolen = 0;
+    };
+
+    /*!
+     * Function that processes a single tile, thread is the index of the thread running it
+     */
+    using Task = std::function<void(const Tile &tile, unsigned int thread)>;
+
+    /*!
+     * Start the worker threads
+     * @param threads Number of threads to use including the calling thread, 0 uses all hardware threads
+     * @param tileSize Width and height of the tiles in pixels
+     */
+    TileScheduler(unsigned int threads = 0, int tileSize = 32);
+
+    ~TileScheduler();
+
+    TileScheduler(const TileScheduler &) = delete;
+    TileScheduler &operator=(const TileScheduler &) = delete;
+
+    /*!
+     * Split an area into tiles and process all of them, returns once all tiles are done
+     * @param width Width of the area in pixels
+     * @param height Height of the area in pixels
+     * @param task Function to call for each tile
+     */
+    void run(int width, int height, const Task &task);
+
+    /*!
+     * Split a range of items into chunks and process all of them, returns once all chunks are done
+     * Chunks are passed to the task as tiles with height 1, x is the first item and width the number of items
+     * @param count Number of items
+     * @param chunkSize Number of items in a chunk
+     * @param task Function to call for each chunk
+     */
+    void runRange(int count, int chunkSize, const Task &task);
+
+    /*!
+     * Number of threads including the calling thread
+     */
+    unsigned int getThreadCount() const;
+
+    /*!
+     * Tile size in pixels
+     */
+    int getTileSize() const;
+
+    /*!
+     * Busy and idle time of each thread accumulated over all runs since the last reset
+     */
+    const std::vector<Statistics> &getStatistics() const;
+
+    /*!
+     * Clear accumulated statistics
+     */
+    void resetStatistics();
+
+    /*!
+     * Print per thread statistics in human readable form
+     * @param output Stream to print to
+     */
+    void printStatistics(std::ostream &output) const;
+
+  private:
+    struct Queue {
+      std::mutex mutex;
+      std::deque<Tile> tiles;
+    };
+
+    void dispatch(const std::vector<Tile> &tiles, const Task &task);
+    void worker(unsigned int thread);
+    void process(unsigned int thread);
+    bool pop(unsigned int thread, Tile &tile, bool &stolen);
+
+    int tileSize;
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<Statistics> statistics;
+    std::vector<std::thread> threads;
+
+    // Current job shared with the workers
+    const Task *task = nullptr;
+    std::mutex mutex;
+    std::condition_variable start, finish;
+    unsigned long generation = 0;
+    unsigned int running = 0;
+    bool stop = false;
+  };
+}
@@ -0,0 +1,607 @@
+#pragma once
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+
+// Instruction set is selected at build time, SSE2 on x86-64 unless USE_AVX or USE_NATIVE_ARCH is set in CMakeLists.txt
+// Define PPGSO_NO_SIMD to force the portable scalar fallback
+#if defined(PPGSO_NO_SIMD)
+#elif defined(__AVX__)
+#define PPGSO_SIMD_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PPGSO_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace ppgso {
+  namespace simd {
+
+    /*!
+     * Name of the instruction set the lane types were compiled for
+     */
+#if defined(PPGSO_SIMD_AVX)
+    const char *const ISA = "AVX";
+#elif defined(PPGSO_SIMD_SSE2)
+    const char *const ISA = "SSE2";
+#else
+    const char *const ISA = "scalar";
+#endif
+
+    /*!
+     * Four double precision lanes processed together
+     * Comparison operators return masks with all bits of a lane set, masks are consumed by select and bits
+     */
+    struct double4 {
+      using Scalar = double;
+      static const int SIZE = 4;
+
+#if defined(PPGSO_SIMD_AVX)
+      __m256d v;
+#elif defined(PPGSO_SIMD_SSE2)
+      __m128d lo, hi;
+#else
+      double v[4];
+#endif
+
+      double4() = default;
+
+      /*!
+       * Broadcast a single value to all lanes
+       * @param value Value to broadcast
+       */
+      double4(double value) {
+#if defined(PPGSO_SIMD_AVX)
+        v = _mm256_set1_pd(value);
+#elif defined(PPGSO_SIMD_SSE2)
+        lo = hi = _mm_set1_pd(value);
+#else
+        v[0] = v[1] = v[2] = v[3] = value;
+#endif
+      }
+
+      /*!
+       * Load four values from unaligned memory
+       * @param data Pointer to four doubles
+       * @return Lanes containing the data
+       */
+      static double4 load(const double *data) {
+        double4 r;
+#if defined(PPGSO_SIMD_AVX)
+        r.v = _mm256_loadu_pd(data);
+#elif defined(PPGSO_SIMD_SSE2)
+        r.lo = _mm_loadu_pd(data);
+        r.hi = _mm_loadu_pd(data + 2);
+#else
+        std::copy(data, data + 4, r.v);
+#endif
+        return r;
+      }
+
+      /*!
+       * Store four values to unaligned memory
+       * @param data Pointer to space for four doubles
+       */
+      void store(double *data) const {
+#if defined(PPGSO_SIMD_AVX)
+        _mm256_storeu_pd(data, v);
+#elif defined(PPGSO_SIMD_SSE2)
+        _mm_storeu_pd(data, lo);
+        _mm_storeu_pd(data + 2, hi);
+#else
+        std::copy(v, v + 4, data);
+#endif
+      }
+
+      /*!
+       * Broadcast a primitive index to all lanes, indices are exact in double lanes
+       * @param index Index to broadcast
+       */
+      static double4 index(uint32_t index) {
+        return double4{(double) index};
+      }
+
+      /*!
+       * Store lanes filled by index and select as indices
+       * @param data Pointer to space for four indices
+       */
+      void storeIndices(uint32_t *data) const {
+        double lanes[4];
+        store(lanes);
+        for (int i = 0; i < 4; ++i) data[i] = (uint32_t) lanes[i];
+      }
+    };
+
+#if defined(PPGSO_SIMD_AVX)
+#define PPGSO_LANES_AVX(name, op) \
+    inline double4 name(const double4 &a, const double4 &b) { double4 r; r.v = op(a.v, b.v); return r; }
+#define PPGSO_LANES(name, avx, sse, scalar) PPGSO_LANES_AVX(name, avx)
+#define PPGSO_COMPARE(name, predicate, sse, scalar) \
+    inline double4 name(const double4 &a, const double4 &b) { double4 r; r.v = _mm256_cmp_pd(a.v, b.v, predicate); return r; }
+#elif defined(PPGSO_SIMD_SSE2)
+#define PPGSO_LANES(name, avx, sse, scalar) \
+    inline double4 name(const double4 &a, const double4 &b) { double4 r; r.lo = sse(a.lo, b.lo); r.hi = sse(a.hi, b.hi); return r; }
+#define PPGSO_COMPARE(name, predicate, sse, scalar) PPGSO_LANES(name, , sse, )
+#else
+#define PPGSO_LANES(name, avx, sse, scalar) \
+    inline double4 name(const double4 &a, const double4 &b) { \
+      double4 r; for (int i = 0; i < 4; ++i) { double x = a.v[i], y = b.v[i]; r.v[i] = (scalar); } return r; }
+#define PPGSO_COMPARE(name, predicate, sse, scalar) PPGSO_LANES(name, , , (scalar) ? allBits() : 0.0)
+
+    /*!
+     * Lane value with all bits set, used as true in scalar masks
+     */
+    inline double allBits() {
+      uint64_t bits = ~(uint64_t) 0;
+      double value;
+      std::copy((const char *) &bits, (const char *) &bits + sizeof(double), (char *) &value);
+      return value;
+    }
+
+    /*!
+     * Bitwise operation on two scalar mask lanes
+     */
+    template<typename Op>
+    inline double bitwise(double x, double y, Op op) {
+      uint64_t a, b;
+      std::copy((const char *) &x, (const char *) &x + sizeof(double), (char *) &a);
+      std::copy((const char *) &y, (const char *) &y + sizeof(double), (char *) &b);
+      uint64_t c = op(a, b);
+      double r;
+      std::copy((const char *) &c, (const char *) &c + sizeof(double), (char *) &r);
+      return r;
+    }
+#endif
+
+    PPGSO_LANES(operator+, _mm256_add_pd, _mm_add_pd, x + y)
+    PPGSO_LANES(operator-, _mm256_sub_pd, _mm_sub_pd, x - y)
+    PPGSO_LANES(operator*, _mm256_mul_pd, _mm_mul_pd, x * y)
+    PPGSO_LANES(operator/, _mm256_div_pd, _mm_div_pd, x / y)
+    PPGSO_LANES(min, _mm256_min_pd, _mm_min_pd, x < y ? x : y)
+    PPGSO_LANES(max, _mm256_max_pd, _mm_max_pd, x > y ? x : y)
+    PPGSO_LANES(operator&, _mm256_and_pd, _mm_and_pd, bitwise(x, y, [](uint64_t p, uint64_t q) { return p & q; }))
+    PPGSO_LANES(operator|, _mm256_or_pd, _mm_or_pd, bitwise(x, y, [](uint64_t p, uint64_t q) { return p | q; }))
+    PPGSO_COMPARE(operator<, _CMP_LT_OQ, _mm_cmplt_pd, x < y)
+    PPGSO_COMPARE(operator<=, _CMP_LE_OQ, _mm_cmple_pd, x <= y)
+    PPGSO_COMPARE(operator>, _CMP_GT_OQ, _mm_cmpgt_pd, x > y)
+
+#undef PPGSO_LANES
+#undef PPGSO_LANES_AVX
+#undef PPGSO_COMPARE
+
+    /*!
+     * Negate all lanes
+     */
+    inline double4 operator-(const double4 &a) {
+      return double4{0.0} - a;
+    }
+
+    /*!
+     * Square root of all lanes
+     */
+    inline double4 sqrt(const double4 &a) {
+      double4 r;
+#if defined(PPGSO_SIMD_AVX)
+      r.v = _mm256_sqrt_pd(a.v);
+#elif defined(PPGSO_SIMD_SSE2)
+      r.lo = _mm_sqrt_pd(a.lo);
+      r.hi = _mm_sqrt_pd(a.hi);
+#else
+      for (int i = 0; i < 4; ++i) r.v[i] = std::sqrt(a.v[i]);
+#endif
+      return r;
+    }
+
+    /*!
+     * Pick lanes from a where mask is set and from b elsewhere
+     * @param mask Mask produced by a comparison
+     * @param a Lanes to use where mask is set
+     * @param b Lanes to use where mask is not set
+     */
+    inline double4 select(const double4 &mask, const double4 &a, const double4 &b) {
+      double4 r;
+#if defined(PPGSO_SIMD_AVX)
+      r.v = _mm256_blendv_pd(b.v, a.v, mask.v);
+#elif defined(PPGSO_SIMD_SSE2)
+      r.lo = _mm_or_pd(_mm_and_pd(mask.lo, a.lo), _mm_andnot_pd(mask.lo, b.lo));
+      r.hi = _mm_or_pd(_mm_and_pd(mask.hi, a.hi), _mm_andnot_pd(mask.hi, b.hi));
+#else
+      for (int i = 0; i < 4; ++i) r.v[i] = std::signbit(mask.v[i]) ? a.v[i] : b.v[i];
+#endif
+      return r;
+    }
+
+    /*!
+     * Collect the mask lanes into bits of an integer, lane 0 is the lowest bit
+     * @param mask Mask produced by a comparison
+     * @return Integer in range <0, 15>, 0 when no lane is set
+     */
+    inline int bits(const double4 &mask) {
+#if defined(PPGSO_SIMD_AVX)
+      return _mm256_movemask_pd(mask.v);
+#elif defined(PPGSO_SIMD_SSE2)
+      return _mm_movemask_pd(mask.lo) | (_mm_movemask_pd(mask.hi) << 2);
+#else
+      int r = 0;
+      for (int i = 0; i < 4; ++i) r |= std::signbit(mask.v[i]) ? 1 << i : 0;
+      return r;
+#endif
+    }
+
+    /*!
+     * Smallest value among all lanes
+     */
+    inline double hmin(const double4 &a) {
+#if defined(PPGSO_SIMD_AVX)
+      __m128d m = _mm_min_pd(_mm256_castpd256_pd128(a.v), _mm256_extractf128_pd(a.v, 1));
+      return _mm_cvtsd_f64(_mm_min_sd(m, _mm_unpackhi_pd(m, m)));
+#else
+      double v[4];
+      a.store(v);
+      return std::min(std::min(v[0], v[1]), std::min(v[2], v[3]));
+#endif
+    }
+
+    /*!
+     * Eight single precision lanes processed together, the same operations as double4 on twice the lanes
+     */
+    struct float8 {
+      using Scalar = float;
+      static const int SIZE = 8;
+
+#if defined(PPGSO_SIMD_AVX)
+      __m256 v;
+#elif defined(PPGSO_SIMD_SSE2)
+      __m128 lo, hi;
+#else
+      float v[8];
+#endif
+
+      float8() = default;
+
+      /*!
+       * Broadcast a single value to all lanes
+       * @param value Value to broadcast
+       */
+      float8(float value) {
+#if defined(PPGSO_SIMD_AVX)
+        v = _mm256_set1_ps(value);
+#elif defined(PPGSO_SIMD_SSE2)
+        lo = hi = _mm_set1_ps(value);
+#else
+        std::fill(v, v + 8, value);
+#endif
+      }
+
+      /*!
+       * Load eight values from unaligned memory
+       * @param data Pointer to eight floats
+       * @return Lanes containing the data
+       */
+      static float8 load(const float *data) {
+        float8 r;
+#if defined(PPGSO_SIMD_AVX)
+        r.v = _mm256_loadu_ps(data);
+#elif defined(PPGSO_SIMD_SSE2)
+        r.lo = _mm_loadu_ps(data);
+        r.hi = _mm_loadu_ps(data + 4);
+#else
+        std::copy(data, data + 8, r.v);
+#endif
+        return r;
+      }
+
+      /*!
+       * Store eight values to unaligned memory
+       * @param data Pointer to space for eight floats
+       */
+      void store(float *data) const {
+#if defined(PPGSO_SIMD_AVX)
+        _mm256_storeu_ps(data, v);
+#elif defined(PPGSO_SIMD_SSE2)
+        _mm_storeu_ps(data, lo);
+        _mm_storeu_ps(data + 4, hi);
+#else
+        std::copy(v, v + 8, data);
+#endif
+      }
+
+      /*!
+       * Broadcast a primitive index to all lanes, the lanes hold the bits of the index as a float can not represent
+       * indices above 2^24 exactly. Such lanes are only meant for select and storeIndices.
+       * @param index Index to broadcast
+       */
+      static float8 index(uint32_t index) {
+        float value;
+        std::copy((const char *) &index, (const char *) &index + sizeof(float), (char *) &value);
+        return float8{value};
+      }
+
+      /*!
+       * Store lanes filled by index and select as indices
+       * @param data Pointer to space for eight indices
+       */
+      void storeIndices(uint32_t *data) const {
+        float lanes[8];
+        store(lanes);
+        std::copy((const char *) lanes, (const char *) (lanes + 8), (char *) data);
+      }
+    };
+
+#if defined(PPGSO_SIMD_AVX)
+#define PPGSO_FLOAT8_LANES(name, avx, sse, scalar) \
+    inline float8 name(const float8 &a, const float8 &b) { float8 r; r.v = avx(a.v, b.v); return r; }
+#define PPGSO_FLOAT8_COMPARE(name, predicate, sse, scalar) \
+    inline float8 name(const float8 &a, const float8 &b) { float8 r; r.v = _mm256_cmp_ps(a.v, b.v, predicate); return r; }
+#elif defined(PPGSO_SIMD_SSE2)
+#define PPGSO_FLOAT8_LANES(name, avx, sse, scalar) \
+    inline float8 name(const float8 &a, const float8 &b) { float8 r; r.lo = sse(a.lo, b.lo); r.hi = sse(a.hi, b.hi); return r; }
+#define PPGSO_FLOAT8_COMPARE(name, predicate, sse, scalar) PPGSO_FLOAT8_LANES(name, , sse, )
+#else
+#define PPGSO_FLOAT8_LANES(name, avx, sse, scalar) \
+    inline float8 name(const float8 &a, const float8 &b) { \
+      float8 r; for (int i = 0; i < 8; ++i) { float x = a.v[i], y = b.v[i]; r.v[i] = (scalar); } return r; }
+#define PPGSO_FLOAT8_COMPARE(name, predicate, sse, scalar) PPGSO_FLOAT8_LANES(name, , , (scalar) ? allBitsFloat() : 0.0f)
+
+    /*!
+     * Lane value with all bits set, used as true in scalar float masks
+     */
+    inline float allBitsFloat() {
+      uint32_t bits = ~(uint32_t) 0;
+      float value;
+      std::copy((const char *) &bits, (const char *) &bits + sizeof(float), (char *) &value);
+      return value;
+    }
+
+    /*!
+     * Bitwise operation on two scalar float mask lanes
+     */
+    template<typename Op>
+    inline float bitwise(float x, float y, Op op) {
+      uint32_t a, b;
+      std::copy((const char *) &x, (const char *) &x + sizeof(float), (char *) &a);
+      std::copy((const char *) &y, (const char *) &y + sizeof(float), (char *) &b);
+      uint32_t c = op(a, b);
+      float r;
+      std::copy((const char *) &c, (const char *) &c + sizeof(float), (char *) &r);
+      return r;
+    }
+#endif
+
+    PPGSO_FLOAT8_LANES(operator+, _mm256_add_ps, _mm_add_ps, x + y)
+    PPGSO_FLOAT8_LANES(operator-, _mm256_sub_ps, _mm_sub_ps, x - y)
+    PPGSO_FLOAT8_LANES(operator*, _mm256_mul_ps, _mm_mul_ps, x * y)
+    PPGSO_FLOAT8_LANES(operator/, _mm256_div_ps, _mm_div_ps, x / y)
+    PPGSO_FLOAT8_LANES(min, _mm256_min_ps, _mm_min_ps, x < y ? x : y)
+    PPGSO_FLOAT8_LANES(max, _mm256_max_ps, _mm_max_ps, x > y ? x : y)
+    PPGSO_FLOAT8_LANES(operator&, _mm256_and_ps, _mm_and_ps, bitwise(x, y, [](uint32_t p, uint32_t q) { return p & q; }))
+    PPGSO_FLOAT8_LANES(operator|, _mm256_or_ps, _mm_or_ps, bitwise(x, y, [](uint32_t p, uint32_t q) { return p | q; }))
+    PPGSO_FLOAT8_COMPARE(operator<, _CMP_LT_OQ, _mm_cmplt_ps, x < y)
+    PPGSO_FLOAT8_COMPARE(operator<=, _CMP_LE_OQ, _mm_cmple_ps, x <= y)
+    PPGSO_FLOAT8_COMPARE(operator>, _CMP_GT_OQ, _mm_cmpgt_ps, x > y)
+
+#undef PPGSO_FLOAT8_LANES
+#undef PPGSO_FLOAT8_COMPARE
+
+    /*!
+     * Negate all lanes
+     */
+    inline float8 operator-(const float8 &a) {
+      return float8{0.0f} - a;
+    }
+
+    /*!
+     * Square root of all lanes
+     */
+    inline float8 sqrt(const float8 &a) {
+      float8 r;
+#if defined(PPGSO_SIMD_AVX)
+      r.v = _mm256_sqrt_ps(a.v);
+#elif defined(PPGSO_SIMD_SSE2)
+      r.lo = _mm_sqrt_ps(a.lo);
+      r.hi = _mm_sqrt_ps(a.hi);
+#else
+      for (int i = 0; i < 8; ++i) r.v[i] = std::sqrt(a.v[i]);
+#endif
+      return r;
+    }
+
+    /*!
+     * Pick lanes from a where mask is set and from b elsewhere
+     * @param mask Mask produced by a comparison
+     * @param a Lanes to use where mask is set
+     * @param b Lanes to use where mask is not set
+     */
+    inline float8 select(const float8 &mask, const float8 &a, const float8 &b) {
+      float8 r;
+#if defined(PPGSO_SIMD_AVX)
+      r.v = _mm256_blendv_ps(b.v, a.v, mask.v);
+#elif defined(PPGSO_SIMD_SSE2)
+      r.lo = _mm_or_ps(_mm_and_ps(mask.lo, a.lo), _mm_andnot_ps(mask.lo, b.lo));
+      r.hi = _mm_or_ps(_mm_and_ps(mask.hi, a.hi), _mm_andnot_ps(mask.hi, b.hi));
+#else
+      // Set mask lanes have all bits set, which is a NaN, testing the sign bit here crashes the vectorizer of GCC 12
+      for (int i = 0; i < 8; ++i) r.v[i] = mask.v[i] != mask.v[i] ? a.v[i] : b.v[i];
+#endif
+      return r;
+    }
+
+    /*!
+     * Collect the mask lanes into bits of an integer, lane 0 is the lowest bit
+     * @param mask Mask produced by a comparison
+     * @return Integer in range <0, 255>, 0 when no lane is set
+     */
+    inline int bits(const float8 &mask) {
+#if defined(PPGSO_SIMD_AVX)
+      return _mm256_movemask_ps(mask.v);
+#elif defined(PPGSO_SIMD_SSE2)
+      return _mm_movemask_ps(mask.lo) | (_mm_movemask_ps(mask.hi) << 4);
+#else
+      int r = 0;
+      for (int i = 0; i < 8; ++i) r |= mask.v[i] != mask.v[i] ? 1 << i : 0;
+      return r;
+#endif
+    }
+
+    /*!
+     * Smallest value among all lanes
+     */
+    inline float hmin(const float8 &a) {
+#if defined(PPGSO_SIMD_AVX)
+      __m128 m = _mm_min_ps(_mm256_castps256_ps128(a.v), _mm256_extractf128_ps(a.v, 1));
+      m = _mm_min_ps(m, _mm_movehl_ps(m, m));
+      return _mm_cvtss_f32(_mm_min_ss(m, _mm_shuffle_ps(m, m, 1)));
+#else
+      float v[8];
+      a.store(v);
+      return std::min(std::min(std::min(v[0], v[1]), std::min(v[2], v[3])),
+                      std::min(std::min(v[4], v[5]), std::min(v[6], v[7])));
+#endif
+    }
+
+    /*!
+     * Four single precision lanes processed together, SSE registers are used also when AVX is available
+     */
+    struct float4 {
+#if defined(PPGSO_SIMD_AVX) || defined(PPGSO_SIMD_SSE2)
+      __m128 v;
+#else
+      float v[4];
+#endif
+
+      float4() = default;
+
+      /*!
+       * Broadcast a single value to all lanes
+       * @param value Value to broadcast
+       */
+      float4(float value) {
+#if defined(PPGSO_SIMD_AVX) || defined(PPGSO_SIMD_SSE2)
+        v = _mm_set1_ps(value);
+#else
+        v[0] = v[1] = v[2] = v[3] = value;
+#endif
+      }
+
+      /*!
+       * Load four values from unaligned memory
+       * @param data Pointer to four floats
+       * @return Lanes containing the data
+       */
+      static float4 load(const float *data) {
+        float4 r;
+#if defined(PPGSO_SIMD_AVX) || defined(PPGSO_SIMD_SSE2)
+        r.v = _mm_loadu_ps(data);
+#else
+        std::copy(data, data + 4, r.v);
+#endif
+        return r;
+      }
+
+      /*!
+       * Load four 16 bit unsigned integers from unaligned memory and convert them to floats
+       * @param data Pointer to four integers
+       * @return Lanes containing the converted data
+       */
+      static float4 load(const uint16_t *data) {
+        float4 r;
+#if defined(PPGSO_SIMD_AVX) || defined(PPGSO_SIMD_SSE2)
+        __m128i words = _mm_loadl_epi64((const __m128i *) data);
+        r.v = _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, _mm_setzero_si128()));
+#else
+        for (int i = 0; i < 4; ++i) r.v[i] = data[i];
+#endif
+        return r;
+      }
+
+      /*!
+       * Store four values to unaligned memory
+       * @param data Pointer to space for four floats
+       */
+      void store(float *data) const {
+#if defined(PPGSO_SIMD_AVX) || defined(PPGSO_SIMD_SSE2)
+        _mm_storeu_ps(data, v);
+#else
+        std::copy(v, v + 4, data);
+#endif
+      }
+    };
+
+#if defined(PPGSO_SIMD_AVX) || defined(PPGSO_SIMD_SSE2)
+#define PPGSO_FLOAT_LANES(name, sse, scalar) \
+    inline float4 name(const float4 &a, const float4 &b) { float4 r; r.v = sse(a.v, b.v); return r; }
+#else
+#define PPGSO_FLOAT_LANES(name, sse, scalar) \
+    inline float4 name(const float4 &a, const float4 &b) { \
+      float4 r; for (int i = 0; i < 4; ++i) { float x = a.v[i], y = b.v[i]; r.v[i] = (scalar); } return r; }
+#endif
+
+    PPGSO_FLOAT_LANES(operator+, _mm_add_ps, x + y)
+    PPGSO_FLOAT_LANES(operator-, _mm_sub_ps, x - y)
+    PPGSO_FLOAT_LANES(operator*, _mm_mul_ps, x * y)
+    PPGSO_FLOAT_LANES(operator/, _mm_div_ps, x / y)
+    // Like the instructions, NaN in a yields b
+    PPGSO_FLOAT_LANES(min, _mm_min_ps, x < y ? x : y)
+    PPGSO_FLOAT_LANES(max, _mm_max_ps, x > y ? x : y)
+
+#undef PPGSO_FLOAT_LANES
+
+    /*!
+     * Square root of all lanes
+     */
+    inline float4 sqrt(const float4 &a) {
+      float4 r;
+#if defined(PPGSO_SIMD_AVX) || defined(PPGSO_SIMD_SSE2)
+      r.v = _mm_sqrt_ps(a.v);
+#else
+      for (int i = 0; i < 4; ++i) r.v[i] = std::sqrt(a.v[i]);
+#endif
+      return r;
+    }
+
+    /*!
+     * Transpose four lanes of four values, afterwards a holds the first lanes of the inputs and so on
+     */
+    inline void transpose(float4 &a, float4 &b, float4 &c, float4 &d) {
+#if defined(PPGSO_SIMD_AVX) || defined(PPGSO_SIMD_SSE2)
+      _MM_TRANSPOSE4_PS(a.v, b.v, c.v, d.v);
+#else
+      float4 *rows[4] = {&a, &b, &c, &d};
+      for (int i = 0; i < 4; ++i)
+        for (int j = i + 1; j < 4; ++j)
+          std::swap(rows[i]->v[j], rows[j]->v[i]);
+#endif
+    }
+
+    /*!
+     * Fill memory with a value, four values per store
+     * @param data Memory aligned to 16 bytes
+     * @param count Number of values to fill
+     * @param value Value to fill with
+     */
+    inline void fill(float *data, size_t count, float value) {
+      size_t i = 0;
+#if defined(PPGSO_SIMD_AVX) || defined(PPGSO_SIMD_SSE2)
+      __m128 lanes = _mm_set1_ps(value);
+      for (; i + 4 <= count; i += 4) _mm_store_ps(data + i, lanes);
+#endif
+      for (; i < count; ++i) data[i] = value;
+    }
+
+    /*!
+     * Fill memory with a value, four values per store
+     * @param data Memory aligned to 16 bytes
+     * @param count Number of values to fill
+     * @param value Value to fill with
+     */
+    inline void fill(uint32_t *data, size_t count, uint32_t value) {
+      size_t i = 0;
+#if defined(PPGSO_SIMD_AVX) || defined(PPGSO_SIMD_SSE2)
+      __m128i lanes = _mm_set1_epi32((int) value);
+      for (; i + 4 <= count; i += 4) _mm_store_si128((__m128i *) (data + i), lanes);
+#endif
+      for (; i < count; ++i) data[i] = value;
+    }
+  }
+}
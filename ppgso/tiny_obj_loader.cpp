@@ -34,12 +34,24 @@
 #include <cmath>
 #include <cstddef>
 #include <cctype>
+#include <cstdint>
 
 #include <string>
 #include <vector>
 #include <map>
 #include <fstream>
 #include <sstream>
+#include <utility>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "tiny_obj_loader.h"
 
@@ -54,18 +66,91 @@ struct vertex_index {
   vertex_index(int vidx, int vtidx, int vnidx)
       : v_idx(vidx), vt_idx(vtidx), vn_idx(vnidx){};
 };
-// for std::map
-static inline bool operator<(const vertex_index &a, const vertex_index &b) {
-  if (a.v_idx != b.v_idx)
-    return (a.v_idx < b.v_idx);
-  if (a.vn_idx != b.vn_idx)
-    return (a.vn_idx < b.vn_idx);
-  if (a.vt_idx != b.vt_idx)
-    return (a.vt_idx < b.vt_idx);
-
-  return false;
+static inline bool operator==(const vertex_index &a, const vertex_index &b) {
+  return a.v_idx == b.v_idx && a.vt_idx == b.vt_idx && a.vn_idx == b.vn_idx;
 }
 
+// Open addressing hash table from vertex_index to the index of the vertex in
+// the exported shape. Linear probing in a power of two sized table that grows
+// when half full, the slots are reused from shape to shape.
+class vertex_cache {
+public:
+  static const unsigned int EMPTY = ~0u;
+
+  vertex_cache() : mask_(0), count_(0) {}
+
+  // Drop all entries and make room for about n vertices.
+  void reset(size_t n) {
+    size_t capacity = 16;
+    while (capacity < 2 * n)
+      capacity *= 2;
+    slots_.assign(capacity, slot());
+    mask_ = capacity - 1;
+    count_ = 0;
+  }
+
+  // Find the index stored for a vertex, a new vertex gets a slot holding
+  // EMPTY that the caller fills in.
+  unsigned int &lookup(const vertex_index &key) {
+    if (2 * (count_ + 1) > slots_.size())
+      grow();
+    size_t i = hash(key) & mask_;
+    while (slots_[i].value != EMPTY && !(slots_[i].key == key))
+      i = (i + 1) & mask_;
+    if (slots_[i].value == EMPTY) {
+      slots_[i].key = key;
+      count_++;
+    }
+    return slots_[i].value;
+  }
+
+private:
+  struct slot {
+    vertex_index key;
+    unsigned int value;
+    slot() : key(-1), value(EMPTY) {}
+  };
+
+  static size_t hash(const vertex_index &i) {
+    uint64_t h = static_cast<uint32_t>(i.v_idx) * 0x9E3779B97F4A7C15ull;
+    h ^= static_cast<uint32_t>(i.vt_idx) * 0xC2B2AE3D27D4EB4Full;
+    h ^= static_cast<uint32_t>(i.vn_idx) * 0x165667B19E3779F9ull;
+    return static_cast<size_t>(h ^ (h >> 32));
+  }
+
+  void grow() {
+    std::vector<slot> old;
+    old.swap(slots_);
+    slots_.assign(std::max(old.size() * 2, static_cast<size_t>(16)), slot());
+    mask_ = slots_.size() - 1;
+    for (size_t j = 0; j < old.size(); j++) {
+      if (old[j].value == EMPTY)
+        continue;
+      size_t i = hash(old[j].key) & mask_;
+      while (slots_[i].value != EMPTY)
+        i = (i + 1) & mask_;
+      slots_[i] = old[j];
+    }
+  }
+
+  std::vector<slot> slots_;
+  size_t mask_, count_;
+};
+
+// Faces of a group stored one after another, so parsing a face does not
+// allocate.
+struct face_group {
+  std::vector<vertex_index> vertices;
+  // Number of vertices of each face
+  std::vector<size_t> sizes;
+
+  bool empty() const { return sizes.empty(); }
+  void clear() {
+    vertices.clear();
+    sizes.clear();
+  }
+};
+
 struct obj_shape {
   std::vector<float> v;
   std::vector<float> vn;
@@ -103,6 +188,51 @@ static inline int parseInt(const char *&token) {
   return i;
 }
 
+// The geometry parsers below read up to 'end', the end of the line, so they
+// also work on lines of a mapped file that are not terminated by zero.
+static inline const char *skipSpace(const char *token, const char *end) {
+  while (token < end && isSpace(*token))
+    token++;
+  return token;
+}
+
+// End of the token at 'token', optionally also ended by '/'
+static inline const char *tokenEnd(const char *token, const char *end,
+                                   bool slash) {
+  while (token < end && !isSpace(*token) && !isNewLine(*token) &&
+         !(slash && *token == '/'))
+    token++;
+  return token;
+}
+
+// Same as atoi for the indices of a face
+static inline int parseIndex(const char *token, const char *end) {
+  token = skipSpace(token, end);
+  bool negative = false;
+  if (token < end && (*token == '+' || *token == '-')) {
+    negative = *token == '-';
+    token++;
+  }
+  int i = 0;
+  while (token < end && isdigit(*token)) {
+    i = i * 10 + (*token - '0');
+    token++;
+  }
+  return negative ? -i : i;
+}
+
+// Keyword followed by a space such as "vn " at the start of the line
+static inline bool isKeyword(const char *token, const char *end,
+                             const char *keyword) {
+  size_t n = strlen(keyword);
+  if (static_cast<size_t>(end - token) <= n)
+    return false;
+  for (size_t i = 0; i < n; i++)
+    if (token[i] != keyword[i])
+      return false;
+  return isSpace(token[n]);
+}
+
 // Tries to parse a floating point number located at s.
 //
 // s_end should be a location in the string where reading should absolutely
@@ -209,7 +339,7 @@ static bool tryParseDouble(const char *s, const char *s_end, double *result) {
     if ((end_not_reached = (curr != s_end)) && (*curr == '+' || *curr == '-')) {
       exp_sign = *curr;
       curr++;
-    } else if (isdigit(*curr)) { /* Pass through. */
+    } else if (end_not_reached && isdigit(*curr)) { /* Pass through. */
     } else {
       // Empty E is not allowed.
       goto fail;
@@ -249,9 +379,19 @@ static inline float parseFloat(const char *&token) {
   return f;
 }
 
-static inline void parseFloat2(float &x, float &y, const char *&token) {
-  x = parseFloat(token);
-  y = parseFloat(token);
+static inline float parseFloat(const char *&token, const char *end) {
+  token = skipSpace(token, end);
+  const char *e = tokenEnd(token, end, false);
+  double val = 0.0;
+  tryParseDouble(token, e, &val);
+  token = e;
+  return static_cast<float>(val);
+}
+
+static inline void parseFloat2(float &x, float &y, const char *&token,
+                               const char *end) {
+  x = parseFloat(token, end);
+  y = parseFloat(token, end);
 }
 
 static inline void parseFloat3(float &x, float &y, float &z,
@@ -261,52 +401,76 @@ static inline void parseFloat3(float &x, float &y, float &z,
   z = parseFloat(token);
 }
 
+static inline void parseFloat3(float &x, float &y, float &z,
+                               const char *&token, const char *end) {
+  x = parseFloat(token, end);
+  y = parseFloat(token, end);
+  z = parseFloat(token, end);
+}
+
+// Bits set by parseTriple for indices relative to the vertices read so far
+enum { RELATIVE_V = 1, RELATIVE_VT = 2, RELATIVE_VN = 4 };
+
 // Parse triples: i, i/j/k, i//k, i/j
-static vertex_index parseTriple(const char *&token, int vsize, int vnsize,
-                                int vtsize) {
+static vertex_index parseTriple(const char *&token, const char *end, int vsize,
+                                int vnsize, int vtsize,
+                                unsigned char *relative) {
   vertex_index vi(-1);
-
-  vi.v_idx = fixIndex(atoi(token), vsize);
-  token += strcspn(token, "/ \t\r");
-  if (token[0] != '/') {
+  unsigned char flags = 0;
+
+  int idx = parseIndex(token, end);
+  vi.v_idx = fixIndex(idx, vsize);
+  flags |= idx < 0 ? RELATIVE_V : 0;
+  token = tokenEnd(token, end, true);
+  if (token == end || token[0] != '/') {
+    *relative = flags;
     return vi;
   }
   token++;
 
   // i//k
-  if (token[0] == '/') {
+  if (token < end && token[0] == '/') {
     token++;
-    vi.vn_idx = fixIndex(atoi(token), vnsize);
-    token += strcspn(token, "/ \t\r");
+    idx = parseIndex(token, end);
+    vi.vn_idx = fixIndex(idx, vnsize);
+    flags |= idx < 0 ? RELATIVE_VN : 0;
+    token = tokenEnd(token, end, true);
+    *relative = flags;
     return vi;
   }
 
   // i/j/k or i/j
-  vi.vt_idx = fixIndex(atoi(token), vtsize);
-  token += strcspn(token, "/ \t\r");
-  if (token[0] != '/') {
+  idx = parseIndex(token, end);
+  vi.vt_idx = fixIndex(idx, vtsize);
+  flags |= idx < 0 ? RELATIVE_VT : 0;
+  token = tokenEnd(token, end, true);
+  if (token == end || token[0] != '/') {
+    *relative = flags;
     return vi;
   }
 
   // i/j/k
   token++; // skip '/'
-  vi.vn_idx = fixIndex(atoi(token), vnsize);
-  token += strcspn(token, "/ \t\r");
+  idx = parseIndex(token, end);
+  vi.vn_idx = fixIndex(idx, vnsize);
+  flags |= idx < 0 ? RELATIVE_VN : 0;
+  token = tokenEnd(token, end, true);
+  *relative = flags;
   return vi;
 }
 
 static unsigned int
-updateVertex(std::map<vertex_index, unsigned int> &vertexCache,
+updateVertex(vertex_cache &vertexCache,
              std::vector<float> &positions, std::vector<float> &normals,
              std::vector<float> &texcoords,
              const std::vector<float> &in_positions,
              const std::vector<float> &in_normals,
              const std::vector<float> &in_texcoords, const vertex_index &i) {
-  const std::map<vertex_index, unsigned int>::iterator it = vertexCache.find(i);
+  unsigned int &cached = vertexCache.lookup(i);
 
-  if (it != vertexCache.end()) {
+  if (cached != vertex_cache::EMPTY) {
     // found cache
-    return it->second;
+    return cached;
   }
 
   assert(in_positions.size() > (unsigned int)(3 * i.v_idx + 2));
@@ -327,7 +491,7 @@ updateVertex(std::map<vertex_index, unsigned int> &vertexCache,
   }
 
   unsigned int idx = static_cast<unsigned int>(positions.size() / 3 - 1);
-  vertexCache[i] = idx;
+  cached = idx;
 
   return idx;
 }
@@ -355,27 +519,47 @@ void InitMaterial(material_t &material) {
   material.unknown_parameter.clear();
 }
 
+// Vertices are merged within each shape, the cache only lends its memory
+// from shape to shape.
 static bool exportFaceGroupToShape(
-    shape_t &shape, std::map<vertex_index, unsigned int> vertexCache,
+    shape_t &shape, vertex_cache &vertexCache,
     const std::vector<float> &in_positions,
     const std::vector<float> &in_normals,
     const std::vector<float> &in_texcoords,
-    const std::vector<std::vector<vertex_index>> &faceGroup,
-    const int material_id, const std::string &name, bool clearCache) {
+    const face_group &faceGroup,
+    const int material_id, const std::string &name) {
   if (faceGroup.empty()) {
     return false;
   }
 
+  // Reserve the output, there are at most as many vertices as face corners
+  // and usually about as many as positions
+  size_t triangles = 0;
+  for (size_t i = 0; i < faceGroup.sizes.size(); i++) {
+    if (faceGroup.sizes[i] > 2)
+      triangles += faceGroup.sizes[i] - 2;
+  }
+  size_t vertices = std::min(faceGroup.vertices.size(), in_positions.size() / 3);
+  vertexCache.reset(vertices);
+  shape.mesh.positions.reserve(3 * vertices);
+  if (!in_normals.empty())
+    shape.mesh.normals.reserve(3 * vertices);
+  if (!in_texcoords.empty())
+    shape.mesh.texcoords.reserve(2 * vertices);
+  shape.mesh.indices.reserve(3 * triangles);
+  shape.mesh.material_ids.reserve(triangles);
+
   // Flatten vertices and indices
-  for (size_t i = 0; i < faceGroup.size(); i++) {
-    const std::vector<vertex_index> &face = faceGroup[i];
+  const vertex_index *face = faceGroup.vertices.data();
+  for (size_t i = 0; i < faceGroup.sizes.size(); face += faceGroup.sizes[i], i++) {
+    size_t npolys = faceGroup.sizes[i];
+    if (npolys < 3)
+      continue;
 
     vertex_index i0 = face[0];
     vertex_index i1(-1);
     vertex_index i2 = face[1];
 
-    size_t npolys = face.size();
-
     // Polygon -> face fan conversion
     for (size_t k = 2; k < npolys; k++) {
       i1 = i2;
@@ -401,9 +585,6 @@ static bool exportFaceGroupToShape(
 
   shape.name = name;
 
-  if (clearCache)
-    vertexCache.clear();
-
   return true;
 }
 
@@ -684,109 +865,117 @@ std::string LoadObj(std::vector<shape_t> &shapes,
   return LoadObj(shapes, materials, ifs, matFileReader);
 }
 
-std::string LoadObj(std::vector<shape_t> &shapes,
-                    std::vector<material_t> &materials, // [output]
-                    std::istream &inStream, MaterialReader &readMatFn) {
-  std::stringstream err;
-
-  std::vector<float> v;
-  std::vector<float> vn;
-  std::vector<float> vt;
-  std::vector<std::vector<vertex_index>> faceGroup;
-  std::string name;
-
-  // material
-  std::map<std::string, int> material_map;
-  std::map<vertex_index, unsigned int> vertexCache;
-  int material = -1;
-
-  shape_t shape;
-
-  int maxchars = 8192;             // Alloc enough size.
-  std::vector<char> buf((unsigned long) maxchars); // Alloc enough size.
-  while (inStream.peek() != -1) {
-    inStream.getline(&buf[0], maxchars);
-
-    std::string linebuf(&buf[0]);
-
-    // Trim newline '\r\n' or '\n'
-    if (linebuf.size() > 0) {
-      if (linebuf[linebuf.size() - 1] == '\n')
-        linebuf.erase(linebuf.size() - 1);
-    }
-    if (linebuf.size() > 0) {
-      if (linebuf[linebuf.size() - 1] == '\r')
-        linebuf.erase(linebuf.size() - 1);
-    }
-
-    // Skip if empty line.
-    if (linebuf.empty()) {
-      continue;
-    }
-
-    // Skip leading space.
-    const char *token = linebuf.c_str();
-    token += strspn(token, " \t");
-
-    assert(token);
-    if (token[0] == '\0')
-      continue; // empty line
+// Parse the vertices of a face line, 'token' points after the "f".
+static void parseFace(const char *token, const char *end, int vsize,
+                      int vnsize, int vtsize, face_group &faceGroup,
+                      std::vector<unsigned char> *relative) {
+  token = skipSpace(token, end);
+
+  size_t first = faceGroup.vertices.size();
+  while (token < end && !isNewLine(token[0])) {
+    unsigned char flags = 0;
+    vertex_index vi = parseTriple(token, end, vsize, vnsize, vtsize, &flags);
+    faceGroup.vertices.push_back(vi);
+    if (relative)
+      relative->push_back(flags);
+    while (token < end && (isSpace(*token) || *token == '\r'))
+      token++;
+  }
 
-    if (token[0] == '#')
-      continue; // comment line
+  faceGroup.sizes.push_back(faceGroup.vertices.size() - first);
+}
 
-    // vertex
-    if (token[0] == 'v' && isSpace((token[1]))) {
-      token += 2;
-      float x, y, z;
-      parseFloat3(x, y, z, token);
-      v.push_back(x);
-      v.push_back(y);
-      v.push_back(z);
-      continue;
-    }
+// Parse a vertex, normal, texture coordinate or face line into the arrays,
+// returns false for other lines. Face indices refer to the vertices in the
+// arrays, 'relative' marks the negative ones when it is given.
+static bool parseGeometry(const char *token, const char *end,
+                          std::vector<float> &v, std::vector<float> &vn,
+                          std::vector<float> &vt, face_group &faces,
+                          std::vector<unsigned char> *relative) {
+  // vertex
+  if (isKeyword(token, end, "v")) {
+    token += 2;
+    float x, y, z;
+    parseFloat3(x, y, z, token, end);
+    v.push_back(x);
+    v.push_back(y);
+    v.push_back(z);
+    return true;
+  }
 
-    // normal
-    if (token[0] == 'v' && token[1] == 'n' && isSpace((token[2]))) {
-      token += 3;
-      float x, y, z;
-      parseFloat3(x, y, z, token);
-      vn.push_back(x);
-      vn.push_back(y);
-      vn.push_back(z);
-      continue;
-    }
+  // normal
+  if (isKeyword(token, end, "vn")) {
+    token += 3;
+    float x, y, z;
+    parseFloat3(x, y, z, token, end);
+    vn.push_back(x);
+    vn.push_back(y);
+    vn.push_back(z);
+    return true;
+  }
 
-    // texcoord
-    if (token[0] == 'v' && token[1] == 't' && isSpace((token[2]))) {
-      token += 3;
-      float x, y;
-      parseFloat2(x, y, token);
-      vt.push_back(x);
-      vt.push_back(y);
-      continue;
-    }
+  // texcoord
+  if (isKeyword(token, end, "vt")) {
+    token += 3;
+    float x, y;
+    parseFloat2(x, y, token, end);
+    vt.push_back(x);
+    vt.push_back(y);
+    return true;
+  }
 
-    // face
-    if (token[0] == 'f' && isSpace((token[1]))) {
-      token += 2;
-      token += strspn(token, " \t");
+  // face
+  if (isKeyword(token, end, "f")) {
+    parseFace(token + 2, end, static_cast<int>(v.size() / 3),
+              static_cast<int>(vn.size() / 3),
+              static_cast<int>(vt.size() / 2), faces, relative);
+    return true;
+  }
 
-      std::vector<vertex_index> face;
-      while (!isNewLine(token[0])) {
-        vertex_index vi = parseTriple(token, static_cast<int>(v.size() / 3),
-                                      static_cast<int>(vn.size() / 3),
-                                      static_cast<int>(vt.size() / 2));
-        face.push_back(vi);
-        size_t n = strspn(token, " \t\r");
-        token += n;
-      }
+  return false;
+}
 
-      faceGroup.push_back(face);
+// Lines that change the state of the parser instead of adding geometry
+static bool isCommand(const char *token, const char *end) {
+  return isKeyword(token, end, "usemtl") || isKeyword(token, end, "mtllib") ||
+         isKeyword(token, end, "g") || isKeyword(token, end, "o");
+}
 
-      continue;
+// Shapes, materials and the face group being collected, changed by the
+// commands in the order they appear in the file.
+struct obj_state {
+  std::vector<shape_t> &shapes;
+  std::vector<material_t> &materials;
+  MaterialReader &readMatFn;
+  std::map<std::string, int> material_map;
+  vertex_cache vertexCache;
+  face_group faceGroup;
+  shape_t shape;
+  std::string name;
+  int material;
+
+  obj_state(std::vector<shape_t> &shapes, std::vector<material_t> &materials,
+            MaterialReader &readMatFn)
+      : shapes(shapes), materials(materials), readMatFn(readMatFn),
+        material(-1) {}
+
+  // Export the face group as a shape and start a new one.
+  void flush(const std::vector<float> &v, const std::vector<float> &vn,
+             const std::vector<float> &vt) {
+    bool ret = exportFaceGroupToShape(shape, vertexCache, v, vn, vt,
+                                      faceGroup, material, name);
+    if (ret) {
+      shapes.push_back(std::move(shape));
     }
+    shape = shape_t();
+    faceGroup.clear();
+  }
 
+  // Handle a line accepted by isCommand. Returns false with the error when
+  // a material file fails to load.
+  bool command(const char *token, const std::vector<float> &v,
+               const std::vector<float> &vn, const std::vector<float> &vt,
+               std::string &err) {
     // use mtl
     if ((0 == strncmp(token, "usemtl", 6)) && isSpace((token[6]))) {
 
@@ -799,13 +988,7 @@ std::string LoadObj(std::vector<shape_t> &shapes,
 #endif
 
       // Create face group per material.
-      bool ret = exportFaceGroupToShape(shape, vertexCache, v, vn, vt,
-                                        faceGroup, material, name, true);
-      if (ret) {
-        shapes.push_back(shape);
-      }
-      shape = shape_t();
-      faceGroup.clear();
+      flush(v, vn, vt);
 
       if (material_map.find(namebuf) != material_map.end()) {
         material = material_map[namebuf];
@@ -814,7 +997,7 @@ std::string LoadObj(std::vector<shape_t> &shapes,
         material = -1;
       }
 
-      continue;
+      return true;
     }
 
     // load mtl
@@ -830,26 +1013,18 @@ std::string LoadObj(std::vector<shape_t> &shapes,
       std::string err_mtl = readMatFn(namebuf, materials, material_map);
       if (!err_mtl.empty()) {
         faceGroup.clear(); // for safety
-        return err_mtl;
+        err = err_mtl;
+        return false;
       }
 
-      continue;
+      return true;
     }
 
     // group name
     if (token[0] == 'g' && isSpace((token[1]))) {
 
       // flush previous face group.
-      bool ret = exportFaceGroupToShape(shape, vertexCache, v, vn, vt,
-                                        faceGroup, material, name, true);
-      if (ret) {
-        shapes.push_back(shape);
-      }
-
-      shape = shape_t();
-
-      // material = -1;
-      faceGroup.clear();
+      flush(v, vn, vt);
 
       std::vector<std::string> names;
       while (!isNewLine(token[0])) {
@@ -867,22 +1042,14 @@ std::string LoadObj(std::vector<shape_t> &shapes,
         name = "";
       }
 
-      continue;
+      return true;
     }
 
     // object name
     if (token[0] == 'o' && isSpace((token[1]))) {
 
       // flush previous face group.
-      bool ret = exportFaceGroupToShape(shape, vertexCache, v, vn, vt,
-                                        faceGroup, material, name, true);
-      if (ret) {
-        shapes.push_back(shape);
-      }
-
-      // material = -1;
-      faceGroup.clear();
-      shape = shape_t();
+      flush(v, vn, vt);
 
       // @todo { multiple object name? }
       char namebuf[TINYOBJ_SSCANF_BUFFER_SIZE];
@@ -894,19 +1061,279 @@ std::string LoadObj(std::vector<shape_t> &shapes,
 #endif
       name = std::string(namebuf);
 
+      return true;
+    }
+
+    return true;
+  }
+};
+
+// Skip leading space and the '\r' of "\r\n" line ends, returns nullptr for
+// lines without content. 'end' is the end of the line without the newline.
+static const char *trimLine(const char *token, const char *&end) {
+  // Trim newline '\r\n' or '\n'
+  if (end > token && end[-1] == '\r')
+    end--;
+
+  // Skip leading space.
+  token = skipSpace(token, end);
+
+  if (token == end || token[0] == '\0')
+    return nullptr; // empty line
+
+  if (token[0] == '#')
+    return nullptr; // comment line
+
+  return token;
+}
+
+std::string LoadObj(std::vector<shape_t> &shapes,
+                    std::vector<material_t> &materials, // [output]
+                    std::istream &inStream, MaterialReader &readMatFn) {
+  std::vector<float> v;
+  std::vector<float> vn;
+  std::vector<float> vt;
+  obj_state state(shapes, materials, readMatFn);
+
+  int maxchars = 8192;             // Alloc enough size.
+  std::vector<char> buf((unsigned long) maxchars); // Alloc enough size.
+  while (inStream.peek() != -1) {
+    inStream.getline(&buf[0], maxchars);
+
+    const char *end = &buf[0] + strlen(&buf[0]);
+    const char *token = trimLine(&buf[0], end);
+    if (!token)
+      continue;
+
+    if (parseGeometry(token, end, v, vn, vt, state.faceGroup, nullptr))
       continue;
+
+    if (isCommand(token, end)) {
+      std::string err;
+      if (!state.command(token, v, vn, vt, err))
+        return err;
     }
 
     // Ignore unknown command.
   }
 
-  bool ret = exportFaceGroupToShape(shape, vertexCache, v, vn, vt, faceGroup,
-                                    material, name, true);
-  if (ret) {
-    shapes.push_back(shape);
+  state.flush(v, vn, vt);
+
+  return "";
+}
+
+// Lines of a part of the file parsed on their own. Indices relative to the
+// vertices read so far only count the vertices of the chunk, they are marked
+// and fixed when the chunks are merged.
+struct obj_chunk {
+  const char *begin, *end;
+  std::vector<float> v, vn, vt;
+  face_group faces;
+  std::vector<unsigned char> relative;
+  // Command lines with the number of faces of the chunk before them
+  std::vector<std::pair<size_t, std::string> > commands;
+};
+
+static void parseChunk(obj_chunk &chunk) {
+  // Lines are parsed in place, the chunk ends after a newline or at the end
+  // of the file
+  for (const char *line = chunk.begin; line < chunk.end;) {
+    const char *end = static_cast<const char *>(
+        memchr(line, '\n', static_cast<size_t>(chunk.end - line)));
+    if (!end)
+      end = chunk.end;
+    const char *next = end < chunk.end ? end + 1 : chunk.end;
+    const char *token = trimLine(line, end);
+    line = next;
+    if (!token)
+      continue;
+
+    if (parseGeometry(token, end, chunk.v, chunk.vn, chunk.vt, chunk.faces,
+                      &chunk.relative))
+      continue;
+
+    // Commands are rare, they are copied for the sequential merge
+    if (isCommand(token, end))
+      chunk.commands.push_back(
+          std::make_pair(chunk.faces.sizes.size(), std::string(token, end)));
   }
-  faceGroup.clear(); // for safety
+}
 
-  return err.str();
+// Contents of a file, mapped into memory where the system supports it.
+class mapped_file {
+public:
+  explicit mapped_file(const char *filename) : data_(nullptr), size_(0) {
+#ifdef _WIN32
+    std::ifstream ifs(filename, std::ios::binary);
+    if (!ifs)
+      return;
+    ifs.seekg(0, std::ios::end);
+    buffer_.resize(static_cast<size_t>(ifs.tellg()));
+    ifs.seekg(0, std::ios::beg);
+    ifs.read(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+    open_ = true;
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+      return;
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+      open_ = true;
+      size_ = static_cast<size_t>(st.st_size);
+      if (size_ > 0) {
+        void *data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+          open_ = false;
+          size_ = 0;
+        } else {
+          // Chunks are read by all threads at once
+          madvise(data, size_, MADV_WILLNEED);
+          data_ = static_cast<const char *>(data);
+        }
+      }
+    }
+    close(fd);
+#endif
+  }
+
+  ~mapped_file() {
+#ifndef _WIN32
+    if (data_)
+      munmap(const_cast<char *>(data_), size_);
+#endif
+  }
+
+  bool is_open() const { return open_; }
+  const char *data() const { return data_; }
+  size_t size() const { return size_; }
+
+private:
+  mapped_file(const mapped_file &);
+  mapped_file &operator=(const mapped_file &);
+
+  const char *data_;
+  size_t size_;
+  bool open_ = false;
+#ifdef _WIN32
+  std::vector<char> buffer_;
+#endif
+};
+
+std::string LoadObjParallel(std::vector<shape_t> &shapes,
+                            std::vector<material_t> &materials, // [output]
+                            const char *filename, const char *mtl_basepath,
+                            unsigned int threads) {
+  shapes.clear();
+
+  mapped_file file(filename);
+  if (!file.is_open()) {
+    std::stringstream err;
+    err << "Cannot open file [" << filename << "]" << std::endl;
+    return err.str();
+  }
+
+  // Split into chunks that end after a newline, several per thread so
+  // threads that finish early take more
+  if (threads == 0)
+    threads = std::max(std::thread::hardware_concurrency(), 1u);
+  const size_t minChunk = 1 << 20;
+  size_t chunkSize = std::max(file.size() / (4 * threads), minChunk);
+  std::vector<obj_chunk> chunks;
+  const char *end = file.data() + file.size();
+  for (const char *begin = file.data(); begin < end;) {
+    const char *split = begin + std::min(chunkSize, static_cast<size_t>(end - begin));
+    if (split < end) {
+      const char *newline = static_cast<const char *>(
+          memchr(split, '\n', static_cast<size_t>(end - split)));
+      split = newline ? newline + 1 : end;
+    }
+    chunks.push_back(obj_chunk());
+    chunks.back().begin = begin;
+    chunks.back().end = split;
+    begin = split;
+  }
+
+  // Parse the chunks in parallel, small files on the calling thread
+  std::atomic<size_t> nextChunk(0);
+  auto worker = [&]() {
+    for (size_t i; (i = nextChunk++) < chunks.size();)
+      parseChunk(chunks[i]);
+  };
+  std::vector<std::thread> pool;
+  for (size_t i = 1; i < std::min(static_cast<size_t>(threads), chunks.size()); i++)
+    pool.push_back(std::thread(worker));
+  worker();
+  for (size_t i = 0; i < pool.size(); i++)
+    pool[i].join();
+
+  // Concatenate the vertex data
+  std::vector<float> v, vn, vt;
+  size_t vsize = 0, vnsize = 0, vtsize = 0;
+  for (size_t i = 0; i < chunks.size(); i++) {
+    vsize += chunks[i].v.size();
+    vnsize += chunks[i].vn.size();
+    vtsize += chunks[i].vt.size();
+  }
+  v.reserve(vsize);
+  vn.reserve(vnsize);
+  vt.reserve(vtsize);
+
+  std::string basePath;
+  if (mtl_basepath) {
+    basePath = mtl_basepath;
+  }
+  MaterialFileReader matFileReader(basePath);
+  obj_state state(shapes, materials, matFileReader);
+
+  // Replay faces and commands in file order, relative indices count the
+  // vertices of the previous chunks too
+  for (size_t c = 0; c < chunks.size(); c++) {
+    obj_chunk &chunk = chunks[c];
+    int vstart = static_cast<int>(v.size() / 3);
+    int vnstart = static_cast<int>(vn.size() / 3);
+    int vtstart = static_cast<int>(vt.size() / 2);
+    v.insert(v.end(), chunk.v.begin(), chunk.v.end());
+    vn.insert(vn.end(), chunk.vn.begin(), chunk.vn.end());
+    vt.insert(vt.end(), chunk.vt.begin(), chunk.vt.end());
+
+    size_t corner = 0, command = 0;
+    for (size_t f = 0; f <= chunk.faces.sizes.size(); f++) {
+      for (; command < chunk.commands.size() && chunk.commands[command].first == f; command++) {
+        std::string err;
+        if (!state.command(chunk.commands[command].second.c_str(), v, vn, vt, err))
+          return err;
+      }
+      if (f == chunk.faces.sizes.size())
+        break;
+
+      for (size_t k = 0; k < chunk.faces.sizes[f]; k++, corner++) {
+        vertex_index vi = chunk.faces.vertices[corner];
+        unsigned char flags = chunk.relative[corner];
+        if (flags & RELATIVE_V)
+          vi.v_idx += vstart;
+        if (flags & RELATIVE_VT)
+          vi.vt_idx += vtstart;
+        if (flags & RELATIVE_VN)
+          vi.vn_idx += vnstart;
+        state.faceGroup.vertices.push_back(vi);
+      }
+      state.faceGroup.sizes.push_back(chunk.faces.sizes[f]);
+    }
+
+    // Release the parsed chunk as it is merged
+    std::vector<float>().swap(chunk.v);
+    std::vector<float>().swap(chunk.vn);
+    std::vector<float>().swap(chunk.vt);
+    std::vector<vertex_index>().swap(chunk.faces.vertices);
+    std::vector<size_t>().swap(chunk.faces.sizes);
+    std::vector<unsigned char>().swap(chunk.relative);
+    std::vector<std::pair<size_t, std::string> >().swap(chunk.commands);
+  }
+
+  state.flush(v, vn, vt);
+
+  return "";
 }
 }
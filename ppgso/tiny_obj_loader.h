@@ -88,6 +88,16 @@ std::string LoadObj(std::vector<shape_t> &shapes,       // [output]
                     std::vector<material_t> &materials, // [output]
                     std::istream &inStream, MaterialReader &readMatFn);
 
+/// Loads .obj from a file mapped into memory, parts of the file are parsed
+/// by 'threads' threads in parallel, 0 uses all hardware threads.
+/// The output is the same as from LoadObj.
+/// Returns empty string when loading .obj success.
+std::string LoadObjParallel(std::vector<shape_t> &shapes,       // [output]
+                            std::vector<material_t> &materials, // [output]
+                            const char *filename,
+                            const char *mtl_basepath = nullptr,
+                            unsigned int threads = 0);
+
 /// Loads materials into std::map
 /// Returns an empty string if successful
 std::string LoadMtl(std::map<std::string, int> &material_map,
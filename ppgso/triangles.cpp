@@ -0,0 +1,63 @@
+#include <sstream>
+#include <stdexcept>
+
+#include "triangles.h"
+#include "mesh_file.h"
+
+using namespace std;
+using namespace glm;
+using namespace ppgso;
+
+void TriangleArrays::push_back(const vec3 &a, const vec3 &b, const vec3 &c) {
+  vec3 e1 = b - a, e2 = c - a;
+  x.push_back(a.x);
+  y.push_back(a.y);
+  z.push_back(a.z);
+  e1x.push_back(e1.x);
+  e1y.push_back(e1.y);
+  e1z.push_back(e1.z);
+  e2x.push_back(e2.x);
+  e2y.push_back(e2.y);
+  e2z.push_back(e2.z);
+}
+
+size_t TriangleArrays::load(const string &obj, const mat4 &transform) {
+  // Load OBJ file through its binary cache
+  auto file = MeshFile::load(obj);
+
+  // Transform the vertices of all shapes and append their faces
+  size_t first = size();
+  for (auto &mesh : file.getShapes()) {
+    vector<vec3> positions(mesh.vertexCount);
+    for (size_t i = 0; i < positions.size(); ++i)
+      positions[i] = vec3{transform * vec4{mesh.positions[3 * i], mesh.positions[3 * i + 1], mesh.positions[3 * i + 2], 1}};
+
+    for (size_t i = 0; i + 2 < mesh.indexCount; i += 3)
+      push_back(positions[mesh.indices[i]], positions[mesh.indices[i + 1]], positions[mesh.indices[i + 2]]);
+  }
+  return size() - first;
+}
+
+void TriangleArrays::transform(const TriangleArrays &source, size_t first, size_t count, const mat4 &transform) {
+  if (size() < first + count) {
+    for (auto array : {&x, &y, &z, &e1x, &e1y, &e1z, &e2x, &e2y, &e2z})
+      array->resize(first + count);
+  }
+
+  // Edges are directions, so only the linear part of the transformation applies to them
+  mat3 linear{transform};
+  for (size_t i = first; i < first + count; ++i) {
+    vec3 a{transform * vec4{source.x[i], source.y[i], source.z[i], 1}};
+    vec3 e1 = linear * vec3{source.e1x[i], source.e1y[i], source.e1z[i]};
+    vec3 e2 = linear * vec3{source.e2x[i], source.e2y[i], source.e2z[i]};
+    x[i] = a.x;
+    y[i] = a.y;
+    z[i] = a.z;
+    e1x[i] = e1.x;
+    e1y[i] = e1.y;
+    e1z[i] = e1.z;
+    e2x[i] = e2.x;
+    e2y[i] = e2.y;
+    e2z[i] = e2.z;
+  }
+}
@@ -0,0 +1,164 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <limits>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+#include "bvh.h"
+#include "packet.h"
+
+namespace ppgso {
+
+  /*!
+   * Triangle geometry stored as structure of arrays, intersected using the Möller–Trumbore algorithm.
+   *
+   * Each triangle keeps its first vertex and the two edges leaving it, which is all the intersection test needs.
+   * Vertices are stored in single precision like in the OBJ files, the intersection is computed in the precision of the ray.
+   */
+  struct TriangleArrays {
+    std::vector<float> x, y, z;
+    std::vector<float> e1x, e1y, e1z;
+    std::vector<float> e2x, e2y, e2z;
+
+    /*!
+     * Append a triangle
+     * @param a First vertex
+     * @param b Second vertex
+     * @param c Third vertex
+     */
+    void push_back(const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c);
+
+    /*!
+     * Append all triangles of a Wavefront .obj file or its .mesh cache (see MeshFile::load), throws std::runtime_error
+     * when the file can not be loaded
+     * @param obj File path to the obj file to load
+     * @param transform Matrix to transform the vertices with
+     * @return Number of triangles added
+     */
+    size_t load(const std::string &obj, const glm::mat4 &transform);
+
+    /*!
+     * Overwrite a range of triangles with transformed triangles of another array, used to animate meshes that keep
+     * their untransformed triangles. Missing triangles are appended.
+     * @param source Triangles to transform
+     * @param first Index of the first triangle of the range in both arrays
+     * @param count Number of triangles in the range
+     * @param transform Matrix to transform the vertices with
+     */
+    void transform(const TriangleArrays &source, size_t first, size_t count, const glm::mat4 &transform);
+
+    /*!
+     * Number of triangles
+     */
+    size_t size() const {
+      return x.size();
+    }
+
+    /*!
+     * Get the vertices of a triangle
+     * @param index Index of the triangle
+     * @param a Output first vertex
+     * @param b Output second vertex
+     * @param c Output third vertex
+     */
+    void vertices(uint32_t index, glm::vec3 &a, glm::vec3 &b, glm::vec3 &c) const {
+      a = {x[index], y[index], z[index]};
+      b = a + glm::vec3{e1x[index], e1y[index], e1z[index]};
+      c = a + glm::vec3{e2x[index], e2y[index], e2z[index]};
+    }
+
+    /*!
+     * Compute the axis aligned bounding box of a triangle
+     * @param index Index of the triangle
+     * @return Box enclosing the triangle
+     */
+    BVH::Box bounds(uint32_t index) const {
+      glm::vec3 a, b, c;
+      vertices(index, a, b, c);
+      return {glm::min(a, glm::min(b, c)), glm::max(a, glm::max(b, c))};
+    }
+
+    /*!
+     * Compute the geometric normal of a triangle, vertices in counter clockwise order face the normal
+     * @param index Index of the triangle
+     * @return Normalized normal
+     */
+    glm::vec3 normal(uint32_t index) const {
+      return glm::normalize(glm::cross(glm::vec3{e1x[index], e1y[index], e1z[index]}, glm::vec3{e2x[index], e2y[index], e2z[index]}));
+    }
+
+    /*!
+     * Intersect a ray with a single triangle
+     * @param origin Ray origin
+     * @param direction Ray direction
+     * @param index Index of the triangle to test
+     * @return Distance along the ray to the hit or infinity when the triangle is missed or behind the ray
+     */
+    template<typename T, glm::precision P>
+    T intersect(const glm::tvec3<T, P> &origin, const glm::tvec3<T, P> &direction, uint32_t index) const {
+      const glm::tvec3<T, P> e1{e1x[index], e1y[index], e1z[index]};
+      const glm::tvec3<T, P> e2{e2x[index], e2y[index], e2z[index]};
+
+      glm::tvec3<T, P> p = glm::cross(direction, e2);
+      T det = glm::dot(e1, p);
+      // Ray is parallel to the triangle
+      if (det == 0) return std::numeric_limits<T>::infinity();
+      T invDet = T(1) / det;
+
+      glm::tvec3<T, P> s = origin - glm::tvec3<T, P>{x[index], y[index], z[index]};
+      T u = glm::dot(s, p) * invDet;
+      if (u < 0 || u > 1) return std::numeric_limits<T>::infinity();
+
+      glm::tvec3<T, P> q = glm::cross(s, e1);
+      T v = glm::dot(direction, q) * invDet;
+      if (v < 0 || u + v > 1) return std::numeric_limits<T>::infinity();
+
+      T t = glm::dot(e2, q) * invDet;
+      return t > 0 ? t : std::numeric_limits<T>::infinity();
+    }
+
+    /*!
+     * Intersect all rays of a packet with a single triangle
+     * @param packet Rays to test
+     * @param index Index of the triangle to test
+     * @param id Value stored to hit for rays where this triangle is the closest one
+     * @param distance Closest hit distance of each ray, updated for lanes where this triangle is closer
+     * @param hit Identifier of the closest primitive for each ray, updated together with distance
+     */
+    template<typename T>
+    void intersect(const RayPacket<T> &packet, uint32_t index, uint32_t id, typename RayPacket<T>::Lanes &distance,
+                   typename RayPacket<T>::Lanes &hit) const {
+      using Lanes = typename RayPacket<T>::Lanes;
+      const Lanes e1[3] = {Lanes{(T) e1x[index]}, Lanes{(T) e1y[index]}, Lanes{(T) e1z[index]}};
+      const Lanes e2[3] = {Lanes{(T) e2x[index]}, Lanes{(T) e2y[index]}, Lanes{(T) e2z[index]}};
+      const Lanes (&d)[3] = packet.direction;
+
+      // p = direction x e2
+      Lanes px = d[1] * e2[2] - d[2] * e2[1];
+      Lanes py = d[2] * e2[0] - d[0] * e2[2];
+      Lanes pz = d[0] * e2[1] - d[1] * e2[0];
+      Lanes det = e1[0] * px + e1[1] * py + e1[2] * pz;
+      Lanes invDet = Lanes{1} / det;
+
+      Lanes sx = packet.origin[0] - Lanes{(T) x[index]};
+      Lanes sy = packet.origin[1] - Lanes{(T) y[index]};
+      Lanes sz = packet.origin[2] - Lanes{(T) z[index]};
+      Lanes u = (sx * px + sy * py + sz * pz) * invDet;
+
+      // q = s x e1
+      Lanes qx = sy * e1[2] - sz * e1[1];
+      Lanes qy = sz * e1[0] - sx * e1[2];
+      Lanes qz = sx * e1[1] - sy * e1[0];
+      Lanes v = (d[0] * qx + d[1] * qy + d[2] * qz) * invDet;
+      Lanes t = (e2[0] * qx + e2[1] * qy + e2[2] * qz) * invDet;
+
+      // Comparisons with NaN from parallel rays are false, so such lanes are never valid
+      Lanes valid = (Lanes{0} <= u) & (Lanes{0} <= v) & (u + v <= Lanes{1}) &
+                    (Lanes{0} < t) & (t < distance);
+      distance = select(valid, t, distance);
+      hit = select(valid, Lanes::index(id), hit);
+    }
+  };
+}
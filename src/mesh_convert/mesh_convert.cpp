@@ -0,0 +1,57 @@
+// Tool mesh_convert
+// - Converts Wavefront obj files to the binary .mesh format that ppgso::MeshFile maps into memory
+// - By default the mesh is written next to the obj file where ppgso::Mesh and the raw renderers look for their cache
+// - Pass --output FILE to write a single mesh to another file, obj files changed later are converted again when loaded
+
+#include <iostream>
+#include <chrono>
+#include <stdexcept>
+#include <cstdlib>
+#include <ppgso/mesh_file.h>
+
+using namespace std;
+using namespace ppgso;
+
+int main(int argc, char *argv[]) {
+  vector<string> inputs;
+  string output;
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "--output" && i + 1 < argc) {
+      output = argv[++i];
+    } else if (arg.size() > 1 && arg[0] == '-') {
+      inputs.clear();
+      break;
+    } else {
+      inputs.push_back(arg);
+    }
+  }
+  if (inputs.empty() || (!output.empty() && inputs.size() > 1)) {
+    cerr << "Usage: " << argv[0] << " [--output FILE] OBJ..." << endl
+         << "  Writes each obj file as a binary mesh next to it, or to FILE when a single obj file is given" << endl;
+    return EXIT_FAILURE;
+  }
+
+  try {
+    for (auto &obj : inputs) {
+      auto begin = chrono::steady_clock::now();
+      auto file = MeshFile::convert(obj);
+      string destination = output.empty() ? MeshFile::cachePath(obj) : output;
+      file.save(destination);
+      double time = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+      size_t triangles = 0, vertices = 0;
+      for (auto &shape : file.getShapes()) {
+        triangles += shape.indexCount / 3;
+        vertices += shape.vertexCount;
+      }
+      cout << obj << " -> " << destination << ": " << file.getShapes().size() << " shapes, " << triangles
+           << " triangles, " << vertices << " vertices, " << file.size() / 1e6 << " MB in " << time * 1000 << " ms"
+           << endl;
+    }
+  } catch (const exception &e) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
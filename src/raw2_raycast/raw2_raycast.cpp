@@ -3,8 +3,16 @@
 // - Casts rays from camera space into scene
 // - Computes collisions with scene geometry
 // - For each collision point calculates lighting
+// - Primary rays are cast in SIMD packets, 2x2 pixels of double rays or 4x2 pixels of float rays
+// - Image tiles are distributed between threads using a work stealing scheduler
+// - Geometry can be computed in float or double precision, run with --float for single precision
+// - Run with --benchmark to compare single precision against the double precision reference
+// - Static scenes are rendered once for --frames, the copies of the frame are written on a background thread
+// - Scenes can be loaded from scene files, run with --help to list the options for resolution, samples, threads and output
 
 #include <iostream>
+#include <chrono>
+#include <stdexcept>
 #include <ppgso/ppgso.h>
 
 using namespace std;
@@ -12,22 +20,27 @@ using namespace glm;
 using namespace ppgso;
 
 // Global constants
-const double INF = numeric_limits<double>::max();           // Will be used for infinity
-const double EPS = numeric_limits<double>::epsilon();       // Numerical Epsilon
-const double DELTA = sqrt(EPS);                             // Delta to use
+template<typename T>
+constexpr T INF = numeric_limits<T>::max();                 // Will be used for infinity
+constexpr uint32_t NO_INDEX = numeric_limits<uint32_t>::max(); // Index used when no object was hit
+
+// Geometry is computed in the scalar type T (float or double), colors always use double
+template<typename T>
+using vec3t = tvec3<T, defaultp>;
 
 /*!
  * Structure holding origin and direction that represents a ray
  */
+template<typename T>
 struct Ray {
-  dvec3 origin, direction;
+  vec3t<T> origin, direction;
 
   /*!
    * Compute a point on the ray
    * @param t Distance from origin
    * @return Point on ray where t is the distance from the origin
    */
-  inline dvec3 point(double t) const {
+  inline vec3t<T> point(T t) const {
     return origin + direction * t;
   }
 };
@@ -43,16 +56,19 @@ struct Material {
 /*!
  * Structure to represent a ray to object collision, the Hit structure will contain material surface normal
  */
+template<typename T>
 struct Hit {
-  double distance;
-  dvec3 point, normal;
+  T distance;
+  vec3t<T> point, normal;
   Material material;
+  uint32_t index;
 };
 
 /*!
  * Constant for collisions that have not hit any object in the scene
  */
-const Hit noHit = { INF, {0,0,0}, {0,0,0}, { {0,0,0}, {0,0,0}, 0 } };
+template<typename T>
+const Hit<T> noHit = { INF<T>, {0,0,0}, {0,0,0}, { {0,0,0}, {0,0,0}, 0 }, NO_INDEX };
 
 /*!
  * Structure representing a simple camera that is composed on position, up, back and right vectors
@@ -60,26 +76,37 @@ const Hit noHit = { INF, {0,0,0}, {0,0,0}, { {0,0,0}, {0,0,0}, 0 } };
 struct Camera {
   dvec3 position, back, up, right;
 
+  /*!
+   * Create a camera described in a scene file, the image is expected to be square
+   * @param description Position, target, up direction and vertical field of view of the camera
+   * @return Camera looking from the position at the target
+   */
+  static Camera fromScene(const scene::Camera &description) {
+    double size = tan(radians(description.fov) / 2);
+    dvec3 back = normalize(description.position - description.target);
+    dvec3 right = normalize(cross(description.up, back));
+    return {description.position, back, cross(back, right) * size, right * size};
+  }
+
   /*!
  * Generate a new Ray for the given viewport size and position
  * @param x Horizontal position in the viewport
  * @param y Vertical position in the viewport
  * @param width Width of the viewport
  * @param height Height of the viewport
+ * @param random Random number generator used for the deviation
  * @return Ray for the giver viewport position with small random deviation applied to support multi-sampling
  */
-  Ray generateRay(int x, int y, int width, int height) const {
+  template<typename T>
+  Ray<T> generateRay(int x, int y, int width, int height, Random &random) const {
     // Camera deltas
     dvec3 vdu = 2.0 * right / (double)width;
     dvec3 vdv = 2.0 * -up / (double)height;
 
-    Ray ray;
-    ray.origin = position;
-    ray.direction = -back
-                    + vdu * ((double)(-width/2 + x) + linearRand(0.0, 1.0))
-                    + vdv * ((double)(-height/2 + y) + linearRand(0.0, 1.0));
-    ray.direction = normalize(ray.direction);
-    return ray;
+    dvec3 direction = -back
+                    + vdu * ((double)(-width/2 + x) + random.linearRand(0.0, 1.0))
+                    + vdv * ((double)(-height/2 + y) + random.linearRand(0.0, 1.0));
+    return {vec3t<T>{position}, vec3t<T>{normalize(direction)}};
   }
 };
 
@@ -94,98 +121,174 @@ struct Light {
 /*!
  * Structure representing a sphere which is defined by its center position, radius and material
  */
+template<typename T>
 struct Sphere {
-  double radius;
-  dvec3 center;
+  T radius;
+  vec3t<T> center;
   Material material;
 
   /*!
-   * Compute ray to sphere collision
+   * Compute distance of the ray to sphere collision, the hit itself is only built for the closest primitive
+   * The discriminant is computed from the distance of the sphere center to the ray instead of b*b - a*c, which
+   * loses all precision in float for large spheres. Rays that start on the surface of this sphere are handled
+   * separately, a sphere is convex so such ray can only hit its far side and only when heading inside.
    * @param ray Ray to compute collision against
-   * @return Hit structure that represents the collision or noHit.
+   * @param start True if the ray starts on the surface of this sphere
+   * @return Distance along the ray or INF when the sphere is missed
    */
-  inline Hit hit(const Ray &ray) const {
-    auto oc = ray.origin - center;
-    auto a = glm::dot(ray.direction, ray.direction);
-    auto b = dot(oc, ray.direction);
-    auto c = dot(oc, oc) - radius * radius;
-    auto dis = b * b - a * c;
+  inline T intersect(const Ray<T> &ray, bool start = false) const {
+    vec3t<T> oc = ray.origin - center;
+    T a = dot(ray.direction, ray.direction);
+    T b = dot(oc, ray.direction);
+
+    if (start) {
+      // Origin is on the surface so one solution is zero, the other one is the length of the chord
+      T t = -2 * b / a;
+      return b < 0 && t > 0 ? t : INF<T>;
+    }
 
-    if (dis > 0) {
-      auto e = sqrt(dis);
-      auto t = (-b - e) / a;
+    vec3t<T> l = oc - ray.direction * (b / a);
+    T dis = a * (radius * radius - dot(l, l));
 
-      if ( t > EPS ) {
-        auto pt = ray.point(t);
-        auto n = normalize(pt - center);
-        return {t, pt, n, material};
-      }
+    if (dis > 0) {
+      T e = sqrt(dis);
+      T t = (-b - e) / a;
+      if ( t > 0 ) return t;
 
       t = (-b + e) / a;
-
-      if ( t > EPS ) {
-        auto pt = ray.point(t);
-        auto n = normalize(pt - center);
-        return {t, pt, n, material};
-      }
+      if ( t > 0 ) return t;
     }
-    return noHit;
+    return INF<T>;
   }
-};
 
-/*!
- * Generate a normalized vector that sits on the surface of a half-sphere which is defined using a normal. Used to generate random diffuse reflections.
- * @param normal Normal that defines the dome/half-sphere direction
- * @return Random 3D vector on the dome surface
- */
-inline dvec3 RandomDome(const dvec3 &normal) {
-  double d;
-  dvec3 p;
-
-  do {
-    p = sphericalRand(1.0);
-    d = dot(p, normal);
-  } while(d < 0);
+  /*!
+   * Compute ray to sphere collision
+   * @param ray Ray that hit the sphere
+   * @param t Distance of the hit computed by intersect
+   * @return Hit structure that represents the collision
+   */
+  inline Hit<T> hit(const Ray<T> &ray, T t) const {
+    vec3t<T> pt = ray.point(t);
+    return {t, pt, normalize(pt - center), material, NO_INDEX};
+  }
 
-  return p;
-}
+};
 
 /*!
  * Structure to represent the scene/world to render
+ * Collisions are computed using scalar type T, float is faster while double serves as the reference
  */
+template<typename T>
 struct World {
   Camera camera;
   vector<Light> lights;
-  vector<Sphere> spheres;
+  vector<Sphere<T>> spheres;
+  SphereArrays<T> sphereArrays;
+
+  /*!
+   * Create the world and prepare sphere data for packet casting
+   * @param camera Camera to render the world from
+   * @param lights Lights in the world
+   * @param spheres Spheres in the world
+   */
+  World(const Camera &camera, const vector<Light> &lights, const vector<Sphere<T>> &spheres) : camera{camera}, lights{lights}, spheres{spheres} {
+    for (auto &sphere : spheres)
+      sphereArrays.push_back(sphere.center, sphere.radius);
+  }
 
   /*!
    * Compute ray to object collision with any object in the world
    * @param ray Ray to trace collisions for
+   * @param start Index of the sphere the ray starts on, NO_INDEX for rays starting in empty space
    * @return Hit or noHit structure which indicates the material and distance the ray has collided with
    */
-  inline Hit cast(const Ray &ray) const {
-    auto hit = noHit;
-    for ( auto& sphere : spheres) {
-      auto lh = sphere.hit(ray);
-
-      if (lh.distance < hit.distance) {
-        hit = lh;
+  inline Hit<T> cast(const Ray<T> &ray, uint32_t start = NO_INDEX) const {
+    // Candidates only update the closest distance and index, the hit is built once for the closest sphere
+    T distance = INF<T>;
+    uint32_t closest = NO_INDEX;
+    for (uint32_t i = 0; i < spheres.size(); ++i) {
+      auto t = spheres[i].intersect(ray, i == start);
+
+      if (t < distance) {
+        distance = t;
+        closest = i;
       }
     }
+    if (closest == NO_INDEX) return noHit<T>;
+
+    auto hit = spheres[closest].hit(ray, distance);
+    hit.index = closest;
     return hit;
   }
 
+  /*!
+   * Check if any object blocks the ray before it travels the given distance, stops at the first blocker
+   * @param ray Ray to test
+   * @param distance Distance the ray has to travel unblocked
+   * @param start Index of the sphere the ray starts on, NO_INDEX for rays starting in empty space
+   * @return true if an object is closer than distance
+   */
+  inline bool occluded(const Ray<T> &ray, T distance, uint32_t start = NO_INDEX) const {
+    for (uint32_t i = 0; i < spheres.size(); ++i)
+      if (spheres[i].intersect(ray, i == start) < distance) return true;
+    return false;
+  }
+
+  /*!
+   * Compute collisions for a packet of rays at once, only the closest hit of each ray is turned into a Hit structure
+   * Packets are intersected in the precision of the world, four double or eight float rays at once
+   * @param rays Rays to trace collisions for
+   * @param hits Output Hit or noHit structure for each ray
+   */
+  inline void cast(const Ray<T> (&rays)[RayPacket<T>::SIZE], Hit<T> (&hits)[RayPacket<T>::SIZE]) const {
+    const int SIZE = RayPacket<T>::SIZE;
+    vec3t<T> origins[SIZE], directions[SIZE];
+    for (int i = 0; i < SIZE; ++i) {
+      origins[i] = rays[i].origin;
+      directions[i] = rays[i].direction;
+    }
+    RayPacket<T> packet{origins, directions};
+
+    using Lanes = typename RayPacket<T>::Lanes;
+    Lanes distance{INF<T>}, index = Lanes::index(NO_INDEX);
+    for (uint32_t i = 0; i < spheres.size(); ++i)
+      sphereArrays.intersect(packet, i, 0, distance, index);
+
+    T distances[SIZE];
+    uint32_t indices[SIZE];
+    distance.store(distances);
+    index.storeIndices(indices);
+    for (int i = 0; i < SIZE; ++i) {
+      if (indices[i] == NO_INDEX) {
+        hits[i] = noHit<T>;
+        continue;
+      }
+      hits[i] = spheres[indices[i]].hit(rays[i], distances[i]);
+      hits[i].index = indices[i];
+    }
+  }
+
   /*!
    * Trace a ray as it collides with objects in the world
    * @param ray Ray to cast
-   * @param depth Maximum number of collisions to trace
    * @return Color representing the accumulated lighting for earch ray collision
    */
-  inline dvec3 trace(const Ray &ray) const {
-    Hit hit = cast(ray);
+  inline dvec3 trace(const Ray<T> &ray) const {
+    return shade(ray, cast(ray));
+  }
 
+  /*!
+   * Compute Phong lighting for a ray that has already collided with an object
+   * @param ray Ray that caused the hit
+   * @param hit Collision of the ray with the world
+   * @return Color representing the lighting at the hit
+   */
+  inline dvec3 shade(const Ray<T> &ray, const Hit<T> &hit) const {
     // No hit
-    if (hit.distance >= INF) return {0, 0, 0};
+    if (hit.distance >= INF<T>) return {0, 0, 0};
+
+    // Lighting is computed in double precision
+    dvec3 point{hit.point}, normal{hit.normal}, direction{ray.direction};
 
     // Phong components
     dvec3 ambientColor = {0.1, 0.1, 0.1};
@@ -193,21 +296,20 @@ struct World {
     dvec3 diffuseColor = {0,0,0};
     dvec3 specularColor = {0,0,0};
     for( auto& light : lights) {
-      auto lightDirection = light.position - hit.point;
+      auto lightDirection = light.position - point;
       auto lightDistance = length(lightDirection);
       auto lightNormal = normalize(lightDirection);
-      Ray lightRay = {hit.point + hit.normal * DELTA, lightNormal};
+      Ray<T> lightRay = {offsetRay(hit.point, hit.normal), vec3t<T>{lightNormal}};
 
-      // Light is obscured by object
-      auto shadowTest = cast(lightRay);
-      if(shadowTest.distance < lightDistance ) continue;
+      // Light is obscured by object, the shadow ray starts on the surface that was hit
+      if (occluded(lightRay, (T) lightDistance, hit.index)) continue;
 
       // Light is visible
       auto att_factor = 1.0 / (light.att_const + light.att_linear * lightDistance + light.att_quad * lightDistance * lightDistance);
-      auto dif = glm::clamp(dot(lightRay.direction, hit.normal), 0.0, 1.0);
+      auto dif = glm::clamp(dot(lightNormal, normal), 0.0, 1.0);
       diffuseColor += hit.material.diffuse * att_factor * light.color * dif;
 
-      auto spec = glm::clamp(dot(reflect(ray.direction, hit.normal), lightRay.direction), 0.0, 1.0);
+      auto spec = glm::clamp(dot(reflect(direction, normal), lightNormal), 0.0, 1.0);
       specularColor += light.color * att_factor * pow(spec, hit.material.shininess);
     }
 
@@ -218,29 +320,52 @@ struct World {
   /*!
    * Render the world to the provided image
    * @param image Image to render to
+   * @param samples Number of samples per pixel
+   * @param seed Seed of the random sequences, the same seed always produces the same image
+   * @param scheduler Scheduler that distributes image tiles between threads
    */
-  void render(Image& image, unsigned int samples) const {
-    // Render section of the framebuffer
-    for(int y = 0; y < image.height; ++y) {
-      for (int x = 0; x < image.width; ++x) {
-        dvec3 color{};
-        for (unsigned int i = 0; i < samples; i++) {
-          auto ray = camera.generateRay(x, y, image.width, image.height);
-          color = color + trace(ray);
+  void render(Image& image, unsigned int samples, uint64_t seed, TileScheduler &scheduler) const {
+    scheduler.run(image.width, image.height, [&](const Tile &tile, unsigned int) {
+      // Render the tile in blocks of 2x2 or 4x2 pixels, one packet of rays per block
+      const int SIZE = RayPacket<T>::SIZE, WIDTH = RayPacket<T>::WIDTH;
+      for (int y = tile.y; y < tile.y + tile.height; y += 2) {
+        for (int x = tile.x; x < tile.x + tile.width; x += WIDTH) {
+          // Pixels of the block, clamped at the tile border
+          int px[SIZE], py[SIZE];
+          // Each pixel uses its own random sequence so the result does not depend on threads
+          Random random[SIZE];
+          for (int i = 0; i < SIZE; ++i) {
+            px[i] = std::min(x + i % WIDTH, tile.x + tile.width - 1);
+            py[i] = std::min(y + i / WIDTH, tile.y + tile.height - 1);
+            random[i] = Random{seed, (uint64_t) (px[i] + py[i] * image.width)};
+          }
+          dvec3 color[SIZE] = {};
+          for (unsigned int s = 0; s < samples; s++) {
+            Ray<T> rays[SIZE];
+            Hit<T> hits[SIZE];
+            for (int i = 0; i < SIZE; ++i)
+              rays[i] = camera.generateRay<T>(px[i], py[i], image.width, image.height, random[i]);
+            cast(rays, hits);
+            for (int i = 0; i < SIZE; ++i)
+              color[i] += shade(rays[i], hits[i]);
+          }
+          for (int i = 0; i < SIZE; ++i) {
+            dvec3 c = color[i] / (double) samples;
+            image.setPixel(px[i], py[i], (float) c.r, (float) c.g, (float) c.b);
+          }
         }
-        color = color / (double) samples;
-        image.setPixel(x, y, (float) color.r, (float) color.g, (float) color.b);
       }
-    }
+    });
   }
 };
 
-int main() {
-  // Image to render to
-  Image image {512, 512};
-
-  // World to render
-  const World world = {
+/*!
+ * Create the scene rendered by this example
+ * @return World to render
+ */
+template<typename T>
+World<T> defaultScene() {
+  return {
       { // Camera
           {  0,   0, 25}, // pos
           {  0,   0,  1}, // back
@@ -262,12 +387,133 @@ int main() {
           {    10, {  10, 10, -10}, { { 0, 0, 0}, { 0, 0, 1}, 30 } },
       },
   };
+}
+
+/*!
+ * Load the world from a scene file, meshes are skipped as this example only renders spheres
+ * @param file File path to the scene file
+ * @return World to render
+ */
+template<typename T>
+World<T> loadScene(const string &file) {
+  auto description = scene::load(file);
+
+  vector<Light> lights;
+  for (auto &light : description.lights)
+    lights.push_back({light.position, light.color, light.attenuation.x, light.attenuation.y, light.attenuation.z});
+
+  vector<Sphere<T>> spheres;
+  spheres.reserve(description.spheres.size());
+  for (auto &sphere : description.spheres) {
+    auto &material = description.materials[sphere.material];
+    spheres.push_back({(T) sphere.radius, vec3t<T>{sphere.center}, {material.emission, material.diffuse, material.shininess}});
+  }
+
+  if (!description.meshes.empty())
+    cout << "Skipping " << description.meshes.size() << " meshes, raw2_raycast only renders spheres" << endl;
+  return {Camera::fromScene(description.camera), lights, spheres};
+}
+
+/*!
+ * Render the built in scene or the scene file selected on the command line
+ * Spheres do not move, so sequences render the image once and save a copy of it for each frame on a background thread
+ * @param options Command line settings
+ */
+template<typename T>
+void render(const RenderOptions &options) {
+  Image image{options.width, options.height};
+  auto begin = chrono::steady_clock::now();
+  auto world = options.scene.empty() ? defaultScene<T>() : loadScene<T>(options.scene);
+  world.camera.right *= (double) image.width / image.height;
+  cout << "Scene with " << world.spheres.size() << " spheres loaded in "
+       << chrono::duration<double>(chrono::steady_clock::now() - begin).count() << " s" << endl;
+
+  // Render the scene using the requested number of threads
+  TileScheduler scheduler{options.threads, options.tileSize};
+  ImageWriter writer;
+  world.render(image, options.samples, options.seed, scheduler);
+  for (unsigned int frame = options.firstFrame; frame < options.firstFrame + options.frames; ++frame)
+    writer.save(image, options.frameOutput(frame));
+  writer.finish();
+  scheduler.printStatistics(cout);
+}
+
+/*!
+ * Compute the peak signal to noise ratio of an image against a reference
+ * @param reference Reference image
+ * @param image Image of the same size to compare
+ * @return PSNR in dB, infinity for identical images
+ */
+double psnr(Image &reference, Image &image) {
+  double error = 0;
+  auto &a = reference.getFramebuffer();
+  auto &b = image.getFramebuffer();
+  for (size_t i = 0; i < a.size(); ++i) {
+    double dr = a[i].r - b[i].r, dg = a[i].g - b[i].g, db = a[i].b - b[i].b;
+    error += dr * dr + dg * dg + db * db;
+  }
+  double mse = error / (3.0 * a.size());
+  return mse > 0 ? 10 * log10(255.0 * 255.0 / mse) : numeric_limits<double>::infinity();
+}
+
+/*!
+ * Compare throughput and image quality of single precision against the double precision reference
+ */
+void benchmark() {
+  Image doubleImage{512, 512}, floatImage{512, 512};
+  TileScheduler scheduler{0, 16};
+  const unsigned int samples = 16;
+
+  auto begin = chrono::steady_clock::now();
+  defaultScene<double>().render(doubleImage, samples, 1, scheduler);
+  double doubleTime = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+  begin = chrono::steady_clock::now();
+  defaultScene<float>().render(floatImage, samples, 1, scheduler);
+  double floatTime = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+  double rays = 512.0 * 512.0 * samples;
+  cout << "Precision: double " << rays / doubleTime / 1e6 << " Mrays/s, "
+       << "float " << rays / floatTime / 1e6 << " Mrays/s, "
+       << "speedup " << doubleTime / floatTime << "x, PSNR " << psnr(doubleImage, floatImage) << " dB" << endl;
+}
+
+int main(int argc, char *argv[]) {
+  RenderOptions defaults;
+  defaults.output = "raw2_raycast.bmp";
+  defaults.accepted = {"--scene", "--output", "--size", "--spp", "--threads", "--tile", "--seed", "--frames", "--first-frame"};
+  const vector<pair<string, string>> flags = {
+      {"--float", "Compute geometry in single precision"},
+      {"--benchmark", "Compare single precision against the double precision reference"},
+  };
 
-  // Render the scene
-  world.render(image, 4);
+  RenderOptions options;
+  try {
+    options = parseOptions(argc, argv, defaults, {"--float", "--benchmark"});
+  } catch (const runtime_error &e) {
+    cerr << e.what() << endl;
+    printOptions(cerr, argv[0], defaults, flags);
+    return EXIT_FAILURE;
+  }
+  if (options.flag("--help")) {
+    printOptions(cout, argv[0], defaults, flags);
+    return EXIT_SUCCESS;
+  }
+
+  if (options.flag("--benchmark")) {
+    benchmark();
+    return EXIT_SUCCESS;
+  }
 
-  // Save the result
-  image::saveBMP(image, "raw2_raycast.bmp");
+  // Render in single precision when requested
+  try {
+    if (options.flag("--float"))
+      render<float>(options);
+    else
+      render<double>(options);
+  } catch (const runtime_error &e) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
 
   cout << "Done." << endl;
   return EXIT_SUCCESS;
@@ -1,32 +1,59 @@
 // Example raw3_raytrace
-// - Simple demonstration of raytracing/pathtracing without any acceleration techniques
-// - Casts rays from camera space into scene and recursively traces reflections/refractions
+// - Simple demonstration of raytracing/pathtracing
+// - Casts rays from camera space into scene and iteratively traces reflections/refractions, dim paths are terminated using Russian roulette
 // - Materials are extended to support simple specular reflections and transparency with refraction index
+// - Ray to scene collisions are accelerated using a bounding volume hierarchy
+// - Primary rays are cast in SIMD packets, 2x2 pixels of double rays or 4x2 pixels of float rays
+// - Image tiles are distributed between threads using a work stealing scheduler
+// - The image is rendered progressively and tiles stop sampling once their noise is low enough
+// - Emissive spheres are sampled directly at diffuse surfaces and combined with diffuse bounces using multiple importance sampling
+// - Diffuse reflections use cosine weighted hemisphere sampling
+// - Pixel position, light sample and reflection at the first collision are stratified between the samples of each pass
+// - Triangle meshes loaded from OBJ files are supported next to spheres, run with --mesh to render the corsair
+// - Primary rays can be cast in single precision packets of eight rays with --float, paths are traced in double precision
+// - Run with --benchmark to compare the hierarchy against brute force collision tests
+// - Animation sequences are rendered with --frames, assets are loaded once and frames are written on a background thread
+// - Scenes can be loaded from scene files, run with --help to list the options for resolution, samples, depth, threads and output
 
 #include <iostream>
+#include <chrono>
+#include <sstream>
+#include <stdexcept>
 #include <ppgso/ppgso.h>
+#include <glm/gtc/matrix_transform.hpp>
 
 using namespace std;
 using namespace glm;
 using namespace ppgso;
 
 // Global constants
-constexpr double INF = numeric_limits<double>::max();       // Will be used for infinity
-constexpr double EPS = numeric_limits<double>::epsilon();   // Numerical epsilon
-const double DELTA = sqrt(EPS);                             // Delta to use
+template<typename T>
+constexpr T INF = numeric_limits<T>::max();                 // Will be used for infinity
+constexpr unsigned int ROULETTE_DEPTH = 3;                  // Collisions traced before paths are terminated randomly
+constexpr double ROULETTE_THRESHOLD = .5;                   // Paths with brighter throughput are never terminated randomly
+constexpr unsigned int PIXEL_DIMENSION = 0;                 // Stratified position inside the pixel
+constexpr unsigned int LIGHT_DIMENSION = 1;                 // Stratified light sample at the first collision
+constexpr unsigned int BOUNCE_DIMENSION = 2;                // Stratified reflection direction at the first collision
+constexpr unsigned int CONVERGENCE_SAMPLES = 16;            // Samples a pixel takes before its noise estimate is trusted
+constexpr uint32_t NO_INDEX = numeric_limits<uint32_t>::max(); // Index used when no object was hit
+
+// Geometry is computed in the scalar type T (float or double), colors and sampling always use double
+template<typename T>
+using vec3t = tvec3<T, defaultp>;
 
 /*!
  * Structure holding origin and direction that represents a ray
  */
+template<typename T>
 struct Ray {
-  dvec3 origin, direction;
+  vec3t<T> origin, direction;
 
   /*!
    * Compute a point on the ray
    * @param t Distance from origin
    * @return Point on ray where t is the distance from the origin
    */
-  inline dvec3 point(double t) const {
+  inline vec3t<T> point(T t) const {
     return origin + direction * t;
   }
 };
@@ -43,16 +70,19 @@ struct Material {
 /*!
  * Structure to represent a ray to object collision, the Hit structure will contain material surface normal
  */
+template<typename T>
 struct Hit {
-  double distance;
-  dvec3 point, normal;
+  T distance;
+  vec3t<T> point, normal;
   Material material;
+  uint32_t index;
 };
 
 /*!
  * Constant for collisions that have not hit any object in the scene
  */
-const Hit noHit{ INF, {0,0,0}, {0,0,0}, { {0,0,0}, {0,0,0}, 0, 0, 0 } };
+template<typename T>
+const Hit<T> noHit{ INF<T>, {0,0,0}, {0,0,0}, { {0,0,0}, {0,0,0}, 0, 0, 0 }, NO_INDEX };
 
 /*!
  * Structure representing a simple camera that is composed on position, up, back and right vectors
@@ -60,192 +90,801 @@ const Hit noHit{ INF, {0,0,0}, {0,0,0}, { {0,0,0}, {0,0,0}, 0, 0, 0 } };
 struct Camera {
   dvec3 position, back, up, right;
 
+  /*!
+   * Create a camera described in a scene file, the image is expected to be square
+   * @param description Position, target, up direction and vertical field of view of the camera
+   * @return Camera looking from the position at the target
+   */
+  static Camera fromScene(const scene::Camera &description) {
+    double size = tan(radians(description.fov) / 2);
+    dvec3 back = normalize(description.position - description.target);
+    dvec3 right = normalize(cross(description.up, back));
+    return {description.position, back, cross(back, right) * size, right * size};
+  }
+
   /*!
    * Generate a new Ray for the given viewport size and position
    * @param x Horizontal position in the viewport
    * @param y Vertical position in the viewport
    * @param width Width of the viewport
    * @param height Height of the viewport
-   * @return Ray for the giver viewport position with small random deviation applied to support multi-sampling
+   * @param offset Position inside the pixel, both coordinates in range <0, 1)
+   * @return Ray for the giver viewport position with the offset applied to support multi-sampling
    */
-  Ray generateRay(int x, int y, int width, int height) const {
+  template<typename T>
+  Ray<T> generateRay(int x, int y, int width, int height, const dvec2 &offset) const {
     // Camera deltas
     dvec3 vdu = 2.0 * right / (double)width;
     dvec3 vdv = 2.0 * -up / (double)height;
 
-    Ray ray;
-    ray.origin = position;
-    ray.direction = -back
-                  + vdu * ((double)(-width/2 + x) + linearRand(0.0, 1.0))
-                  + vdv * ((double)(-height/2 + y) + linearRand(0.0, 1.0));
-    ray.direction = normalize(ray.direction);
-    return ray;
+    dvec3 direction = -back
+                    + vdu * ((double)(-width/2 + x) + offset.x)
+                    + vdv * ((double)(-height/2 + y) + offset.y);
+    return {vec3t<T>{position}, vec3t<T>{normalize(direction)}};
+  }
+
+  /*!
+   * Generate a new Ray through a random position inside the pixel
+   * @param x Horizontal position in the viewport
+   * @param y Vertical position in the viewport
+   * @param width Width of the viewport
+   * @param height Height of the viewport
+   * @param random Random number generator used for the deviation
+   * @return Ray for the giver viewport position with small random deviation applied to support multi-sampling
+   */
+  template<typename T>
+  Ray<T> generateRay(int x, int y, int width, int height, Random &random) const {
+    double u = random.linearRand(0.0, 1.0);
+    return generateRay<T>(x, y, width, height, dvec2{u, random.linearRand(0.0, 1.0)});
   }
 };
 
 /*!
  * Structure representing a sphere which is defined by its center position, radius and material
  */
+template<typename T>
 struct Sphere {
-  double radius;
-  dvec3 center;
+  T radius;
+  vec3t<T> center;
   Material material;
 
   /*!
-   * Compute ray to sphere collision
+   * Compute distance of the ray to sphere collision, the hit itself is only built for the closest primitive
+   * The discriminant is computed from the distance of the sphere center to the ray instead of b*b - a*c, which
+   * loses all precision in float for large spheres. Rays that start on the surface of this sphere are handled
+   * separately, a sphere is convex so such ray can only hit its far side and only when heading inside.
    * @param ray Ray to compute collision against
-   * @return Hit structure that represents the collision or noHit.
+   * @param start True if the ray starts on the surface of this sphere
+   * @return Distance along the ray or INF when the sphere is missed
    */
-  inline Hit hit(const Ray &ray) const {
-    dvec3 oc = ray.origin - center;
-    double a = dot(ray.direction, ray.direction);
-    double b = dot(oc, ray.direction);
-    double c = dot(oc, oc) - radius * radius;
-    double dis = b * b - a * c;
+  inline T intersect(const Ray<T> &ray, bool start = false) const {
+    vec3t<T> oc = ray.origin - center;
+    T a = dot(ray.direction, ray.direction);
+    T b = dot(oc, ray.direction);
 
-    if (dis > 0) {
-      double e = sqrt(dis);
-      double t = (-b - e) / a;
+    if (start) {
+      // Origin is on the surface so one solution is zero, the other one is the length of the chord
+      T t = -2 * b / a;
+      return b < 0 && t > 0 ? t : INF<T>;
+    }
 
-      if ( t > EPS ) {
-        dvec3 pt = ray.point(t);
-        dvec3 n = normalize(pt - center);
-        return {t, pt, n, material};
-      }
+    vec3t<T> l = oc - ray.direction * (b / a);
+    T dis = a * (radius * radius - dot(l, l));
 
-      t = (-b + e) / a;
+    if (dis > 0) {
+      T e = sqrt(dis);
+      T t = (-b - e) / a;
+      if ( t > 0 ) return t;
 
-      if ( t > EPS ) {
-        dvec3 pt = ray.point(t);
-        dvec3 n = normalize(pt - center);
-        return {t, pt, n, material};
-      }
+      t = (-b + e) / a;
+      if ( t > 0 ) return t;
     }
-    return noHit;
+    return INF<T>;
+  }
+
+  /*!
+   * Compute ray to sphere collision
+   * @param ray Ray that hit the sphere
+   * @param t Distance of the hit computed by intersect
+   * @return Hit structure that represents the collision
+   */
+  inline Hit<T> hit(const Ray<T> &ray, T t) const {
+    vec3t<T> pt = ray.point(t);
+    return {t, pt, normalize(pt - center), material, NO_INDEX};
+  }
+
+
+  /*!
+   * Compute the cone of directions in which the sphere is seen from a point
+   * @param point Point outside of the sphere
+   * @param axis Output normalized direction towards the sphere center
+   * @param cosThetaMax Output cosine of the cone half angle
+   * @return false if the point is inside the sphere
+   */
+  inline bool cone(const dvec3 &point, dvec3 &axis, double &cosThetaMax) const {
+    dvec3 d = dvec3{center} - point;
+    double distance2 = dot(d, d), r = radius;
+    if (distance2 <= r * r) return false;
+    double distance = sqrt(distance2);
+    axis = d / distance;
+    cosThetaMax = sqrt(std::max(0.0, 1.0 - r * r / distance2));
+    return true;
+  }
+
+  /*!
+   * Compute the axis aligned bounding box of the sphere
+   * @return Box enclosing the sphere
+   */
+  BVH::Box bounds() const {
+    return {center - vec3t<T>{radius}, center + vec3t<T>{radius}};
   }
 };
 
 /*!
- * Generate a normalized vector that sits on the surface of a half-sphere which is defined using a normal. Used to generate random diffuse reflections.
+ * Generate a normalized vector that sits on the surface of a half-sphere which is defined using a normal.
+ * Rejection sampled with uniform distribution, replaced by sampling::cosineHemisphere and kept as a reference for the benchmark.
  * @param normal Normal that defines the dome/half-sphere direction
+ * @param random Random number generator to use
  * @return Random 3D vector on the dome surface
  */
-inline dvec3 RandomDome(const dvec3 &normal) {
+inline dvec3 RandomDome(const dvec3 &normal, Random &random) {
   double d;
   dvec3 p;
 
   do {
-    p = sphericalRand(1.0);
+    p = random.sphericalRand(1.0);
     d = dot(p, normal);
   } while(d < 0);
 
   return p;
 }
 
+/*!
+ * Triangle mesh loaded from a Wavefront .obj file and placed in the world using a transformation
+ * Animated sequences turn the mesh around its vertical axis by spin degrees each frame
+ */
+struct MeshInstance {
+  string file;
+  mat4 transform;
+  Material material;
+  double spin = 0;
+};
+
+/*!
+ * Running per pixel sums used to render the image progressively in multiple passes
+ * Image tiles whose noise estimate drops below a threshold are marked as converged and receive no more samples
+ */
+struct Accumulator {
+  int width, height, tileSize, tilesX;
+  vector<dvec3> sum;
+  vector<double> sumSquares;
+  vector<unsigned int> count;
+  vector<Random> random;
+  vector<char> converged;
+
+  /*!
+   * Create empty sums for an image
+   * @param width Width of the image
+   * @param height Height of the image
+   * @param tileSize Size of the scheduler tiles, convergence is decided for whole tiles
+   * @param seed Seed of the random sequences, every pixel continues its own sequence across passes
+   */
+  Accumulator(int width, int height, int tileSize, uint64_t seed) : width{width}, height{height}, tileSize{tileSize} {
+    tilesX = (width + tileSize - 1) / tileSize;
+    int tilesY = (height + tileSize - 1) / tileSize;
+    auto size = (size_t) (width * height);
+    sum.resize(size);
+    sumSquares.resize(size);
+    count.resize(size);
+    converged.resize((size_t) (tilesX * tilesY));
+    random.reserve(size);
+    for (size_t i = 0; i < size; ++i)
+      random.emplace_back(seed, i);
+  }
+
+  /*!
+   * Add a sample to a pixel
+   * @param index Index of the pixel
+   * @param color Sampled color
+   */
+  void add(size_t index, const dvec3 &color) {
+    sum[index] += color;
+    sumSquares[index] += luminance(color) * luminance(color);
+    count[index]++;
+  }
+
+  /*!
+   * Estimate the noise of a pixel as the standard error of its mean luminance
+   * @param index Index of the pixel
+   * @return Standard error, infinity when there are not enough samples
+   */
+  double error(size_t index) const {
+    double n = count[index];
+    if (n < 2) return INF<double>;
+    double mean = luminance(sum[index]) / n;
+    double variance = std::max(0.0, (sumSquares[index] / n - mean * mean) * n / (n - 1));
+    return sqrt(variance / n);
+  }
+
+  /*!
+   * Check if a tile has converged
+   * @param tile Tile produced by the scheduler
+   * @return true if the tile needs no more samples
+   */
+  bool isConverged(const Tile &tile) const {
+    return converged[tile.x / tileSize + tile.y / tileSize * tilesX] != 0;
+  }
+
+  /*!
+   * Mark a tile as converged when the noise of all its pixels is below the threshold
+   * Pixels need CONVERGENCE_SAMPLES first, a few samples that happen to agree estimate no noise at all
+   * @param tile Tile produced by the scheduler
+   * @param threshold Largest allowed standard error of pixel luminance
+   */
+  void updateConvergence(const Tile &tile, double threshold) {
+    for (int y = tile.y; y < tile.y + tile.height; ++y)
+      for (int x = tile.x; x < tile.x + tile.width; ++x) {
+        auto index = (size_t) (x + y * width);
+        if (count[index] < CONVERGENCE_SAMPLES || error(index) > threshold) return;
+      }
+    converged[tile.x / tileSize + tile.y / tileSize * tilesX] = 1;
+  }
+
+  /*!
+   * Store the current mean of all pixels in an image
+   * @param image Image of the same size as the accumulator
+   */
+  void resolve(Image &image) const {
+    for (int y = 0; y < height; ++y) {
+      for (int x = 0; x < width; ++x) {
+        auto index = (size_t) (x + y * width);
+        dvec3 c = count[index] ? sum[index] / (double) count[index] : dvec3{0};
+        image.setPixel(x, y, (float) c.r, (float) c.g, (float) c.b);
+      }
+    }
+  }
+
+  /*!
+   * Total number of samples taken by all pixels
+   */
+  unsigned long samples() const {
+    unsigned long total = 0;
+    for (auto c : count) total += c;
+    return total;
+  }
+
+  /*!
+   * Number of tiles that still receive samples
+   */
+  size_t activeTiles() const {
+    return (size_t) std::count(converged.begin(), converged.end(), 0);
+  }
+
+private:
+  static double luminance(const dvec3 &color) {
+    return dot(color, dvec3{0.2126, 0.7152, 0.0722});
+  }
+};
+
 /*!
  * Structure to represent the scene/world to render
+ * Collisions are computed using scalar type T and packets of primary rays using type P. Scalar float is not faster
+ * than double, so only packets gain from single precision where a SIMD register holds twice as many rays
  */
+template<typename T, typename P = T>
 struct World {
   Camera camera;
-  vector<Sphere> spheres;
+  vector<Sphere<T>> spheres;
+  vector<uint32_t> lights;
+  SphereArrays<P> sphereArrays;
+  TriangleArrays triangles, meshTriangles;
+  vector<uint32_t> triangleMeshes;
+  vector<MeshInstance> meshes;
+  vector<uint32_t> meshOffsets;
+  BVH bvh;
+  bool lightSampling = true;
+  bool cosineSampling = true;
+
+  /*!
+   * Create the world and build the acceleration structure for its spheres and mesh triangles
+   * Primitives are numbered with spheres first, triangles follow after the last sphere
+   * @param camera Camera to render the world from
+   * @param spheres Spheres in the world
+   * @param meshes Triangle meshes in the world
+   */
+  World(const Camera &camera, const vector<Sphere<T>> &spheres, const vector<MeshInstance> &meshes = {}) : camera{camera}, spheres{spheres}, meshes{meshes} {
+    // Meshes keep their untransformed triangles so they can be moved between frames
+    for (auto &mesh : meshes) {
+      meshOffsets.push_back((uint32_t) meshTriangles.size());
+      auto count = meshTriangles.load(mesh.file, mat4{1.0f});
+      triangleMeshes.insert(triangleMeshes.end(), count, (uint32_t) (meshOffsets.size() - 1));
+      triangles.transform(meshTriangles, meshOffsets.back(), count, mesh.transform);
+    }
+    meshOffsets.push_back((uint32_t) meshTriangles.size());
+
+    for (auto &sphere : spheres)
+      sphereArrays.push_back(vec3t<P>{sphere.center}, (P) sphere.radius);
+    bvh.build(bounds());
+
+    // Emissive spheres are sampled explicitly as light sources
+    for (uint32_t i = 0; i < spheres.size(); ++i)
+      if (spheres[i].material.emission != dvec3{0, 0, 0})
+        lights.push_back(i);
+  }
+
+  /*!
+   * Bounding boxes of all primitives, spheres first
+   */
+  vector<BVH::Box> bounds() const {
+    vector<BVH::Box> boxes;
+    boxes.reserve(primitives());
+    for (auto &sphere : spheres)
+      boxes.push_back(sphere.bounds());
+    for (uint32_t i = 0; i < triangles.size(); ++i)
+      boxes.push_back(triangles.bounds(i));
+    return boxes;
+  }
+
+  /*!
+   * Move the animated meshes to their place in a frame of the sequence and refit the hierarchy around them
+   * @param frame Frame of the sequence
+   * @return true if anything moved
+   */
+  bool setFrame(unsigned int frame) {
+    bool moved = false;
+    for (size_t i = 0; i < meshes.size(); ++i) {
+      if (meshes[i].spin == 0) continue;
+      triangles.transform(meshTriangles, meshOffsets[i], meshOffsets[i + 1] - meshOffsets[i],
+                          scene::turntable(meshes[i].transform, meshes[i].spin, frame));
+      moved = true;
+    }
+    if (moved) bvh.refit(bounds());
+    return moved;
+  }
+
+  /*!
+   * Number of spheres and triangles in the world
+   */
+  inline size_t primitives() const {
+    return spheres.size() + triangles.size();
+  }
+
+  /*!
+   * Compute distance of the ray to a single primitive
+   * @param ray Ray to compute collision against
+   * @param index Index of the sphere or triangle
+   * @param start Index of the primitive the ray starts on
+   * @return Distance along the ray or INF when the primitive is missed
+   */
+  inline T intersect(const Ray<T> &ray, uint32_t index, uint32_t start) const {
+    if (index < spheres.size())
+      return spheres[index].intersect(ray, index == start);
+
+    // Ray leaving a triangle can not hit the same plane again
+    if (index == start) return INF<T>;
+    return triangles.intersect(ray.origin, ray.direction, (uint32_t) (index - spheres.size()));
+  }
+
+  /*!
+   * Build the Hit structure for the closest primitive, meshes are two sided so triangle normals always face the ray
+   * @param ray Ray that hit the primitive
+   * @param index Index of the sphere or triangle, NO_INDEX when nothing was hit
+   * @param t Distance of the hit along the ray
+   * @return Hit or noHit structure
+   */
+  inline Hit<T> hit(const Ray<T> &ray, uint32_t index, T t) const {
+    if (index == NO_INDEX) return noHit<T>;
+
+    Hit<T> hit;
+    if (index < spheres.size()) {
+      hit = spheres[index].hit(ray, t);
+    } else {
+      auto triangle = (uint32_t) (index - spheres.size());
+      vec3t<T> normal{triangles.normal(triangle)};
+      if (dot(normal, ray.direction) > 0) normal = -normal;
+      hit = {t, ray.point(t), normal, meshes[triangleMeshes[triangle]].material, NO_INDEX};
+    }
+    hit.index = index;
+    return hit;
+  }
+
+  /*!
+   * Find the closest primitive along a ray without building its Hit structure
+   * @param ray Ray to trace collisions for
+   * @param distance Output distance of the closest hit, INF when nothing was hit
+   * @param start Index of the primitive the ray starts on, NO_INDEX for rays starting in empty space
+   * @return Index of the closest primitive, NO_INDEX when nothing was hit
+   */
+  inline uint32_t closest(const Ray<T> &ray, T &distance, uint32_t start = NO_INDEX) const {
+    distance = INF<T>;
+    uint32_t closest = NO_INDEX;
+    bvh.traverse(ray.origin, ray.direction, distance, [&](uint32_t index) {
+      T t = intersect(ray, index, start);
+      if (t < distance) {
+        distance = t;
+        closest = index;
+      }
+    });
+    return closest;
+  }
 
   /*!
    * Compute ray to object collision with any object in the world
+   * Candidates only update the closest distance and index, the hit is built once for the closest primitive
    * @param ray Ray to trace collisions for
+   * @param start Index of the primitive the ray starts on, NO_INDEX for rays starting in empty space
    * @return Hit or noHit structure which indicates the material and distance the ray has collided with
    */
-  inline Hit cast(const Ray &ray) const {
-    Hit hit = noHit;
-    for (auto &sphere : spheres) {
-      auto lh = sphere.hit(ray);
+  inline Hit<T> cast(const Ray<T> &ray, uint32_t start = NO_INDEX) const {
+    T distance;
+    uint32_t index = closest(ray, distance, start);
+    return hit(ray, index, distance);
+  }
+
+  /*!
+   * Check if any object blocks the ray before it travels the given distance, traversal stops at the first blocker
+   * @param ray Ray to test
+   * @param distance Distance the ray has to travel unblocked
+   * @param start Index of the primitive the ray starts on, NO_INDEX for rays starting in empty space
+   * @return true if an object is closer than distance
+   */
+  inline bool occluded(const Ray<T> &ray, T distance, uint32_t start = NO_INDEX) const {
+    return bvh.traverseAny(ray.origin, ray.direction, distance, [&](uint32_t index) {
+      return intersect(ray, index, start) < distance;
+    });
+  }
+
+  /*!
+   * Find the closest primitives of a packet of rays at once, the caller builds Hit structures only for the rays it shades
+   * Packets are intersected in the packet precision, four double or eight float rays at once
+   * @param rays Rays to trace collisions for
+   * @param distances Output distance of the closest hit of each ray, INF when nothing was hit
+   * @param indices Output index of the closest primitive of each ray, NO_INDEX when nothing was hit
+   */
+  inline void cast(const Ray<T> (&rays)[RayPacket<P>::SIZE], P (&distances)[RayPacket<P>::SIZE],
+                   uint32_t (&indices)[RayPacket<P>::SIZE]) const {
+    const int SIZE = RayPacket<P>::SIZE;
+    vec3t<P> origins[SIZE], directions[SIZE];
+    for (int i = 0; i < SIZE; ++i) {
+      origins[i] = vec3t<P>{rays[i].origin};
+      directions[i] = vec3t<P>{rays[i].direction};
+    }
+    RayPacket<P> packet{origins, directions};
+
+    using Lanes = typename RayPacket<P>::Lanes;
+    Lanes distance{INF<P>}, index = Lanes::index(NO_INDEX);
+    bvh.traverse(packet.origin, packet.direction, distance, [&](uint32_t i) {
+      if (i < spheres.size())
+        sphereArrays.intersect(packet, i, 0, distance, index);
+      else
+        triangles.intersect(packet, (uint32_t) (i - spheres.size()), i, distance, index);
+    });
+
+    distance.store(distances);
+    index.storeIndices(indices);
+  }
+
+  /*!
+   * Build the Hit structure for the closest primitive found by a packet
+   * A packet of lower precision than the world only picks the primitive, its distance is recomputed in type T
+   * @param ray Ray of the packet
+   * @param index Index of the closest primitive, NO_INDEX when nothing was hit
+   * @param distance Distance of the hit computed by the packet
+   * @return Hit or noHit structure
+   */
+  inline Hit<T> packetHit(const Ray<T> &ray, uint32_t index, P distance) const {
+    if (is_same<T, P>::value || index == NO_INDEX) return hit(ray, index, (T) distance);
+    T t = intersect(ray, index, NO_INDEX);
+    return hit(ray, index, t < INF<T> ? t : (T) distance);
+  }
 
-      if (lh.distance < hit.distance) {
-        hit = lh;
+  /*!
+   * Compute ray to object collision by testing every object in the world, used as a reference for cast
+   * @param ray Ray to trace collisions for
+   * @return Hit or noHit structure which indicates the material and distance the ray has collided with
+   */
+  inline Hit<T> castLinear(const Ray<T> &ray) const {
+    T distance = INF<T>;
+    uint32_t closest = NO_INDEX;
+    for (uint32_t index = 0; index < primitives(); ++index) {
+      T t = intersect(ray, index, NO_INDEX);
+      if (t < distance) {
+        distance = t;
+        closest = index;
       }
     }
-    return hit;
+    return hit(ray, closest, distance);
   }
 
   /*!
    * Trace a ray as it collides with objects in the world
    * @param ray Ray to trace
    * @param depth Maximum number of collisions to trace
+   * @param random Random number generator used for sampling
    * @return Color representing the accumulated lighting for each ray collision
    */
-  inline dvec3 trace(const Ray &ray, unsigned int depth) const {
+  inline dvec3 trace(const Ray<T> &ray, unsigned int depth, Random &random) const {
+    return shade(ray, cast(ray), depth, random);
+  }
+
+  /*!
+   * Probability density of sampling a direction towards a light with sampleLight
+   * @param point Point the light is sampled from
+   * @param index Index of the primitive the direction hits
+   * @return Density with respect to solid angle, 0 if the primitive is not sampled as a light
+   */
+  inline double lightPdf(const dvec3 &point, uint32_t index) const {
+    dvec3 axis;
+    double cosThetaMax;
+    if (index >= spheres.size() || spheres[index].material.emission == dvec3{0, 0, 0} || !spheres[index].cone(point, axis, cosThetaMax)) return 0;
+    return sampling::uniformConePdf(cosThetaMax) / (double) lights.size();
+  }
+
+  /*!
+   * Generate a random diffuse reflection direction
+   * @param normal Surface normal
+   * @param u Point in the unit square used by cosine weighted sampling
+   * @param random Random number generator used by rejection sampling
+   * @return Normalized direction on the hemisphere above the surface
+   */
+  inline dvec3 diffuseDirection(const dvec3 &normal, const dvec2 &u, Random &random) const {
+    return cosineSampling ? sampling::cosineHemisphere(normal, u) : RandomDome(normal, random);
+  }
+
+  /*!
+   * Probability density of directions generated by diffuseDirection
+   * @param cosine Cosine of the angle between the direction and the normal
+   * @return Density with respect to solid angle
+   */
+  inline double diffusePdf(double cosine) const {
+    return cosineSampling ? sampling::cosineHemispherePdf(cosine) : sampling::uniformHemispherePdf();
+  }
+
+  /*!
+   * Estimate light arriving directly from a randomly chosen emissive sphere at a diffuse hit (next event estimation)
+   * The sample is weighted against diffuse reflection sampling using multiple importance sampling
+   * @param hit Diffuse surface collision
+   * @param u Point in the unit square that selects the direction inside the cone of the light
+   * @param random Random number generator used to pick the light
+   * @return Reflected light, weighted by the diffuse reflectance and surface orientation
+   */
+  inline dvec3 sampleLight(const Hit<T> &hit, const dvec2 &u, Random &random) const {
+    if (lights.empty()) return {0, 0, 0};
+
+    // Pick a light and a direction inside the cone it occupies
+    auto pick = std::min(lights.size() - 1, (size_t) random.linearRand(0.0, (double) lights.size()));
+    uint32_t index = lights[pick];
+    // Convex sphere never lights its own outer surface, checked by index so the result does not depend on precision
+    if (index == hit.index) return {0, 0, 0};
+    Ray<T> lightRay{offsetRay(hit.point, hit.normal), {}};
+    dvec3 axis;
+    double cosThetaMax;
+    if (!spheres[index].cone(dvec3{lightRay.origin}, axis, cosThetaMax)) return {0, 0, 0};
+    dvec3 direction = sampling::uniformCone(axis, cosThetaMax, u);
+    lightRay.direction = vec3t<T>{direction};
+
+    double cosine = dot(direction, dvec3{hit.normal});
+    if (cosine <= 0) return {0, 0, 0};
+
+    // Light is obscured by other object
+    T lightDistance = spheres[index].intersect(lightRay);
+    if (lightDistance >= INF<T> || occluded(lightRay, lightDistance, hit.index)) return {0, 0, 0};
+
+    // Lambertian reflection of the light weighted using the power heuristic
+    double pdf = sampling::uniformConePdf(cosThetaMax) / (double) lights.size();
+    double weight = sampling::powerHeuristic(pdf, diffusePdf(cosine));
+    return hit.material.diffuse * one_over_pi<double>() * cosine * spheres[index].material.emission * weight / pdf;
+  }
+
+  /*!
+   * Follow a path from a ray that has already collided with an object and accumulate the light along it
+   * The path is traced in a loop, throughput holds the product of material colors seen so far. After ROULETTE_DEPTH
+   * collisions paths whose throughput dropped below ROULETTE_THRESHOLD are terminated randomly (Russian roulette),
+   * surviving paths are weighted up so the result stays unbiased. The depth limit only caps extremely long paths, at
+   * the last collision only its emission is counted.
+   * At diffuse surfaces light sources are also sampled directly, light found by the diffuse bounce is then weighted
+   * using multiple importance sampling so no light is counted twice.
+   * Light sampling and reflection at the first collision are stratified between the samples of the pixel.
+   * @param ray Ray that caused the hit
+   * @param hit Collision of the ray with the world
+   * @param depth Maximum number of collisions to trace
+   * @param random Random number generator used for sampling
+   * @param strata Position of the sample among the samples the pixel receives in this pass, by default not stratified
+   * @return Color representing the accumulated lighting for each ray collision
+   */
+  inline dvec3 shade(Ray<T> ray, Hit<T> hit, unsigned int depth, Random &random, sampling::Strata strata = {}) const {
+    dvec3 radiance{0, 0, 0};
+    dvec3 throughput{1, 1, 1};
+    // Density of the diffuse bounce that generated the ray, 0 for camera rays and specular bounces
+    double bouncePdf = 0;
+
+    for (unsigned int bounce = 1; bounce <= depth && hit.distance < INF<T>; ++bounce) {
+      // Emission, weighted against light sampling done at the previous diffuse hit
+      if (hit.material.emission != dvec3{0, 0, 0}) {
+        double weight = bouncePdf > 0 ? sampling::powerHeuristic(bouncePdf, lightPdf(dvec3{ray.origin}, hit.index)) : 1.0;
+        radiance += throughput * hit.material.emission * weight;
+      }
+
+      // The next collision would not be traced, so neither light sampling nor the bounce it is weighted against are done
+      if (bounce == depth) break;
+
+      // New directions are computed in double precision
+      dvec3 direction{ray.direction}, hitNormal{hit.normal};
+
+      // Decide to reflect or refract using linear random
+      if (random.linearRand(0.0, 1.0) < hit.material.transparency) {
+        // Flip normal if the ray is "inside" a sphere
+        dvec3 normal = dot(direction, hitNormal) < 0 ? hitNormal : -hitNormal;
+        // Reverse the refraction index as well
+        double r_index = dot(direction, hitNormal) < 0 ? 1/hit.material.refractionIndex : hit.material.refractionIndex;
+
+        // Continue with the refraction ray modulated by the diffuse color
+        ray = {offsetRay(hit.point, vec3t<T>{-normal}), vec3t<T>{refract(direction, normal, r_index)}};
+        throughput *= lerp(hit.material.diffuse, {1,1,1}, hit.material.transparency);
+        bouncePdf = 0;
+      } else if (hit.material.reflectivity > 0) {
+        // Random diffuse reflection
+        dvec3 diffuse = diffuseDirection(hitNormal, sampling::stratified(strata, BOUNCE_DIMENSION, random), random);
+        // Ideal specular reflection
+        dvec3 reflection = reflect(direction, hitNormal);
+        // Continue with a ray that combines reflection direction depending on the material reflectivness
+        // Reflection color is white for specular reflections, otherwise diffuse color is used
+        ray = {offsetRay(hit.point, hit.normal), vec3t<T>{lerp(diffuse, reflection, hit.material.reflectivity)}};
+        throughput *= lerp(hit.material.diffuse, {1, 1, 1}, hit.material.reflectivity);
+        bouncePdf = 0;
+      } else {
+        // Direct light
+        if (lightSampling) radiance += throughput * sampleLight(hit, sampling::stratified(strata, LIGHT_DIMENSION, random), random);
+
+        // Random diffuse reflection, Lambertian reflectance divided by the sampling density
+        // Cosine weighted directions cancel out the reflectance so only the albedo remains
+        dvec3 diffuse = diffuseDirection(hitNormal, sampling::stratified(strata, BOUNCE_DIMENSION, random), random);
+        ray = {offsetRay(hit.point, hit.normal), vec3t<T>{diffuse}};
+        double cosine = dot(diffuse, hitNormal);
+        throughput *= hit.material.diffuse * (cosineSampling ? 1.0 : one_over_pi<double>() * cosine / diffusePdf(cosine));
+        bouncePdf = lightSampling ? diffusePdf(cosine) : 0;
+      }
+
+      // Only the first collision is stratified, the rest of the path is sampled independently
+      strata = {};
+
+      // Russian roulette
+      double brightness = std::max(throughput.r, std::max(throughput.g, throughput.b));
+      if (bounce >= ROULETTE_DEPTH && brightness < ROULETTE_THRESHOLD) {
+        double survival = brightness / ROULETTE_THRESHOLD;
+        if (random.linearRand(0.0, 1.0) >= survival) break;
+        throughput /= survival;
+      }
+
+      // The new ray starts on the surface that was hit
+      hit = cast(ray, hit.index);
+    }
+
+    return radiance;
+  }
+
+  /*!
+   * Recursive formulation of trace with a hard depth limit, used as a reference in the benchmark
+   * @param ray Ray to trace
+   * @param depth Maximum number of collisions to trace
+   * @param random Random number generator used for sampling
+   * @param start Index of the primitive the ray starts on, NO_INDEX for rays starting in empty space
+   * @return Color representing the accumulated lighting for each ray collision
+   */
+  inline dvec3 traceRecursive(const Ray<T> &ray, unsigned int depth, Random &random, uint32_t start = NO_INDEX) const {
     if (depth == 0) return {0, 0, 0};
 
-    const Hit hit = cast(ray);
+    const Hit<T> hit = cast(ray, start);
 
     // No hit
-    if ( std::isinf(hit.distance)) return {0, 0, 0};
+    if (hit.distance >= INF<T>) return {0, 0, 0};
 
     // Emission
     dvec3 color = hit.material.emission;
+    dvec3 direction{ray.direction}, hitNormal{hit.normal};
 
     // Decide to reflect or refract using linear random
-    if (linearRand(0.0f, 1.0f) < hit.material.transparency) {
-      // Flip normal if the ray is "inside" a sphere
-      dvec3 normal = dot(ray.direction, hit.normal) < 0 ? hit.normal : -hit.normal;
-      // Reverse the refraction index as well
-      double r_index = dot(ray.direction, hit.normal) < 0 ? 1/hit.material.refractionIndex : hit.material.refractionIndex;
-
-      // Prepare refraction ray
-      dvec3 refraction = refract(ray.direction, normal, r_index);
-      Ray refractionRay{hit.point - normal * DELTA, refraction};
-      // Modulate the refraction color with diffuse color
+    if (random.linearRand(0.0, 1.0) < hit.material.transparency) {
+      dvec3 normal = dot(direction, hitNormal) < 0 ? hitNormal : -hitNormal;
+      double r_index = dot(direction, hitNormal) < 0 ? 1/hit.material.refractionIndex : hit.material.refractionIndex;
+      Ray<T> refractionRay{offsetRay(hit.point, vec3t<T>{-normal}), vec3t<T>{refract(direction, normal, r_index)}};
       dvec3 refractionColor = lerp(hit.material.diffuse, {1,1,1}, hit.material.transparency);
-      // Trace the ray recursively
-      color += refractionColor * trace(refractionRay, depth - 1);
+      color += refractionColor * traceRecursive(refractionRay, depth - 1, random, hit.index);
     } else {
-      // Calculate reflection
-      // Random diffuse reflection
-      dvec3 diffuse = RandomDome(hit.normal);
-      // Ideal specular reflection
-      dvec3 reflection = reflect(ray.direction, hit.normal);
-      // Ray that combines reflection direction depending on the material reflectivness
-      Ray reflectedRay{hit.point + hit.normal * DELTA, lerp(diffuse, reflection, hit.material.reflectivity)};
-      // Reflection color is white for specular reflections, otherwise diffuse color is used
+      dvec3 diffuse = sampling::cosineHemisphere(hitNormal, random);
+      dvec3 reflection = reflect(direction, hitNormal);
+      Ray<T> reflectedRay{offsetRay(hit.point, hit.normal), vec3t<T>{lerp(diffuse, reflection, hit.material.reflectivity)}};
       dvec3 reflectionColor = lerp(hit.material.diffuse, {1, 1, 1}, hit.material.reflectivity);
-      // Trace the ray recursively
-      color += reflectionColor * trace(reflectedRay, depth - 1);
+      color += reflectionColor * traceRecursive(reflectedRay, depth - 1, random, hit.index);
     }
 
     return color;
   }
 
   /*!
-   * Render the world to the provided image
-   * @param image Image to render to
+   * Add samples to all tiles of the accumulator that have not converged yet
+   * @param accumulator Running sums of the progressive rendering
+   * @param samples Number of samples per pixel to add in this pass
+   * @param depth Maximum number of collisions to trace
+   * @param threshold Tiles with pixel noise below this threshold stop receiving samples, 0 to disable
+   * @param scheduler Scheduler that distributes image tiles between threads
    */
-  void render(Image& image, unsigned int samples, unsigned int depth) const {
-    // For each pixel generate rays
-    #pragma omp parallel for
-    for (int y = 0; y < image.height; ++y) {
-      for (int x = 0; x < image.width; ++x) {
-        dvec3 color{};
-
-        // Generate multiple samples
-        for (unsigned int i = 0; i < samples; ++i) {
-          auto ray = camera.generateRay(x, y, image.width, image.height);
-          color = color + trace(ray, depth);
+  void renderPass(Accumulator &accumulator, unsigned int samples, unsigned int depth, double threshold, TileScheduler &scheduler) const {
+    int width = accumulator.width, height = accumulator.height;
+    scheduler.run(width, height, [&](const Tile &tile, unsigned int) {
+      if (accumulator.isConverged(tile)) return;
+
+      // For each block of 2x2 or 4x2 pixels generate a packet of rays
+      const int SIZE = RayPacket<P>::SIZE, WIDTH = RayPacket<P>::WIDTH;
+      for (int y = tile.y; y < tile.y + tile.height; y += 2) {
+        for (int x = tile.x; x < tile.x + tile.width; x += WIDTH) {
+          // Pixels of the block, clamped at the tile border
+          size_t index[SIZE];
+          int px[SIZE], py[SIZE];
+          for (int i = 0; i < SIZE; ++i) {
+            px[i] = std::min(x + i % WIDTH, tile.x + tile.width - 1);
+            py[i] = std::min(y + i / WIDTH, tile.y + tile.height - 1);
+            index[i] = (size_t) (px[i] + py[i] * width);
+          }
+
+          // Each pixel draws the order of its strata for this pass from its own random sequence
+          uint32_t scramble[SIZE];
+          for (int i = 0; i < SIZE; ++i) {
+            Random random = accumulator.random[index[i]];
+            scramble[i] = random.next();
+            if (px[i] == x + i % WIDTH && py[i] == y + i / WIDTH)
+              accumulator.random[index[i]] = random;
+          }
+
+          // Generate multiple samples stratified over the pixel, each pixel continues its own random sequence so the result does not depend on threads
+          for (unsigned int s = 0; s < samples; ++s) {
+            Ray<T> rays[SIZE];
+            P distances[SIZE];
+            uint32_t indices[SIZE];
+            Random random[SIZE];
+            for (int i = 0; i < SIZE; ++i) {
+              random[i] = accumulator.random[index[i]];
+              rays[i] = camera.generateRay<T>(px[i], py[i], width, height, sampling::stratified({s, samples, scramble[i]}, PIXEL_DIMENSION, random[i]));
+            }
+            cast(rays, distances, indices);
+            for (int i = 0; i < SIZE; ++i) {
+              // Lanes duplicated at the tile border are cast with the packet but not shaded
+              if (px[i] != x + i % WIDTH || py[i] != y + i / WIDTH) continue;
+              dvec3 color = shade(rays[i], packetHit(rays[i], indices[i], distances[i]), depth, random[i], {s, samples, scramble[i]});
+              accumulator.add(index[i], color);
+              accumulator.random[index[i]] = random[i];
+            }
+          }
         }
-        // Collect the data
-        color = color / (double) samples;
-        image.setPixel(x, y, (float)color.r, (float)color.g, (float)color.b);
       }
-    }
-  }
-};
 
-int main() {
-  cout << "This will take a while ..." << endl;
+      if (threshold > 0)
+        accumulator.updateConvergence(tile, threshold);
+    });
+  }
 
-  // Image to render to
-  Image image{512, 512};
+  /*!
+   * Render the world to the provided image
+   * @param image Image to render to
+   * @param samples Number of samples per pixel
+   * @param depth Maximum number of collisions to trace
+   * @param seed Seed of the random sequences, the same seed always produces the same image
+   * @param scheduler Scheduler that distributes image tiles between threads
+   */
+  void render(Image& image, unsigned int samples, unsigned int depth, uint64_t seed, TileScheduler &scheduler) const {
+    Accumulator accumulator{image.width, image.height, scheduler.getTileSize(), seed};
+    renderPass(accumulator, samples, depth, 0, scheduler);
+    accumulator.resolve(image);
+  }
+};
 
-  // World to render
-  const World world{
+/*!
+ * Create the Cornell box like scene rendered by this example
+ * @return World to render
+ */
+template<typename T, typename P = T>
+World<T, P> cornellBox() {
+  return {
       { // Camera
           {  0,   0, 25}, // Position
           {  0,   0,  1}, // Back
@@ -264,12 +903,506 @@ int main() {
           {    10, {  10, 10, -10}, { { 0, 0, 0}, { 0, 0, 1}, 0, 0, 1.54 } },       // Sphere in top right corner
       },
   };
+}
+
+/*!
+ * Create the Cornell box scene with the corsair mesh in place of the reflective sphere
+ * @return World to render
+ */
+template<typename T, typename P = T>
+World<T, P> corsairBox() {
+  auto box = cornellBox<T, P>();
+  box.spheres.erase(box.spheres.begin() + 7);
+  mat4 transform = translate(mat4{1.0f}, vec3{0, -5, 0}) * rotate(mat4{1.0f}, .8f, vec3{0, 1, 0}) *
+                   rotate(mat4{1.0f}, -1.2f, vec3{1, 0, 0}) * scale(mat4{1.0f}, vec3{14});
+  return {box.camera, box.spheres, {{"corsair.obj", transform, { {0, 0, 0}, {.7, .5, .1}, 0, 0, 0 }}}};
+}
+
+/*!
+ * Compute the peak signal to noise ratio of an image against a reference
+ * @param reference Reference image
+ * @param image Image of the same size to compare
+ * @return PSNR in dB, infinity for identical images
+ */
+double psnr(Image &reference, Image &image) {
+  double error = 0;
+  auto &a = reference.getFramebuffer();
+  auto &b = image.getFramebuffer();
+  for (size_t i = 0; i < a.size(); ++i) {
+    double dr = a[i].r - b[i].r, dg = a[i].g - b[i].g, db = a[i].b - b[i].b;
+    error += dr * dr + dg * dg + db * db;
+  }
+  double mse = error / (3.0 * a.size());
+  return mse > 0 ? 10 * log10(255.0 * 255.0 / mse) : numeric_limits<double>::infinity();
+}
+
+/*!
+ * Measure packet casting of the primary rays of the example scene against casting them one by one
+ * @param random Random number generator used for the pixel offsets
+ */
+template<typename T>
+void benchmarkPackets(Random &random) {
+  const int width = 512, height = 512, SIZE = RayPacket<T>::SIZE, WIDTH = RayPacket<T>::WIDTH;
+  const World<T> world = cornellBox<T>();
+
+  // Rays in the order the renderer generates them
+  vector<Ray<T>> rays;
+  for (int y = 0; y < height; y += 2)
+    for (int x = 0; x < width; x += WIDTH)
+      for (int i = 0; i < SIZE; ++i)
+        rays.push_back(world.camera.template generateRay<T>(x + i % WIDTH, y + i / WIDTH, width, height, random));
+
+  // Both measure finding the closest primitive, the renderer builds Hit structures only for the rays it shades
+  double singleSum = 0, packetSum = 0;
+  auto begin = chrono::steady_clock::now();
+  for (auto &ray : rays) {
+    T distance;
+    world.closest(ray, distance);
+    singleSum += distance;
+  }
+  double singleRate = rays.size() / chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+  begin = chrono::steady_clock::now();
+  for (size_t r = 0; r < rays.size(); r += SIZE) {
+    Ray<T> packet[SIZE];
+    T distances[SIZE];
+    uint32_t indices[SIZE];
+    copy(rays.begin() + r, rays.begin() + r + SIZE, packet);
+    world.cast(packet, distances, indices);
+    for (auto distance : distances)
+      packetSum += distance;
+  }
+  double packetRate = rays.size() / chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+  cout << "Primary rays, " << (sizeof(T) == sizeof(float) ? "float" : "double") << " x" << SIZE << " (" << simd::ISA
+       << "): single " << singleRate / 1e6 << " Mrays/s, "
+       << "packet " << packetRate / 1e6 << " Mrays/s, "
+       << "speedup " << packetRate / singleRate << "x"
+       << (abs(singleSum - packetSum) > 1e-6 * singleSum ? " (MISMATCH)" : "") << endl;
+}
+
+/*!
+ * Measure collision performance of the bounding volume hierarchy against brute force on random scenes
+ * and performance of packet casting of primary rays against casting them one by one
+ * Also measures triangle meshes and compares the path integrators, hemisphere samplers and single against double precision
+ */
+void benchmark() {
+  const Camera camera{{0, 0, 25}, {0, 0, 1}, {0, .5, 0}, {.5, 0, 0}};
+  const int width = 512, height = 512;
+  Random random{1};
+
+  for (int count : {10, 1000, 100000}) {
+    // Spheres randomly distributed in a box in front of the camera, smaller when there are more of them
+    vector<Sphere<double>> spheres;
+    double radius = 4.0 / cbrt((double) count);
+    for (int i = 0; i < count; ++i)
+      spheres.push_back({radius * random.linearRand(0.5, 1.5), {random.linearRand(-10, 10), random.linearRand(-10, 10), random.linearRand(-10, 10)}, {{0, 0, 0}, {1, 1, 1}, 0, 0, 0}});
+
+    auto start = chrono::steady_clock::now();
+    const World<double> world{camera, spheres};
+    double buildTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    // Keep the brute force workload bounded for large scenes
+    int rayCount = std::max(1000, std::min(200000, 100000000 / count));
+    vector<Ray<double>> rays(rayCount);
+    for (auto &ray : rays)
+      ray = camera.generateRay<double>((int) random.linearRand(0, width), (int) random.linearRand(0, height), width, height, random);
+
+    auto measure = [&](bool linear, double &checksum) {
+      auto begin = chrono::steady_clock::now();
+      for (auto &ray : rays)
+        checksum += std::min((linear ? world.castLinear(ray) : world.cast(ray)).distance, 1000.0);
+      return rayCount / chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    };
+
+    double linearSum = 0, bvhSum = 0;
+    double linearRate = measure(true, linearSum);
+    double bvhRate = measure(false, bvhSum);
+
+    cout << count << " spheres: build " << buildTime * 1000 << " ms, "
+         << "brute force " << linearRate / 1e6 << " Mrays/s, "
+         << "bvh " << bvhRate / 1e6 << " Mrays/s, "
+         << "speedup " << bvhRate / linearRate << "x"
+         << (abs(linearSum - bvhSum) > 1e-6 * linearSum ? " (MISMATCH)" : "") << endl;
+  }
+
+  // Primary rays of the example scene, four double or eight float rays per packet
+  benchmarkPackets<double>(random);
+  benchmarkPackets<float>(random);
+
+  const World<double> world = cornellBox<double>();
+  auto begin = chrono::steady_clock::now();
+
+  // Triangle meshes in the example scene, their triangles go through the same hierarchy as the spheres
+  for (auto file : {"sphere.obj", "asteroid.obj", "corsair.obj"}) {
+    begin = chrono::steady_clock::now();
+    const World<double> meshWorld{world.camera, world.spheres, {{file, scale(mat4{1.0f}, vec3{14}), { {0, 0, 0}, {1, 1, 1}, 0, 0, 0 }}}};
+    double buildTime = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+    const int meshRayCount = 20000;
+    vector<Ray<double>> meshRays(meshRayCount);
+    for (auto &ray : meshRays)
+      ray = meshWorld.camera.generateRay<double>((int) random.linearRand(0, width), (int) random.linearRand(0, height), width, height, random);
+
+    double linearSum = 0, bvhSum = 0;
+    begin = chrono::steady_clock::now();
+    for (auto &ray : meshRays)
+      linearSum += meshWorld.castLinear(ray).distance;
+    double linearRate = meshRayCount / chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    begin = chrono::steady_clock::now();
+    for (auto &ray : meshRays)
+      bvhSum += meshWorld.cast(ray).distance;
+    double bvhRate = meshRayCount / chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+    cout << file << ": " << meshWorld.triangles.size() << " triangles, build " << buildTime * 1000 << " ms, "
+         << "brute force " << linearRate / 1e6 << " Mrays/s, "
+         << "bvh " << bvhRate / 1e6 << " Mrays/s, "
+         << "speedup " << bvhRate / linearRate << "x"
+         << (abs(linearSum - bvhSum) > 1e-6 * linearSum ? " (MISMATCH)" : "") << endl;
+  }
+
+  // Turntable of the corsair, refitting the hierarchy between frames against building it again
+  {
+    World<double> animated = corsairBox<double>();
+    animated.meshes[0].spin = 10;
+    const unsigned int frames = 36;
+    begin = chrono::steady_clock::now();
+    for (unsigned int frame = 1; frame <= frames / 2; ++frame)
+      animated.setFrame(frame);
+    double refitTime = chrono::duration<double>(chrono::steady_clock::now() - begin).count() / (frames / 2);
+    // Building includes the same mesh transformation and bounds as the refit
+    World<double> rebuilt = animated;
+    begin = chrono::steady_clock::now();
+    rebuilt.triangles.transform(rebuilt.meshTriangles, 0, rebuilt.meshTriangles.size(),
+                                scene::turntable(rebuilt.meshes[0].transform, rebuilt.meshes[0].spin, frames / 2));
+    rebuilt.bvh.build(rebuilt.bounds());
+    double rebuildTime = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+    const int animatedRayCount = 100000;
+    vector<Ray<double>> animatedRays(animatedRayCount);
+    for (auto &ray : animatedRays)
+      ray = animated.camera.generateRay<double>((int) random.linearRand(0, width), (int) random.linearRand(0, height), width, height, random);
+    double refitSum = 0, rebuiltSum = 0;
+    begin = chrono::steady_clock::now();
+    for (auto &ray : animatedRays)
+      refitSum += animated.cast(ray).distance;
+    double refitRate = animatedRayCount / chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    begin = chrono::steady_clock::now();
+    for (auto &ray : animatedRays)
+      rebuiltSum += rebuilt.cast(ray).distance;
+    double rebuiltRate = animatedRayCount / chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+    cout << "Turntable, frame " << frames / 2 << ": refit " << refitTime * 1000 << " ms, build " << rebuildTime * 1000 << " ms, "
+         << "refitted " << refitRate / 1e6 << " Mrays/s, rebuilt " << rebuiltRate / 1e6 << " Mrays/s"
+         << (abs(refitSum - rebuiltSum) > 1e-6 * rebuiltSum ? " (MISMATCH)" : "") << endl;
+  }
+
+  // Full paths traced recursively with a hard depth limit and iteratively with Russian roulette at equal sample counts
+  // Light sampling is disabled so both integrators use the same estimator
+  World<double> pathWorld = cornellBox<double>();
+  pathWorld.lightSampling = false;
+  const int pathWidth = 128, pathHeight = 128, pathSamples = 8;
+  for (unsigned int depth : {5u, 32u}) {
+    for (bool recursive : {true, false}) {
+      double sum = 0;
+      begin = chrono::steady_clock::now();
+      for (int y = 0; y < pathHeight; ++y) {
+        for (int x = 0; x < pathWidth; ++x) {
+          Random pixelRandom{1, (uint64_t) (x + y * pathWidth)};
+          for (int s = 0; s < pathSamples; ++s) {
+            auto ray = pathWorld.camera.generateRay<double>(x, y, pathWidth, pathHeight, pixelRandom);
+            dvec3 color = recursive ? pathWorld.traceRecursive(ray, depth, pixelRandom) : pathWorld.trace(ray, depth, pixelRandom);
+            sum += color.r + color.g + color.b;
+          }
+        }
+      }
+      double time = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+      double paths = (double) pathWidth * pathHeight * pathSamples;
+      cout << "Paths with depth " << depth << (recursive ? ", recursive: " : ", iterative: ")
+           << paths / time / 1e6 << " Mpaths/s, mean color " << sum / paths / 3 << endl;
+    }
+  }
+
+  // Noise with and without light sampling and cosine weighted diffuse bounces, measured against a converged reference image
+  const int noiseWidth = 64, noiseHeight = 64;
+  auto renderNoise = [&](const World<double> &noiseWorld, unsigned int samples, uint64_t seed, vector<dvec3> &pixels) {
+    TileScheduler scheduler{0, 16};
+    Accumulator accumulator{noiseWidth, noiseHeight, scheduler.getTileSize(), seed};
+    auto start = chrono::steady_clock::now();
+    noiseWorld.renderPass(accumulator, samples, 32, 0, scheduler);
+    double time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    pixels.resize(noiseWidth * noiseHeight);
+    for (int i = 0; i < noiseWidth * noiseHeight; ++i)
+      pixels[i] = accumulator.sum[i] / (double) accumulator.count[i];
+    return time;
+  };
+
+  vector<dvec3> reference, pixels;
+  renderNoise(world, 1024, 2, reference);
+  for (bool lightSampling : {false, true}) {
+    for (bool cosineSampling : {false, true}) {
+      pathWorld.lightSampling = lightSampling;
+      pathWorld.cosineSampling = cosineSampling;
+      for (unsigned int samples : {4u, 32u}) {
+        double time = renderNoise(pathWorld, samples, 1, pixels);
+        double error = 0;
+        for (int i = 0; i < noiseWidth * noiseHeight; ++i) {
+          dvec3 d = pixels[i] - reference[i];
+          error += dot(d, d) / 3;
+        }
+        cout << (lightSampling ? "Light sampling, " : "Diffuse bounces only, ")
+             << (cosineSampling ? "cosine hemisphere, " : "rejection dome, ") << samples << " spp: "
+             << time * 1000 << " ms, RMSE " << sqrt(error / (noiseWidth * noiseHeight)) << endl;
+      }
+    }
+  }
+
+  // Raw throughput of the hemisphere samplers for random normals
+  const int directionCount = 1000000;
+  vector<dvec3> normals(1024);
+  for (auto &normal : normals)
+    normal = random.sphericalRand(1.0);
+  for (bool cosineSampling : {false, true}) {
+    Random directionRandom{3};
+    double checksum = 0;
+    begin = chrono::steady_clock::now();
+    for (int i = 0; i < directionCount; ++i) {
+      auto &normal = normals[i % normals.size()];
+      dvec3 direction = cosineSampling ? sampling::cosineHemisphere(normal, directionRandom) : RandomDome(normal, directionRandom);
+      checksum += dot(direction, normal);
+    }
+    double time = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    cout << (cosineSampling ? "Cosine hemisphere: " : "Rejection dome: ") << directionCount / time / 1e6
+         << " Msamples/s, mean cosine " << checksum / directionCount << endl;
+  }
+
+  // Single precision against the double precision reference, all use the same random sequences. Float geometry
+  // traces whole paths in float, float packets only cast the primary rays in float as --float does. Renders take
+  // a fraction of a second so each is timed as the best of three
+  const int precisionWidth = 256, precisionHeight = 256, precisionSamples = 8;
+  Image doubleImage{precisionWidth, precisionHeight}, floatImage{precisionWidth, precisionHeight};
+  TileScheduler scheduler{0, 16};
+  auto bestTime = [&](const auto &renderWorld, Image &image) {
+    double best = INF<double>;
+    for (int run = 0; run < 3; ++run) {
+      auto begin = chrono::steady_clock::now();
+      renderWorld.render(image, precisionSamples, 32, 1, scheduler);
+      best = std::min(best, chrono::duration<double>(chrono::steady_clock::now() - begin).count());
+    }
+    return best;
+  };
+  double doubleTime = bestTime(world, doubleImage);
+  double paths = (double) precisionWidth * precisionHeight * precisionSamples;
+  auto measurePrecision = [&](const string &name, const auto &floatWorld) {
+    double floatTime = bestTime(floatWorld, floatImage);
+    cout << "Precision, example scene: double " << paths / doubleTime / 1e6 << " Mpaths/s, "
+         << name << " " << paths / floatTime / 1e6 << " Mpaths/s, "
+         << "speedup " << doubleTime / floatTime << "x, PSNR " << psnr(doubleImage, floatImage) << " dB" << endl;
+  };
+  measurePrecision("float geometry", cornellBox<float>());
+  measurePrecision("float packets", cornellBox<double, float>());
+
+  // Scalar collisions alone on a large scene where memory traffic matters
+  vector<Sphere<double>> doubleSpheres;
+  vector<Sphere<float>> floatSpheres;
+  for (int i = 0; i < 100000; ++i) {
+    doubleSpheres.push_back({0.1 * random.linearRand(0.5, 1.5), {random.linearRand(-10, 10), random.linearRand(-10, 10), random.linearRand(-10, 10)}, {{0, 0, 0}, {1, 1, 1}, 0, 0, 0}});
+    floatSpheres.push_back({(float) doubleSpheres.back().radius, vec3{doubleSpheres.back().center}, doubleSpheres.back().material});
+  }
+  const World<double> doubleScene{camera, doubleSpheres};
+  const World<float> floatScene{camera, floatSpheres};
+  vector<Ray<double>> doubleRays;
+  vector<Ray<float>> floatRays;
+  for (int i = 0; i < 200000; ++i) {
+    Random rayRandom{2, (uint64_t) i};
+    doubleRays.push_back(camera.generateRay<double>(i % width, (i / width) % height, width, height, rayRandom));
+    floatRays.push_back({vec3{doubleRays.back().origin}, vec3{doubleRays.back().direction}});
+  }
+
+  unsigned int mismatches = 0;
+  begin = chrono::steady_clock::now();
+  vector<uint32_t> doubleHits;
+  for (auto &ray : doubleRays)
+    doubleHits.push_back(doubleScene.cast(ray).index);
+  doubleTime = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+  begin = chrono::steady_clock::now();
+  for (size_t i = 0; i < floatRays.size(); ++i)
+    if (floatScene.cast(floatRays[i]).index != doubleHits[i]) mismatches++;
+  double floatTime = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
 
-  // Render the scene
-  world.render(image, 32, 5);
+  cout << "Precision, 100000 spheres: double " << doubleRays.size() / doubleTime / 1e6 << " Mrays/s, "
+       << "float " << floatRays.size() / floatTime / 1e6 << " Mrays/s, "
+       << "speedup " << doubleTime / floatTime << "x, " << mismatches << " different hits" << endl;
+
+  // Startup cost of a large scene file compared to building its hierarchy
+  stringstream sceneFile;
+  sceneFile << "material white diffuse 1 1 1" << endl;
+  for (auto &sphere : doubleSpheres)
+    sceneFile << "sphere center " << sphere.center.x << " " << sphere.center.y << " " << sphere.center.z
+              << " radius " << sphere.radius << " material white" << endl;
+  begin = chrono::steady_clock::now();
+  auto description = scene::parse(sceneFile, "benchmark");
+  double parseTime = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+  begin = chrono::steady_clock::now();
+  const World<double> parsedScene{camera, doubleSpheres};
+  double buildTime = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+  cout << "Scene file, " << description.spheres.size() << " spheres: parsed in " << parseTime * 1e3 << " ms ("
+       << sceneFile.str().size() / parseTime / 1e6 << " MB/s), hierarchy built in " << buildTime * 1e3 << " ms" << endl;
+}
 
-  // Save the result
-  image::saveBMP(image, "raw3_raytrace.bmp");
+/*!
+ * Load the world from a scene file, emissive spheres act as lights so point lights are skipped
+ * @param file File path to the scene file
+ * @return World to render
+ */
+template<typename T, typename P = T>
+World<T, P> loadScene(const string &file) {
+  auto description = scene::load(file);
+  auto material = [&](uint32_t index) {
+    auto &m = description.materials[index];
+    return Material{m.emission, m.diffuse, m.reflectivity, m.transparency, m.refractionIndex};
+  };
+
+  vector<Sphere<T>> spheres;
+  spheres.reserve(description.spheres.size());
+  for (auto &sphere : description.spheres)
+    spheres.push_back({(T) sphere.radius, vec3t<T>{sphere.center}, material(sphere.material)});
+
+  vector<MeshInstance> meshes;
+  for (auto &mesh : description.meshes)
+    meshes.push_back({mesh.file, mesh.transform, material(mesh.material), mesh.spin});
+
+  if (!description.lights.empty())
+    cout << "Skipping " << description.lights.size() << " point lights, raw3_raytrace is lit by emissive spheres" << endl;
+  return {Camera::fromScene(description.camera), spheres, meshes};
+}
+
+/*!
+ * Render the world progressively in passes of options.passSamples up to the requested number of samples per pixel
+ * Tiles stop receiving samples once the noise of their pixels drops below options.threshold
+ * @param world World to render
+ * @param options Command line settings with resolution, samples, passes, depth, threads and output
+ */
+template<typename T, typename P>
+void renderProgressive(World<T, P> world, const RenderOptions &options) {
+  // Image to render to
+  Image image{options.width, options.height};
+  world.camera.right *= (double) image.width / image.height;
+
+  TileScheduler scheduler{options.threads, options.tileSize};
+  Accumulator accumulator{image.width, image.height, scheduler.getTileSize(), options.seed};
+  unsigned int passSamples = options.passSamples;
+  for (unsigned int samples = 0; samples < options.samples && accumulator.activeTiles() > 0; samples += passSamples) {
+    world.renderPass(accumulator, std::min(passSamples, options.samples - samples), options.depth, options.threshold, scheduler);
+
+    // Save the intermediate result
+    accumulator.resolve(image);
+    image::saveBMP(image, options.output);
+    cout << "Pass " << samples / passSamples + 1 << ": " << accumulator.activeTiles() << " tiles active, "
+         << (double) accumulator.samples() / (image.width * image.height) << " samples per pixel" << endl;
+  }
+  scheduler.printStatistics(cout);
+}
+
+/*!
+ * Render an animation sequence, assets are loaded once and the hierarchy is refitted for each frame
+ * Finished frames are written by a background thread while the next frame renders
+ * @param world World to render
+ * @param options Command line settings with the frame range, resolution, samples, passes, depth, threads and output
+ */
+template<typename T, typename P>
+void renderSequence(World<T, P> world, const RenderOptions &options) {
+  Image image{options.width, options.height};
+  world.camera.right *= (double) image.width / image.height;
+
+  TileScheduler scheduler{options.threads, options.tileSize};
+  ImageWriter writer;
+  unsigned int passSamples = options.passSamples;
+  auto begin = chrono::steady_clock::now();
+  for (unsigned int frame = options.firstFrame; frame < options.firstFrame + options.frames; ++frame) {
+    auto frameBegin = chrono::steady_clock::now();
+    world.setFrame(frame);
+    double refitTime = chrono::duration<double>(chrono::steady_clock::now() - frameBegin).count();
+
+    // Every frame uses the same seed, so a frame does not depend on where the sequence starts
+    Accumulator accumulator{image.width, image.height, scheduler.getTileSize(), options.seed};
+    for (unsigned int samples = 0; samples < options.samples && accumulator.activeTiles() > 0; samples += passSamples)
+      world.renderPass(accumulator, std::min(passSamples, options.samples - samples), options.depth, options.threshold, scheduler);
+    accumulator.resolve(image);
+    writer.save(image, options.frameOutput(frame));
+
+    cout << "Frame " << frame << ": refit " << refitTime * 1e3 << " ms, total "
+         << chrono::duration<double>(chrono::steady_clock::now() - frameBegin).count() << " s" << endl;
+  }
+  writer.finish();
+
+  cout << options.frames << " frames in " << chrono::duration<double>(chrono::steady_clock::now() - begin).count()
+       << " s, writing took " << writer.getWriteTime() << " s in the background of which rendering waited "
+       << writer.getWaitTime() << " s" << endl;
+  scheduler.printStatistics(cout);
+}
+
+/*!
+ * Render the built in scene or the scene file selected on the command line
+ * Paths are traced in double precision, primary rays are cast in packets of type P
+ * @param options Command line settings
+ */
+template<typename P>
+void render(const RenderOptions &options) {
+  auto begin = chrono::steady_clock::now();
+  World<double, P> world = !options.scene.empty() ? loadScene<double, P>(options.scene)
+                           : options.flag("--mesh") ? corsairBox<double, P>() : cornellBox<double, P>();
+  cout << "Scene with " << world.spheres.size() << " spheres and " << world.triangles.size() << " triangles loaded in "
+       << chrono::duration<double>(chrono::steady_clock::now() - begin).count() << " s" << endl;
+
+  cout << "This will take a while ..." << endl;
+  if (options.frames > 1 || options.firstFrame > 0)
+    renderSequence(move(world), options);
+  else
+    renderProgressive(move(world), options);
+}
+
+int main(int argc, char *argv[]) {
+  RenderOptions defaults;
+  defaults.samples = 32;
+  // Paths end by Russian roulette, the depth only caps the rare paths that stay bright for long
+  defaults.depth = 64;
+  defaults.threshold = 0.01;
+  defaults.output = "raw3_raytrace.bmp";
+  const vector<pair<string, string>> flags = {
+      {"--float", "Cast primary rays in single precision packets of eight"},
+      {"--mesh", "Render the built in scene with the corsair mesh"},
+      {"--benchmark", "Compare the hierarchy against brute force collision tests"},
+  };
+
+  RenderOptions options;
+  try {
+    options = parseOptions(argc, argv, defaults, {"--float", "--mesh", "--benchmark"});
+  } catch (const runtime_error &e) {
+    cerr << e.what() << endl;
+    printOptions(cerr, argv[0], defaults, flags);
+    return EXIT_FAILURE;
+  }
+  if (options.flag("--help")) {
+    printOptions(cout, argv[0], defaults, flags);
+    return EXIT_SUCCESS;
+  }
+
+  if (options.flag("--benchmark")) {
+    benchmark();
+    return EXIT_SUCCESS;
+  }
+
+  // Cast primary rays in single precision when requested
+  try {
+    if (options.flag("--float"))
+      render<float>(options);
+    else
+      render<double>(options);
+  } catch (const runtime_error &e) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
 
   cout << "Done." << endl;
   return EXIT_SUCCESS;
@@ -1,10 +1,31 @@
 // Example raw4_raster
 // - This example implements a very simple software rasterizer that mimics parts of the OpenGL pipeline with vertex and fragment shaders
-// - Some of the pipeline steps such as culling, clipping were skipped for simplicity and readability
-// - Triangle rendering is realized using horizontal triangle splitting and filling is implemented using linear interpolation
+// - Triangles are culled and clipped in clip space, back faces are skipped unless --no-cull is passed
+// - Triangles are rasterized with edge functions in 2x2 pixel quads and attributes are interpolated with perspective correct barycentrics
+// - Quads are shaded four fragments at a time with SIMD lanes, textures are sampled bilinearly from mip levels stored in tiles of 16 bit texels
+// - The rasterizer is a template over the shader program, each program declares the varyings it interpolates and --lit selects a program with per fragment lighting
+// - Meshes are drawn straight from the indexed arrays of the loaded obj mesh, each vertex is shaded once per draw in a parallel vertex stage
+// - Obj files are mapped into memory and parsed in parallel chunks whose vertices and faces are merged in file order
+// - Parsed meshes are cached in binary .mesh files next to the obj files, later runs map the cache and draw its streams in place
+// - Triangles are binned into screen tiles that threads rasterize straight into the tiles of the render target, run with --benchmark to measure triangle and fragment rates
+// - Depth and color live in a render target that is kept between frames and stored tile by tile, clears only mark the tiles and a resolve converts the color to the image
+// - Edges are antialiased with 4x or 8x multisampling selected by --spp, coverage and depth are tested per sample but each pixel is shaded once
+// - Blocks of each tile keep their depth range so occluded triangles and blocks are rejected early, --prepass resolves visibility before shading each pixel once
+// - Animation sequences are rendered with --frames, meshes and textures are loaded once and frames are written on a background thread
+// - Meshes, textures and the camera can be loaded from scene files, run with --help to list the options for resolution and output
 
 #include <iostream>
+#include <stdexcept>
+#include <chrono>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <atomic>
+#include <array>
+#include <cstddef>
+#include <type_traits>
 #include <ppgso/ppgso.h>
+#include <ppgso/tiny_obj_loader.h>
 #include <glm/gtx/euler_angles.hpp>
 
 using namespace std;
@@ -12,304 +33,1848 @@ using namespace glm;
 using namespace ppgso;
 
 /*!
- * Vertex structure to hold per vertex data in
+ * Vertex attributes of a mesh, the input of the vertex shader
+ * The rasterizer gathers them from the separate arrays of the mesh as each vertex is shaded
  */
 struct Vertex {
   vec4 position;
-  vec4 normal;
+  vec3 normal;
   vec2 texCoord;
-  vec4 color;
 };
 
 /*!
- * Vertex interpolation function that interpolates position, normal, texCoord and color vectors between two vertices
+ * Attributes of a varyings struct seen as an array of floats
+ *
+ * Each program declares its varyings, the output of its vertex shader. They start with the clip space position as
+ * vec4 followed by the attributes the fragment shader reads, floats or glm vectors of floats. The rasterizer clips
+ * and interpolates exactly these floats, so attributes a program does not declare cost nothing.
+ */
+template<typename V>
+struct VaryingLayout {
+  static_assert(is_standard_layout<V>::value && sizeof(V) % sizeof(float) == 0 && offsetof(V, position) == 0,
+                "Varyings have to start with the position and consist of floats");
+
+  // Number of floats following the position
+  static constexpr int COUNT = (int) (sizeof(V) / sizeof(float)) - 4;
+
+  static float *attributes(V &varyings) {
+    return reinterpret_cast<float *>(&varyings) + 4;
+  }
+
+  static const float *attributes(const V &varyings) {
+    return reinterpret_cast<const float *>(&varyings) + 4;
+  }
+
+  /*!
+   * Find an attribute among the floats following the position
+   * @param member Attribute of the varyings
+   * @return Index of the first float of the attribute
+   */
+  template<typename M>
+  static int offset(M V::*member) {
+    // Only addresses are taken, the storage is never read
+    static const typename aligned_storage<sizeof(V), alignof(V)>::type storage{};
+    auto &layout = reinterpret_cast<const V &>(storage);
+    return (int) (reinterpret_cast<const float *>(&(layout.*member)) - attributes(layout));
+  }
+};
+
+/*!
+ * Varyings interpolation function used by the clipper in clip space where all attributes are linear
  * @param v0 First vertex
  * @param v1 Second vertex
  * @param t Interpolation amount, range <0,1>
  * @return Linear combination of v0 and v1
  */
-Vertex lerp(const Vertex &v0, const Vertex &v1, float t) {
-  auto z = lerp(1.0f / v0.position.z, 1.0f / v1.position.z, t);
-  auto texCoord = lerp(v0.texCoord / v0.position.z, v1.texCoord / v1.position.z, t) / z;
-  return Vertex{
-      lerp(v0.position, v1.position, t),
-      lerp(v0.normal, v1.normal, t),
-      texCoord,
-      lerp(v0.color, v1.color, t)
-  };
+template<typename V>
+V lerp(const V &v0, const V &v1, float t) {
+  V result;
+  result.position = mix(v0.position, v1.position, t);
+  auto a0 = VaryingLayout<V>::attributes(v0), a1 = VaryingLayout<V>::attributes(v1);
+  auto attributes = VaryingLayout<V>::attributes(result);
+  for (int i = 0; i < VaryingLayout<V>::COUNT; ++i)
+    attributes[i] = a0[i] + t * (a1[i] - a0[i]);
+  return result;
 }
 
 /*!
- * Face structure to hold three vertices that form a triangle/face
+ * Varyings of the four fragments of a 2x2 pixel quad, every float of the varyings holds one lane per fragment
+ * Lanes are ordered top left, top right, bottom left, bottom right
  */
-struct Face {
-  Vertex v0, v1, v2;
+template<typename V>
+struct FragmentQuad {
+  // Lanes of an attribute, one vector per float of the attribute
+  template<typename M>
+  using Lanes = simd::float4[sizeof(M) / sizeof(float)];
+
+  // Pixel center, depth and interpolated w of the fragments
+  simd::float4 position[4];
+  simd::float4 attributes[std::max(VaryingLayout<V>::COUNT, 1)];
+  // Fragments covered by the triangle, bit i is set for lane i
+  int mask;
+  // Vertices of the triangle with attributes multiplied by the reciprocal w, and the change of their barycentric
+  // coordinates and of the reciprocal w for a step of one pixel to the right and down
+  const V *vertices;
+  float lx[3], ly[3], wx, wy;
+
+  /*!
+   * Interpolated attribute of the fragments
+   * @param member Attribute of the varyings
+   * @return Lanes of the attribute
+   */
+  template<typename M>
+  const Lanes<M> &get(M V::*member) const {
+    return reinterpret_cast<const Lanes<M> &>(attributes[VaryingLayout<V>::offset(member)]);
+  }
+
+  /*!
+   * Change of an attribute for a step of one pixel, computed only for the attributes a shader asks for and the same
+   * for every pixel no matter how it is grouped into quads
+   * @param member Attribute of the varyings, for example texture coordinates to select a mip level
+   * @param dx Output change for a step to the right
+   * @param dy Output change for a step down
+   */
+  template<typename M>
+  void derivatives(M V::*member, Lanes<M> &dx, Lanes<M> &dy) const {
+    int offset = VaryingLayout<V>::offset(member);
+    const float *a[3];
+    for (int k = 0; k < 3; ++k)
+      a[k] = VaryingLayout<V>::attributes(vertices[k]) + offset;
+    // Derivative of the quotient of the linear premultiplied attribute and the linear reciprocal w
+    for (size_t i = 0; i < sizeof(M) / sizeof(float); ++i) {
+      float tx = lx[0] * a[0][i] + lx[1] * a[1][i] + lx[2] * a[2][i];
+      float ty = ly[0] * a[0][i] + ly[1] * a[1][i] + ly[2] * a[2][i];
+      dx[i] = (simd::float4{tx} - attributes[offset + i] * wx) * position[3];
+      dy[i] = (simd::float4{ty} - attributes[offset + i] * wy) * position[3];
+    }
+  }
 };
 
-class Program {
+/*!
+ * Perspective correct interpolation of the attributes of the fragments of a quad
+ * @param v Vertices with attributes multiplied by the reciprocal of their w
+ * @param l Barycentric coordinates of the fragments in screen space
+ * @param w Interpolated w of the fragments, the reciprocal of the interpolated reciprocals
+ * @param quad Fragments to fill in, position is left for the caller
+ */
+template<typename V>
+void interpolate(const V (&v)[3], const simd::float4 (&l)[3], const simd::float4 &w, FragmentQuad<V> &quad) {
+  const float *a[3] = {VaryingLayout<V>::attributes(v[0]), VaryingLayout<V>::attributes(v[1]), VaryingLayout<V>::attributes(v[2])};
+  for (int i = 0; i < VaryingLayout<V>::COUNT; ++i)
+    quad.attributes[i] = (l[0] * a[0][i] + l[1] * a[1][i] + l[2] * a[2][i]) * w;
+}
+
+/*!
+ * Texture sampled by the fragment shader with bilinear filtering from precomputed mip levels
+ *
+ * Texels keep 16 bits per channel so averaged mip levels do not lose precision to rounding. Levels are stored in
+ * tiles of 4x4 texels, the four texels of a bilinear footprint mostly share a tile and neighbouring rows of texels
+ * are close in memory.
+ */
+class RasterTexture {
 public:
+  // Tiles are 1 << TILE_BITS texels wide and tall
+  static constexpr int TILE_BITS = 2;
+  static constexpr int TILE_SIZE = 1 << TILE_BITS;
+
+  /*!
+   * Red, green, blue and alpha channel, 8 bytes so the texel is loaded at once
+   */
+  struct Texel {
+    uint16_t channels[4];
+  };
+
+  /*!
+   * Single mip level with its texels stored tile by tile
+   */
+  struct Level {
+    int width, height, tilesX;
+    vector<Texel> texels;
+  };
+
+  /*!
+   * Create the mip levels of an image, each level averages 2x2 texels of the previous one down to a single texel
+   * @param image Image to sample
+   */
+  explicit RasterTexture(Image &image) {
+    // NOTE: The rows are vertically inverted for compatibility with object files generated using Blender 3D.
+    levels.push_back(createLevel(image.width, image.height));
+    for (int y = 0; y < image.height; ++y)
+      for (int x = 0; x < image.width; ++x) {
+        auto &pixel = image.getPixel(x, image.height - 1 - y);
+        texel(levels[0], x, y) = {{(uint16_t) (pixel.r * 257), (uint16_t) (pixel.g * 257), (uint16_t) (pixel.b * 257), 65535}};
+      }
+
+    while (levels.back().width > 1 || levels.back().height > 1) {
+      auto &previous = levels.back();
+      auto level = createLevel(std::max(previous.width / 2, 1), std::max(previous.height / 2, 1));
+      for (int y = 0; y < level.height; ++y)
+        for (int x = 0; x < level.width; ++x) {
+          // Last row or column of an odd sized level is averaged with itself
+          int x0 = 2 * x, x1 = std::min(2 * x + 1, previous.width - 1);
+          int y0 = 2 * y, y1 = std::min(2 * y + 1, previous.height - 1);
+          auto &result = texel(level, x, y);
+          for (int i = 0; i < 4; ++i) {
+            int sum = texel(previous, x0, y0).channels[i] + texel(previous, x1, y0).channels[i] +
+                      texel(previous, x0, y1).channels[i] + texel(previous, x1, y1).channels[i];
+            result.channels[i] = (uint16_t) ((sum + 2) / 4);
+          }
+        }
+      levels.push_back(move(level));
+    }
+  }
+
+  /*!
+   * Sample colors of the fragments of a quad from the level where a pixel covers about one texel
+   * @param texCoord Normalized texture coordinates of the fragments, clamped to the edges
+   * @param dx Change of the texture coordinates for a step of one pixel to the right
+   * @param dy Change of the texture coordinates for a step of one pixel down
+   * @param mask Fragments to sample, bit i is set for lane i
+   * @return Red, green, blue and alpha of the fragments in range <0,1>, lanes outside of mask are zero
+   */
+  array<simd::float4, 4> sample(const simd::float4 (&texCoord)[2], const simd::float4 (&dx)[2], const simd::float4 (&dy)[2], int mask) const {
+    // Squared size of the pixel footprint in texels of the first level
+    simd::float4 width = (float) levels[0].width, height = (float) levels[0].height;
+    simd::float4 dux = dx[0] * width, dvx = dx[1] * height, duy = dy[0] * width, dvy = dy[1] * height;
+    float footprint[4], u[4], v[4];
+    simd::max(dux * dux + dvx * dvx, duy * duy + dvy * dvy).store(footprint);
+    simd::min(simd::max(texCoord[0], 0.0f), 1.0f).store(u);
+    simd::min(simd::max(texCoord[1], 0.0f), 1.0f).store(v);
+
+    simd::float4 color[4];
+    int last = (int) levels.size() - 1;
+    for (int i = 0; i < 4; ++i) {
+      if (!(mask & (1 << i))) {
+        color[i] = 0.0f;
+        continue;
+      }
+      // Level log2(sqrt(footprint)) rounded to nearest, the exponent of 2 * footprint halved
+      int exponent = ilogb(2.0f * footprint[i]);
+      int level = exponent <= 0 ? 0 : std::min(exponent / 2, last);
+      color[i] = bilinear(levels[level], u[i], v[i]) * (1.0f / 65535.0f);
+    }
+    simd::transpose(color[0], color[1], color[2], color[3]);
+    return {{color[0], color[1], color[2], color[3]}};
+  }
+
+private:
+  vector<Level> levels;
+
   /*!
-   * Program constructor that expects texture reference
+   * Allocate a level padded to whole tiles
+   * @param width Width in texels
+   * @param height Height in texels
+   * @return Level with uninitialized texels
    */
-  Program(Image &texture) : texture{texture} {};
+  static Level createLevel(int width, int height) {
+    Level level{width, height, (width + TILE_SIZE - 1) >> TILE_BITS, {}};
+    int tilesY = (height + TILE_SIZE - 1) >> TILE_BITS;
+    level.texels.resize((size_t) (level.tilesX * tilesY) << (2 * TILE_BITS));
+    return level;
+  }
 
-  // Uniform inputs common for all vertices
-  Image &texture;
+  /*!
+   * Find a texel in the tiled layout
+   * @param level Level of the texel
+   * @param x Horizontal texel position
+   * @param y Vertical texel position
+   * @return Reference to the texel
+   */
+  template<typename L>
+  static auto texel(L &level, int x, int y) -> decltype(level.texels[0]) {
+    auto tile = (size_t) ((y >> TILE_BITS) * level.tilesX + (x >> TILE_BITS));
+    return level.texels[(tile << (2 * TILE_BITS)) + ((y & (TILE_SIZE - 1)) << TILE_BITS) + (x & (TILE_SIZE - 1))];
+  }
+
+  /*!
+   * Blend the four texels around a point
+   * @param level Level to sample
+   * @param u Horizontal texture coordinate in range <0,1>
+   * @param v Vertical texture coordinate in range <0,1>
+   * @return Channels of the blended texel in range <0,65535>
+   */
+  static simd::float4 bilinear(const Level &level, float u, float v) {
+    // Texel centers are at half integer coordinates
+    float x = u * level.width - .5f, y = v * level.height - .5f;
+    float fx = std::floor(x), fy = std::floor(y);
+    float tx = x - fx, ty = y - fy;
+    int x0 = std::max((int) fx, 0), x1 = std::min((int) fx + 1, level.width - 1);
+    int y0 = std::max((int) fy, 0), y1 = std::min((int) fy + 1, level.height - 1);
+
+    simd::float4 t00 = simd::float4::load(texel(level, x0, y0).channels), t10 = simd::float4::load(texel(level, x1, y0).channels);
+    simd::float4 t01 = simd::float4::load(texel(level, x0, y1).channels), t11 = simd::float4::load(texel(level, x1, y1).channels);
+    simd::float4 top = t00 + (t10 - t00) * tx, bottom = t01 + (t11 - t01) * tx;
+    return top + (bottom - top) * ty;
+  }
+};
+
+/*!
+ * Uniform inputs common for all vertices of the programs in this example, they can change between meshes
+ */
+struct Uniforms {
+  const RasterTexture *texture = nullptr;
   mat4 modelMatrix;
   mat4 viewMatrix;
   mat4 projectionMatrix;
 
   /*!
-   * Vertex shader is a program that can manipulate vertex data, typically changing the vertex position using a perspective projection matrix.
-   * @param vertex Vertex to manipulate.
-   * @return Output vertex, position on screen is expected to be in the <-1,1> range for x and y coordinates.
+   * Transform a position of a mesh to clip space using a perspective projection matrix
+   * @param position Position in model coordinates
+   * @return Position on screen, expected to be in the <-1,1> range for x and y coordinates
    */
-  Vertex vertexShader(const Vertex &vertex) {
+  vec4 project(const vec4 &position) const {
     // Transform the vertex position to world coordinates
-    vec4 worldCoordinates = modelMatrix * vertex.position;
+    vec4 worldCoordinates = modelMatrix * position;
     // Transform the position to camera coordinates
     vec4 cameraCoordinates = viewMatrix * worldCoordinates;
     // Project the camera coordinates to screen coordinates
-    vec4 screenCoordinates = projectionMatrix * cameraCoordinates;
-    // Multiply normal with modelMatrix so that normals are always in world coordinates.
-    // Pass on color and texture coordinates unchanged.
-    return Vertex{screenCoordinates, modelMatrix * vertex.normal, vertex.texCoord, vertex.color};
+    return projectionMatrix * cameraCoordinates;
+  }
+};
+
+/*!
+ * Program that only applies the texture, its fragments interpolate nothing but the texture coordinates
+ */
+class TextureProgram : public Uniforms {
+public:
+  /*!
+   * Output of the vertex shader interpolated for each fragment
+   */
+  struct Varyings {
+    vec4 position;
+    vec2 texCoord;
   };
 
+  /*!
+   * Vertex shader is a program that can manipulate vertex data, typically changing the vertex position using a perspective projection matrix.
+   * @param vertex Vertex to manipulate.
+   * @return Output varyings, position on screen is expected to be in the <-1,1> range for x and y coordinates.
+   */
+  Varyings vertexShader(const Vertex &vertex) const {
+    return {project(vertex.position), vertex.texCoord};
+  }
+
   /*!
    * Fragment shader is a program that is responsible for generating the final output color for each fragment, in this case we have 1 fragment per pixel.
-   * @param varying Varying vertex data that is interpolated from the triangle vertices
-   * @return Fragment color
-   */
-  vec4 fragmentShader(const Vertex &varying) {
-    // Simple directional light
-    float lighting = 1; //std::max(0.0f, (float) dot(varying.normal, vec4{.5f, .5f, .5f, 0.0f}));
-    // Compute output color
-    return varying.color * lighting * sample(texture, varying.texCoord);
+   * Fragments are shaded four at a time in 2x2 pixel quads, one SIMD lane per fragment.
+   * @param varying Varyings of the quad that are interpolated from the triangle vertices
+   * @return Red, green, blue and alpha of the fragments
+   */
+  array<simd::float4, 4> fragmentShader(const FragmentQuad<Varyings> &varying) const {
+    FragmentQuad<Varyings>::Lanes<vec2> dx, dy;
+    varying.derivatives(&Varyings::texCoord, dx, dy);
+    return texture->sample(varying.get(&Varyings::texCoord), dx, dy, varying.mask);
+  }
+};
+
+/*!
+ * Program that lights the texture by a directional light with normals interpolated per fragment
+ */
+class LitProgram : public Uniforms {
+public:
+  // Direction towards the light in world coordinates and the share of light that reaches surfaces facing away
+  vec3 lightDirection = normalize(vec3{1, 1, 1});
+  float ambient = .3f;
+
+  /*!
+   * Output of the vertex shader interpolated for each fragment
+   */
+  struct Varyings {
+    vec4 position;
+    vec3 normal;
+    vec2 texCoord;
   };
+
+  /*!
+   * Project the vertex and transform its normal to world coordinates
+   * @param vertex Vertex to manipulate.
+   * @return Output varyings, position on screen is expected to be in the <-1,1> range for x and y coordinates.
+   */
+  Varyings vertexShader(const Vertex &vertex) const {
+    return {project(vertex.position), mat3{modelMatrix} * vertex.normal, vertex.texCoord};
+  }
+
+  /*!
+   * Diffuse lighting of the textured surface, interpolated normals are normalized again for each fragment
+   * @param varying Varyings of the quad that are interpolated from the triangle vertices
+   * @return Red, green, blue and alpha of the fragments
+   */
+  array<simd::float4, 4> fragmentShader(const FragmentQuad<Varyings> &varying) const {
+    auto &normal = varying.get(&Varyings::normal);
+    simd::float4 length = simd::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+    simd::float4 cosine = (normal[0] * lightDirection.x + normal[1] * lightDirection.y + normal[2] * lightDirection.z) /
+                          simd::max(length, 1e-6f);
+    simd::float4 lighting = simd::float4{ambient} + simd::max(cosine, 0.0f) * (1.0f - ambient);
+
+    FragmentQuad<Varyings>::Lanes<vec2> dx, dy;
+    varying.derivatives(&Varyings::texCoord, dx, dy);
+    auto color = texture->sample(varying.get(&Varyings::texCoord), dx, dy, varying.mask);
+    for (int i = 0; i < 3; ++i)
+      color[i] = color[i] * lighting;
+    return color;
+  }
+};
+
+/*!
+ * Depth and color buffers that persist between frames, stored tile by tile so the thread rasterizing a tile works
+ * on contiguous memory that no other thread touches
+ *
+ * Depth is a 32 bit float and color is RGBA with 8 bits per channel packed into 32 bits, red in the lowest byte.
+ * Multisampled targets store the samples of each pixel next to each other. Every tile starts on a cache line. Clearing only marks the tiles, a marked tile is filled with the clear values
+ * when it is first drawn to and tiles that are never drawn to are resolved straight from the clear color.
+ */
+class RenderTarget {
+public:
+  // Values in a cache line, tiles start on cache lines
+  static constexpr int LINE = 16;
+
+  int width, height;
+
+  /*!
+   * Allocate the buffers, all tiles start cleared to black and the farthest depth
+   * @param width Width in pixels
+   * @param height Height in pixels
+   * @param tileSize Size of the tiles of the TileScheduler that renders into the target
+   * @param samples Depth and color samples per pixel, a power of two
+   */
+  RenderTarget(int width, int height, int tileSize, int samples = 1) : width{width}, height{height}, tileSize{tileSize}, samples{samples} {
+    if (samples < 1 || (samples & (samples - 1)))
+      throw runtime_error("Render target needs a power of two samples per pixel, not " + to_string(samples));
+    while ((1 << sampleShift) < samples) sampleShift++;
+    tilesX = (width + tileSize - 1) / tileSize;
+    int tilesY = (height + tileSize - 1) / tileSize;
+    tileStride = (size_t) ((tileSize * tileSize * samples + LINE - 1) / LINE * LINE);
+    // Storage has room to move the start to the next cache line
+    auto size = tileStride * tilesX * tilesY + LINE;
+    depthStorage.resize(size);
+    colorStorage.resize(size);
+    depth = alignToLine(depthStorage.data());
+    color = alignToLine(colorStorage.data());
+    cleared.resize((size_t) (tilesX * tilesY));
+    clear({0, 0, 0});
+  }
+
+  RenderTarget(const RenderTarget &) = delete;
+  RenderTarget &operator=(const RenderTarget &) = delete;
+
+  /*!
+   * Pack a color into the RGBA format of the target
+   * @param r Red channel <0, 255>
+   * @param g Green channel <0, 255>
+   * @param b Blue channel <0, 255>
+   * @return Opaque color
+   */
+  static uint32_t pack(uint8_t r, uint8_t g, uint8_t b) {
+    return r | (uint32_t) g << 8 | (uint32_t) b << 16 | 0xFF000000u;
+  }
+
+  /*!
+   * Clear all tiles, the tiles are only marked and filled once they are drawn to
+   * @param color Clear color
+   * @param depth Clear depth
+   */
+  void clear(const Image::Pixel &color, float depth = numeric_limits<float>::max()) {
+    clearColor = pack(color.r, color.g, color.b);
+    clearDepth = depth;
+    fill(cleared.begin(), cleared.end(), 1);
+  }
+
+  /*!
+   * Depth that cleared pixels have
+   */
+  float getClearDepth() const {
+    return clearDepth;
+  }
+
+  /*!
+   * Size of the tiles the target is stored in
+   */
+  int getTileSize() const {
+    return tileSize;
+  }
+
+  /*!
+   * Number of samples per pixel
+   */
+  int getSamples() const {
+    return samples;
+  }
+
+  /*!
+   * Get the buffers of a tile to draw to, a cleared tile is filled with the clear values first
+   * @param tile Tile of the scheduler
+   * @param tileDepth Output depth of the tile, rows are tile.width pixels apart
+   * @param tileColor Output color of the tile, rows are tile.width pixels apart
+   * @return true if the tile was cleared since it was last drawn to so all of its pixels have the clear values
+   */
+  bool getTile(const Tile &tile, float *&tileDepth, uint32_t *&tileColor) {
+    auto index = tileIndex(tile);
+    tileDepth = depth + index * tileStride;
+    tileColor = color + index * tileStride;
+    if (!cleared[index]) return false;
+
+    auto count = (size_t) (tile.width * tile.height * samples);
+    simd::fill(tileDepth, count, clearDepth);
+    simd::fill(tileColor, count, clearColor);
+    cleared[index] = 0;
+    return true;
+  }
+
+  /*!
+   * Convert the color of all tiles into an image in parallel, samples of a pixel are averaged
+   * @param image Image of the same size as the target
+   * @param scheduler Scheduler with the tile size of the target
+   */
+  void resolve(Image &image, TileScheduler &scheduler) {
+    auto &framebuffer = image.getFramebuffer();
+    scheduler.run(width, height, [&](const Tile &tile, unsigned int) {
+      auto index = tileIndex(tile);
+      auto first = framebuffer.begin() + tile.x + tile.y * width;
+      if (cleared[index]) {
+        // Rows of 3 byte pixels are copied faster than filled
+        fill_n(first, tile.width, unpack(clearColor));
+        for (int y = 1; y < tile.height; ++y)
+          copy_n(first, tile.width, first + y * width);
+        return;
+      }
+      for (int y = 0; y < tile.height; ++y) {
+        auto row = first + y * width;
+        auto source = color + index * tileStride + (size_t) (y * tile.width * samples);
+        if (samples == 1) {
+          for (int x = 0; x < tile.width; ++x)
+            row[x] = unpack(source[x]);
+          continue;
+        }
+        for (int x = 0; x < tile.width; ++x, source += samples) {
+          uint32_t r = 0, g = 0, b = 0;
+          for (int i = 0; i < samples; ++i) {
+            r += source[i] & 0xFF;
+            g += source[i] >> 8 & 0xFF;
+            b += source[i] >> 16 & 0xFF;
+          }
+          row[x] = {(uint8_t) ((r + samples / 2) >> sampleShift), (uint8_t) ((g + samples / 2) >> sampleShift),
+                    (uint8_t) ((b + samples / 2) >> sampleShift)};
+        }
+      }
+    });
+  }
+
 private:
+  int tileSize, samples, tilesX;
+  // Samples per pixel are a power of two so their average is a shift
+  int sampleShift = 0;
+  size_t tileStride;
+  vector<float> depthStorage;
+  vector<uint32_t> colorStorage;
+  float *depth;
+  uint32_t *color;
+  // Tiles that were cleared and not drawn to since
+  vector<uint8_t> cleared;
+  uint32_t clearColor;
+  float clearDepth;
+
+  /*!
+   * Move a pointer forward to the start of the next cache line
+   */
+  template<typename T>
+  static T *alignToLine(T *data) {
+    auto address = reinterpret_cast<uintptr_t>(data), line = (uintptr_t) (LINE * sizeof(T));
+    return reinterpret_cast<T *>((address + line - 1) / line * line);
+  }
+
   /*!
-   * Get a color sample from image for given normalized texture coordinates
-   * @param image Image to obtain raw color information from.
-   * @param textCoord Normalized 2D coordinates to get color sample from.
-   * @return
-   */
-  vec4 sample(Image &image, vec2 textCoord) {
-    // Get the appropriate pixel for given texture coordinates.
-    textCoord = clamp(textCoord, 0.0f, 1.0f);
-    auto x = (int) (textCoord.x * (image.width - 1));
-    auto y = (int) (textCoord.y * (image.height - 1));
-    // NOTE: The coordinates are vertically inverted for compatibility with object files generated using Blender 3D.
-    auto pixel = image.getPixel(x, image.height-y);
-    // Return normalized color vector
-    return vec4{pixel.r / 255.0f, pixel.g / 255.0f, pixel.b / 255.0f, 1.0};
+   * Position of a tile in the buffers
+   */
+  size_t tileIndex(const Tile &tile) const {
+    return (size_t) (tile.x / tileSize + tile.y / tileSize * tilesX);
+  }
+
+  /*!
+   * Convert a packed color to a pixel of the image
+   */
+  static Image::Pixel unpack(uint32_t value) {
+    return {(uint8_t) value, (uint8_t) (value >> 8), (uint8_t) (value >> 16)};
   }
 };
 
 /*!
- * Simple rasterizer class that can render triangles into an image
+ * Constants, statistics and settings of the rasterizer that do not depend on the program
  */
-class Rasterizer {
+class RasterizerBase {
+public:
+  // Fractional bits of the fixed point screen coordinates
+  static constexpr int SUBPIXEL_BITS = 8;
+  static constexpr int64_t SUBPIXEL_ONE = 1 << SUBPIXEL_BITS;
+  // Width and height of the blocks tested against the triangle edges before walking their pixels, must be even
+  static constexpr int BLOCK_SIZE = 8;
+  // Number of vertices or triangles processed as a single unit of work in the vertex and setup stages
+  static constexpr int CHUNK_SIZE = 256;
+  // Distance in pixels the guard band extends beyond each side of the image
+  static constexpr float GUARD_BAND = 1 << 14;
+  // Clipping a triangle against six planes adds at most one vertex per plane
+  static constexpr int MAX_CLIPPED = 9;
+  // Margin of the hierarchical depth test, covers rounding differences to the depth of single fragments
+  static constexpr float DEPTH_EPSILON = 1e-5f;
+  // Marks pixels not covered by any triangle in the depth prepass
+  static constexpr uint32_t NO_TRIANGLE = numeric_limits<uint32_t>::max();
+  // Largest supported number of samples per pixel
+  static constexpr int MAX_SAMPLES = 8;
+
+  /*!
+   * Planes of the view frustum a clip space vertex lies outside of, one bit per plane
+   */
+  enum Outcode : uint8_t {
+    OUTSIDE_NEAR = 1, OUTSIDE_FAR = 2, OUTSIDE_LEFT = 4, OUTSIDE_RIGHT = 8, OUTSIDE_BOTTOM = 16, OUTSIDE_TOP = 32,
+    OUTSIDE_FRUSTUM = 63,
+    // Left, right, bottom or top of the guard band
+    OUTSIDE_GUARD_BAND = 64
+  };
+
+  /*!
+   * How much of a rectangle of pixels a triangle covers
+   */
+  enum class Coverage { None, Partial, Full };
+
+  /*!
+   * Work done since the statistics were last reset
+   */
+  struct Statistics {
+    uint64_t vertices = 0, triangles = 0, fragments = 0;
+    // Triangles rejected as a whole, split by the clipper and passed on to rasterization
+    uint64_t outside = 0, backfacing = 0, clipped = 0, rasterized = 0;
+    // Triangles in a tile and blocks rejected by the hierarchical depth test
+    uint64_t occludedTriangles = 0, occludedBlocks = 0;
+  };
+
+  /*!
+   * Optional pipeline stages
+   */
+  struct Settings {
+    // Skip triangles facing away from the camera, front faces are counter clockwise as with glFrontFace(GL_CCW)
+    bool cullBackFaces = true;
+    // Reject triangles and blocks behind the minimum and maximum depth kept for blocks of each tile
+    bool hierarchicalDepth = true;
+    // Resolve visibility of a tile before shading so each pixel is shaded once
+    bool depthPrepass = false;
+  };
+};
+
+/*!
+ * Rasterizer that renders indexed triangles into an image using edge functions
+ *
+ * Rendering is split into stages that each run in parallel on the TileScheduler threads:
+ * - draw shades every vertex once into a post-transform buffer, so vertices shared by several triangles are only
+ *   transformed once, and assembles the triangles from the indices
+ * - Triangles outside of the view frustum and back facing triangles are culled in clip space. Triangles crossing
+ *   the near or far plane or reaching beyond the guard band are clipped, the guard band is large enough that
+ *   triangles only partially on screen rarely need clipping and small enough to keep the fixed point edge functions
+ *   from overflowing
+ * - Triangles are sorted into bins of the screen tiles they overlap, each thread bins chunks of triangles into its
+ *   own bins and the bins of a tile are merged back into submission order when the tile is rasterized
+ * - finish rasterizes the tiles, each thread renders straight into a tile of the RenderTarget, tiles are stored
+ *   contiguously so no locks are needed and no two threads write the same cache lines
+ *
+ * Within a tile the bounding box of each triangle is split into blocks, blocks outside of the triangle are skipped
+ * and the rest is walked in 2x2 pixel quads with the edge functions updated incrementally. The pixels of a quad that
+ * pass the depth test are shaded together, one SIMD lane per pixel.
+ *
+ * Each tile keeps the minimum and maximum depth of its blocks. Triangles behind everything drawn in a tile or block
+ * are rejected without testing their pixels and blocks entirely in front skip the per pixel depth test. With the
+ * depth prepass, tiles are rasterized twice, first writing only depth and the triangle covering each pixel and
+ * then shading the covering triangle, so the fragment shader runs at most once per pixel.
+ *
+ * The rasterizer is specialized for a program P that declares its Varyings, a const vertexShader turning a Vertex
+ * into Varyings and a const fragmentShader turning a FragmentQuad of the Varyings into four colors. Shaders are
+ * called directly so they inline into the pipeline, and only the attributes the program declares are stored,
+ * clipped and interpolated. The uniforms of the program are copied by each draw call.
+ */
+template<typename P>
+class Rasterizer : public RasterizerBase {
+public:
+  using Varyings = typename P::Varyings;
+
+  Settings settings;
+
 private:
-  Program &program;
-  Image &image;
-  vector<float> depthBuffer;
+  /*!
+   * Triangle prepared for rasterization
+   * Each edge function E(x, y) = a * x + b * y + c is positive inside the triangle, it is evaluated in fixed point
+   * with SUBPIXEL_BITS fractional bits so adjacent triangles never overlap or leave gaps along shared edges
+   */
+  struct Triangle {
+    // Edge functions, edge i is opposite to vertex i so E_i / area is the barycentric coordinate of vertex i
+    int64_t a[3], b[3], c[3];
+    // Pixel bounds clamped to the image
+    int minX, minY, maxX, maxY;
+    float invArea;
+    // Depth z = z2 + e0 * depth[0] + e1 * depth[1] from the edge functions, its change per pixel and its range
+    float z2, depth[2], depthStepX, depthStepY, zMin, zMax;
+    // Draw call the triangle belongs to, it selects the program state used to shade it
+    uint32_t draw;
+    // Vertices with position in viewport coordinates and attributes multiplied by the reciprocal w
+    Varyings vertices[3];
+  };
+
+  /*!
+   * Depth and color of a single tile, owned by one thread while the tile is rasterized
+   */
+  struct TileBuffer {
+    // Buffers of the tile in the render target
+    float *depth;
+    uint32_t *color;
+    // Triangles of the tile gathered from the bins of all threads, in submission order
+    vector<uint32_t> bin;
+    // Triangle covering each sample in the depth prepass
+    vector<uint32_t> visible;
+    // Depth range of the blocks and the farthest depth in the tile
+    vector<float> blockMin, blockMax;
+    // Blocks written since their depth range was computed, their range still encloses the depth buffer
+    vector<uint8_t> blockStale;
+    float tileMax;
+    int blocksX;
+  };
+
+  P &program;
+  RenderTarget &target;
+  TileScheduler &scheduler;
+  // Program state captured by each draw call since the last finish
+  vector<P> draws;
+  // Post-transform buffer of the current draw call, vertices in clip space, projected to the viewport and their outcodes
+  vector<Varyings> transformed, projected;
+  vector<uint8_t> outcodes;
+  vector<Triangle> triangles;
+  vector<uint8_t> accepted;
+  // Additional triangles made by the clipper and work done for each chunk of the setup stage
+  vector<vector<Triangle>> clippedTriangles;
+  vector<Statistics> chunkStatistics;
+  // Extent of the guard band in normalized device coordinates
+  vec2 guardBand;
+  // Triangles overlapping each tile, every thread bins into its own set so binning needs no locks
+  vector<vector<vector<uint32_t>>> bins;
+  vector<TileBuffer> tileBuffers;
+  int tilesX, tilesY;
+  // Samples per pixel, their positions relative to the pixel center and their largest distance from it in subpixels
+  int samples;
+  ivec2 sampleOffsets[MAX_SAMPLES];
+  int sampleRadius;
+  Statistics statistics;
+  atomic<uint64_t> fragments{0}, occludedTriangles{0}, occludedBlocks{0};
 
   /*!
    * Transform a vertex from screen coordinates to viewport/image coordinates
    * @param vertex Vertex to transform to viewport. The visible range is <-1,1> for x and y coordinates
-   * @return Vertex that has position transformed to viewport/image coordinates
+   * @return Vertex that has position transformed to viewport/image coordinates and w replaced by its reciprocal,
+   * the other attributes are multiplied by the reciprocal so they can be interpolated linearly in screen space.
+   * Vertices behind the camera can not be projected and are marked by a negative w, triangles using them are clipped.
+   */
+  Varyings toViewport(const Varyings &vertex) {
+    Varyings result{};
+    if (vertex.position.w <= 0) {
+      result.position = {0, 0, 0, -1};
+      return result;
+    }
+    float invW = 1.0f / vertex.position.w;
+    result.position = {(vertex.position.x * invW + 1.0f) * target.width / 2.0f,
+                       (1.0f - vertex.position.y * invW) * target.height / 2.0f,
+                       vertex.position.z * invW, invW};
+    auto input = VaryingLayout<Varyings>::attributes(vertex);
+    auto output = VaryingLayout<Varyings>::attributes(result);
+    for (int i = 0; i < VaryingLayout<Varyings>::COUNT; ++i)
+      output[i] = input[i] * invW;
+    return result;
+  }
+
+  /*!
+   * Compute the edge functions of a triangle from transformed vertices
+   * @param v0 First vertex in viewport coordinates
+   * @param v1 Second vertex in viewport coordinates
+   * @param v2 Third vertex in viewport coordinates
+   * @param triangle Output triangle
+   * @return false if the triangle covers no pixels and can be skipped
+   */
+  bool setup(const Varyings &v0, const Varyings &v1, const Varyings &v2, Triangle &triangle) {
+    triangle.vertices[0] = v0;
+    triangle.vertices[1] = v1;
+    triangle.vertices[2] = v2;
+
+    int64_t x[3], y[3];
+    for (int i = 0; i < 3; ++i) {
+      // Vertices are inside of the guard band so the edge functions can not overflow
+      auto &position = triangle.vertices[i].position;
+      if (position.w <= 0) return false;
+      x[i] = llround(position.x * SUBPIXEL_ONE);
+      y[i] = llround(position.y * SUBPIXEL_ONE);
+    }
+
+    // Twice the signed area, vertices are reordered to a positive area (clockwise with y pointing down) so inside
+    // points have positive edges
+    int64_t area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+    if (area == 0) return false;
+    if (area < 0) {
+      swap(x[1], x[2]);
+      swap(y[1], y[2]);
+      swap(triangle.vertices[1], triangle.vertices[2]);
+      area = -area;
+    }
+
+    for (int i = 0; i < 3; ++i) {
+      int j = (i + 1) % 3, k = (i + 2) % 3;
+      triangle.a[i] = y[j] - y[k];
+      triangle.b[i] = x[k] - x[j];
+      triangle.c[i] = -triangle.a[i] * x[j] - triangle.b[i] * y[j];
+      // Top-left fill rule with y pointing down, inside is to the right of left edges (a > 0) and below top edges
+      // (a == 0, b > 0), pixels exactly on right and bottom edges belong to the neighbouring triangle
+      bool topLeft = triangle.a[i] > 0 || (triangle.a[i] == 0 && triangle.b[i] > 0);
+      if (!topLeft) triangle.c[i] -= 1;
+    }
+    triangle.invArea = 1.0f / (float) area;
+
+    // Depth is linear in the edge functions of the snapped triangle
+    auto &v = triangle.vertices;
+    triangle.z2 = v[2].position.z;
+    triangle.depth[0] = (v[0].position.z - v[2].position.z) * triangle.invArea;
+    triangle.depth[1] = (v[1].position.z - v[2].position.z) * triangle.invArea;
+    triangle.depthStepX = (float) ((triangle.a[0] * triangle.depth[0] + triangle.a[1] * triangle.depth[1]) * SUBPIXEL_ONE);
+    triangle.depthStepY = (float) ((triangle.b[0] * triangle.depth[0] + triangle.b[1] * triangle.depth[1]) * SUBPIXEL_ONE);
+    triangle.zMin = std::min({v[0].position.z, v[1].position.z, v[2].position.z});
+    triangle.zMax = std::max({v[0].position.z, v[1].position.z, v[2].position.z});
+
+    // Bounds of the pixels with samples covered by the triangle
+    auto toPixel = [](int64_t value) { return (int) ((value - SUBPIXEL_ONE / 2) >> SUBPIXEL_BITS); };
+    triangle.minX = std::max(toPixel(std::min({x[0], x[1], x[2]}) - sampleRadius + SUBPIXEL_ONE - 1), 0);
+    triangle.minY = std::max(toPixel(std::min({y[0], y[1], y[2]}) - sampleRadius + SUBPIXEL_ONE - 1), 0);
+    triangle.maxX = std::min(toPixel(std::max({x[0], x[1], x[2]}) + sampleRadius), target.width - 1);
+    triangle.maxY = std::min(toPixel(std::max({y[0], y[1], y[2]}) + sampleRadius), target.height - 1);
+    return triangle.minX <= triangle.maxX && triangle.minY <= triangle.maxY;
+  }
+
+  /*!
+   * Find the frustum and guard band planes a clip space position lies outside of
+   * @param position Vertex position in clip space
+   * @return Outcode bits of the planes
+   */
+  uint8_t outcode(const vec4 &position) const {
+    uint8_t code = 0;
+    if (position.z < -position.w) code |= OUTSIDE_NEAR;
+    if (position.z > position.w) code |= OUTSIDE_FAR;
+    if (position.x < -position.w) code |= OUTSIDE_LEFT;
+    if (position.x > position.w) code |= OUTSIDE_RIGHT;
+    if (position.y < -position.w) code |= OUTSIDE_BOTTOM;
+    if (position.y > position.w) code |= OUTSIDE_TOP;
+    if (std::abs(position.x) > guardBand.x * position.w || std::abs(position.y) > guardBand.y * position.w)
+      code |= OUTSIDE_GUARD_BAND;
+    return code;
+  }
+
+  /*!
+   * Clip a convex polygon in clip space against the near and far planes and the guard band (Sutherland-Hodgman)
+   * Attributes are linear in clip space so they are interpolated before the perspective division
+   * @param polygon Vertices of the polygon, replaced by the clipped polygon
+   * @param count Number of vertices of the polygon
+   * @return Number of vertices of the clipped polygon, less than three if nothing is left
    */
-  Vertex toViewport(const Vertex &vertex) {
-    // Matrix that aligns the screen coordinates to viewport coordinates
-    static const mat4 viewportMatrix = glm::translate(glm::scale(mat4{1.0f}, vec3{image.width / 2.0, -image.height / 2.0, 1.0}), vec3{1, -1, 0});
-    // First convert homogeneous coordinates to cartesian and transform to viewport
-    vec4 viewportCoordinates = viewportMatrix * (vertex.position / vertex.position.w);
-    // Copy rest of the data without change
-    return Vertex{viewportCoordinates, vertex.normal, vertex.texCoord, vertex.color};
+  int clip(Varyings (&polygon)[MAX_CLIPPED], int count) const {
+    // A point is inside when the dot product with the plane is positive
+    const vec4 planes[] = {
+        {0, 0, 1, 1}, {0, 0, -1, 1},
+        {1, 0, 0, guardBand.x}, {-1, 0, 0, guardBand.x}, {0, 1, 0, guardBand.y}, {0, -1, 0, guardBand.y}
+    };
+
+    Varyings input[MAX_CLIPPED];
+    for (auto &plane : planes) {
+      copy_n(polygon, count, input);
+      int inputCount = count;
+      count = 0;
+      for (int i = 0; i < inputCount; ++i) {
+        auto &current = input[i], &next = input[(i + 1) % inputCount];
+        float d0 = dot(plane, current.position), d1 = dot(plane, next.position);
+        if (d0 >= 0) polygon[count++] = current;
+        // Edges crossing the plane add the intersection
+        if ((d0 >= 0) != (d1 >= 0)) polygon[count++] = lerp(current, next, d0 / (d0 - d1));
+      }
+      if (count < 3) return 0;
+    }
+    return count;
   }
 
   /*!
-   * Set the pixel in the output using the varying data stored in Vertex
-   * @param x Fragment horizontal position
-   * @param y Fragment vertical position
-   * @param varying Varying vertex data to pass to fragment shader which will generate the pixel color
+   * Cull, clip and set up a triangle of the current draw call
+   * @param i0 Index of the first vertex in the post-transform buffer
+   * @param i1 Index of the second vertex
+   * @param i2 Index of the third vertex
+   * @param triangle Output triangle
+   * @param extra Additional triangles when the clipped polygon has more than three vertices
+   * @param stats Counters of culled and clipped triangles
+   * @return false if nothing of the triangle is left to rasterize
    */
-  void setFragment(const Vertex &varying) {
-    int x = (int) varying.position.x;
-    int y = (int) varying.position.y;
-    // Do not render pixels outside of the image
-    if (x < 0 || y < 0 || x >= image.width || y >= image.height)
-      return;
+  bool assemble(uint32_t i0, uint32_t i1, uint32_t i2, Triangle &triangle, vector<Triangle> &extra, Statistics &stats) {
+    uint8_t c0 = outcodes[i0], c1 = outcodes[i1], c2 = outcodes[i2];
+    // All vertices outside of the same frustum plane
+    if (c0 & c1 & c2 & OUTSIDE_FRUSTUM) {
+      stats.outside++;
+      return false;
+    }
+
+    // Orientation from the determinant of the homogeneous x, y, w coordinates, valid even for vertices behind the camera
+    auto &p0 = transformed[i0].position, &p1 = transformed[i1].position, &p2 = transformed[i2].position;
+    float orientation = dot(vec3{p0.x, p0.y, p0.w}, cross(vec3{p1.x, p1.y, p1.w}, vec3{p2.x, p2.y, p2.w}));
+    if (settings.cullBackFaces && orientation <= 0) {
+      stats.backfacing++;
+      return false;
+    }
+
+    // Most triangles are inside of the guard band and use the projected vertices
+    if (!((c0 | c1 | c2) & (OUTSIDE_NEAR | OUTSIDE_FAR | OUTSIDE_GUARD_BAND)))
+      return setup(projected[i0], projected[i1], projected[i2], triangle);
+
+    stats.clipped++;
+    Varyings polygon[MAX_CLIPPED] = {transformed[i0], transformed[i1], transformed[i2]};
+    int count = clip(polygon, 3);
+    for (int i = 0; i < count; ++i)
+      polygon[i] = toViewport(polygon[i]);
+
+    // Split the polygon into a triangle fan
+    bool any = false;
+    Triangle piece;
+    piece.draw = triangle.draw;
+    for (int i = 1; i + 1 < count; ++i) {
+      if (!setup(polygon[0], polygon[i], polygon[i + 1], any ? piece : triangle)) continue;
+      if (any) extra.push_back(piece);
+      any = true;
+    }
+    return any;
+  }
+
+  /*!
+   * Compute the colors of the covered pixels of a 2x2 quad, each pixel is shaded once at its center and the color
+   * is stored to its covered samples
+   * Lanes outside of the mask are still interpolated from the triangle plane but their colors are not stored
+   * @param triangle Triangle covering the pixels
+   * @param x Left pixel of the quad
+   * @param y Top pixel of the quad
+   * @param quad Edge functions at the centers of the four pixels
+   * @param mask Pixels to shade, bit i is set for lane i
+   * @param sampleMasks Samples of each pixel to store the color to
+   * @param tile Tile the quad belongs to
+   * @param buffer Color of the tile
+   */
+  void shade(const Triangle &triangle, int x, int y, const int64_t (&quad)[4][3], int mask, const int (&sampleMasks)[4],
+             const Tile &tile, TileBuffer &buffer) {
+    auto &v = triangle.vertices;
+    float e0[4], e1[4];
+    for (int q = 0; q < 4; ++q) {
+      e0[q] = (float) quad[q][0];
+      e1[q] = (float) quad[q][1];
+    }
+    simd::float4 l[3];
+    l[0] = simd::float4::load(e0) * triangle.invArea;
+    l[1] = simd::float4::load(e1) * triangle.invArea;
+    l[2] = simd::float4{1.0f} - l[0] - l[1];
+    simd::float4 z = l[0] * v[0].position.z + l[1] * v[1].position.z + l[2] * v[2].position.z;
+    simd::float4 w = simd::float4{1.0f} / (l[0] * v[0].position.w + l[1] * v[1].position.w + l[2] * v[2].position.w);
+
+    FragmentQuad<Varyings> varying;
+    interpolate(v, l, w, varying);
+    float px[4] = {x + .5f, x + 1.5f, x + .5f, x + 1.5f}, py[4] = {y + .5f, y + .5f, y + 1.5f, y + 1.5f};
+    varying.position[0] = simd::float4::load(px);
+    varying.position[1] = simd::float4::load(py);
+    varying.position[2] = z;
+    varying.position[3] = w;
+    varying.mask = mask;
 
-    // Check and update the depth buffer
-    if (depthBuffer[x + y * image.width] < varying.position.z)
-      return;
+    // Change of the barycentric coordinates and 1/w per pixel, the shader derives the attributes it needs from them
+    float scale = SUBPIXEL_ONE * triangle.invArea;
+    varying.vertices = v;
+    varying.lx[0] = triangle.a[0] * scale;
+    varying.lx[1] = triangle.a[1] * scale;
+    varying.lx[2] = -varying.lx[0] - varying.lx[1];
+    varying.ly[0] = triangle.b[0] * scale;
+    varying.ly[1] = triangle.b[1] * scale;
+    varying.ly[2] = -varying.ly[0] - varying.ly[1];
+    varying.wx = varying.lx[0] * v[0].position.w + varying.lx[1] * v[1].position.w + varying.lx[2] * v[2].position.w;
+    varying.wy = varying.ly[0] * v[0].position.w + varying.ly[1] * v[1].position.w + varying.ly[2] * v[2].position.w;
 
-    depthBuffer[x + y * image.height] = varying.position.z;
+    // Compute the fragment colors and limit the output
+    auto color = draws[triangle.draw].fragmentShader(varying);
+    float r[4], g[4], b[4];
+    (simd::min(simd::max(color[0], 0.0f), 1.0f) * 255.0f).store(r);
+    (simd::min(simd::max(color[1], 0.0f), 1.0f) * 255.0f).store(g);
+    (simd::min(simd::max(color[2], 0.0f), 1.0f) * 255.0f).store(b);
+    for (int q = 0; q < 4; ++q) {
+      if (!(mask & (1 << q))) continue;
+      auto index = (size_t) ((x + (q & 1) - tile.x) + (y + (q >> 1) - tile.y) * tile.width) * samples;
+      auto color = RenderTarget::pack((uint8_t) r[q], (uint8_t) g[q], (uint8_t) b[q]);
+      for (int i = 0; i < samples; ++i)
+        if (sampleMasks[q] & (1 << i)) buffer.color[index + i] = color;
+    }
+  }
 
-    // Compute the fragment color and limit the output
-    vec4 color = clamp(program.fragmentShader(varying), 0.0f, 1.0f);
-    image.setPixel(x, y, color.r, color.g, color.b);
+  /*!
+   * Depth test the covered samples of a pixel and update the depth buffer
+   * @param depth Depth of the first sample of the pixel
+   * @param z Depth of the triangle at the pixel center
+   * @param sampleDepth Change of depth from the pixel center to each sample
+   * @param covered Mask of the samples covered by the triangle
+   * @param depthTest false when the whole block is known to be in front of the depth buffer
+   * @return Mask of the samples that passed the depth test
+   */
+  int setDepth(float *depth, float z, const float *sampleDepth, int covered, bool depthTest) const {
+    int passed = 0;
+    for (int j = 0; j < samples; ++j) {
+      float sample = z + sampleDepth[j];
+      if (!(covered & (1 << j)) || (depthTest && depth[j] < sample)) continue;
+      depth[j] = sample;
+      passed |= 1 << j;
+    }
+    return passed;
   }
 
   /*!
-   * Fill the top portion of a triangle that has split horizontally by using interpolation between vertices
-   * @param v0 - Top vertex of the triangle
-   * @param v1 - First bottom vertex
-   * @param v2 - Second bottom vertex
+   * Update the depth range of a block from the depth of its samples
+   * @param tile Tile the block belongs to
+   * @param buffer Depth of the tile
+   * @param bx Left pixel of the block
+   * @param by Top pixel of the block
    */
-  void renderTopTriangle(const Vertex &v0, const Vertex &v1, const Vertex &v2) {
-    for (int y = 0; v0.position.y + y <= v2.position.y; ++y) {
-      float yt = v0.position.y >= v2.position.y ? 0 : y / (v2.position.y - v0.position.y);
-      Vertex a = lerp(v0, v1, yt);
-      Vertex b = lerp(v0, v2, yt);
-      if (a.position.x > b.position.x) swap(a, b);
-      for (int x = 0; a.position.x + x <= b.position.x; ++x) {
-        float xt = a.position.x >= b.position.x ? 0 : x / (b.position.x - a.position.x);
-        Vertex varying = lerp(a, b, xt);
-        setFragment(varying);
+  void updateBlock(const Tile &tile, TileBuffer &buffer, int bx, int by) const {
+    int width = std::min(BLOCK_SIZE, tile.x + tile.width - bx) * samples, height = std::min(BLOCK_SIZE, tile.y + tile.height - by);
+    // Rows of multisampled blocks are scanned four samples at a time
+    simd::float4 laneMin{numeric_limits<float>::max()}, laneMax{-numeric_limits<float>::max()};
+    float zMin = numeric_limits<float>::max(), zMax = -numeric_limits<float>::max();
+    for (int y = 0; y < height; ++y) {
+      auto row = buffer.depth + ((bx - tile.x) + (by - tile.y + y) * tile.width) * samples;
+      int x = 0;
+      for (; x + 4 <= width; x += 4) {
+        auto depth = simd::float4::load(row + x);
+        laneMin = simd::min(depth, laneMin);
+        laneMax = simd::max(depth, laneMax);
+      }
+      for (; x < width; ++x) {
+        zMin = std::min(zMin, row[x]);
+        zMax = std::max(zMax, row[x]);
       }
     }
+    float lanes[4];
+    laneMin.store(lanes);
+    zMin = std::min({zMin, lanes[0], lanes[1], lanes[2], lanes[3]});
+    laneMax.store(lanes);
+    zMax = std::max({zMax, lanes[0], lanes[1], lanes[2], lanes[3]});
+    auto block = (size_t) ((bx - tile.x) / BLOCK_SIZE + (by - tile.y) / BLOCK_SIZE * buffer.blocksX);
+    buffer.blockMin[block] = zMin;
+    buffer.blockMax[block] = zMax;
   }
 
   /*!
-   * Fill the bottom portion of a triangle that has split horizontally by using interpolation between vertices
-   * @param v0 - First top vertex of the triangle
-   * @param v1 - Second top vertex
-   * @param v2 - Bottom vertex
+   * Evaluate the edge functions of a triangle at a pixel center
+   * @param triangle Triangle to evaluate
+   * @param x Horizontal pixel position
+   * @param y Vertical pixel position
+   * @param e Output values of the three edge functions
    */
-  void renderBottomTriangle(const Vertex &v0, const Vertex &v1, const Vertex &v2) {
-    for (int y = 0; v0.position.y + y <= v2.position.y; ++y) {
-      float yt =  v0.position.y >= v2.position.y ? 0 : y / (v2.position.y - v0.position.y);
-      Vertex a = lerp(v0, v2, yt);
-      Vertex b = lerp(v1, v2, yt);
-      if (a.position.x > b.position.x) swap(a, b);
-      for (int x = 0; a.position.x + x <= b.position.x; ++x) {
-        float xt = a.position.x >= b.position.x ? 0 : x / (b.position.x - a.position.x);
-        Vertex varying = lerp(a, b, xt);
-        setFragment(varying);
+  static void evaluate(const Triangle &triangle, int x, int y, int64_t (&e)[3]) {
+    for (int i = 0; i < 3; ++i)
+      e[i] = triangle.a[i] * (((int64_t) x << SUBPIXEL_BITS) + SUBPIXEL_ONE / 2) +
+             triangle.b[i] * (((int64_t) y << SUBPIXEL_BITS) + SUBPIXEL_ONE / 2) + triangle.c[i];
+  }
+
+  /*!
+   * Edge functions of the four pixels of a 2x2 quad
+   * @param triangle Triangle to evaluate
+   * @param e Edge functions at the top left pixel
+   * @param quad Output edge functions in order top left, top right, bottom left, bottom right
+   */
+  static void evaluateQuad(const Triangle &triangle, const int64_t (&e)[3], int64_t (&quad)[4][3]) {
+    for (int i = 0; i < 3; ++i) {
+      int64_t stepX = triangle.a[i] * SUBPIXEL_ONE, stepY = triangle.b[i] * SUBPIXEL_ONE;
+      quad[0][i] = e[i];
+      quad[1][i] = e[i] + stepX;
+      quad[2][i] = e[i] + stepY;
+      quad[3][i] = e[i] + stepX + stepY;
+    }
+  }
+
+  /*!
+   * Test the samples of a rectangle of pixels against the edges of a triangle, edge functions are linear so it is
+   * enough to check the corner that is furthest inside or outside of each edge, widened by the sample radius
+   * @param triangle Triangle to test
+   * @param x0 Left pixel of the rectangle
+   * @param y0 Top pixel of the rectangle
+   * @param x1 Right pixel of the rectangle
+   * @param y1 Bottom pixel of the rectangle
+   * @return Coverage of the rectangle, partially covered rectangles may also turn out to be empty
+   */
+  Coverage coverage(const Triangle &triangle, int x0, int y0, int x1, int y1) const {
+    int64_t e[3];
+    evaluate(triangle, x0, y0, e);
+    bool full = true;
+    for (int i = 0; i < 3; ++i) {
+      int64_t stepX = triangle.a[i] * SUBPIXEL_ONE * (x1 - x0), stepY = triangle.b[i] * SUBPIXEL_ONE * (y1 - y0);
+      int64_t spread = (std::abs(triangle.a[i]) + std::abs(triangle.b[i])) * sampleRadius;
+      if (e[i] + std::max(stepX, (int64_t) 0) + std::max(stepY, (int64_t) 0) + spread < 0) return Coverage::None;
+      if (e[i] + std::min(stepX, (int64_t) 0) + std::min(stepY, (int64_t) 0) - spread < 0) full = false;
+    }
+    return full ? Coverage::Full : Coverage::Partial;
+  }
+
+  /*!
+   * Rasterize the part of a triangle inside a tile
+   * The tile is split into blocks that are skipped when they lie outside of an edge or behind the depth buffer, the
+   * remaining blocks are walked in 2x2 pixel quads and pixels of fully covered blocks skip the edge tests
+   * @param triangle Triangle to rasterize
+   * @param id Index of the triangle
+   * @param tile Tile to rasterize in
+   * @param buffer Depth and color of the tile
+   * @return Number of fragments that passed the depth test
+   */
+  uint64_t rasterize(const Triangle &triangle, uint32_t id, const Tile &tile, TileBuffer &buffer) {
+    int x0 = std::max(triangle.minX, tile.x), x1 = std::min(triangle.maxX, tile.x + tile.width - 1);
+    int y0 = std::max(triangle.minY, tile.y), y1 = std::min(triangle.maxY, tile.y + tile.height - 1);
+    if (x0 > x1 || y0 > y1) return 0;
+
+    // Whole triangle behind everything in the tile
+    bool hierarchicalDepth = settings.hierarchicalDepth;
+    if (hierarchicalDepth && triangle.zMin - DEPTH_EPSILON > buffer.tileMax) {
+      occludedTriangles++;
+      return 0;
+    }
+
+    // Change of the edge functions for a step of one pixel and from the pixel center to each sample, a pixel has all
+    // samples inside of an edge when its center is at least sampleInside from it and none when it is sampleOutside out
+    int64_t stepX[3], stepY[3], sampleSteps[MAX_SAMPLES][3], sampleInside[3], sampleOutside[3];
+    for (int i = 0; i < 3; ++i) {
+      stepX[i] = triangle.a[i] * SUBPIXEL_ONE;
+      stepY[i] = triangle.b[i] * SUBPIXEL_ONE;
+      sampleInside[i] = sampleOutside[i] = 0;
+      for (int j = 0; j < samples; ++j) {
+        sampleSteps[j][i] = triangle.a[i] * sampleOffsets[j].x + triangle.b[i] * sampleOffsets[j].y;
+        sampleInside[i] = std::max(sampleInside[i], -sampleSteps[j][i]);
+        sampleOutside[i] = std::max(sampleOutside[i], sampleSteps[j][i]);
       }
     }
+    // Depth is stepped along with the edge functions, each sample adds its offset to the depth of the pixel center
+    float sampleDepth[MAX_SAMPLES];
+    for (int j = 0; j < samples; ++j)
+      sampleDepth[j] = (float) sampleSteps[j][0] * triangle.depth[0] + (float) sampleSteps[j][1] * triangle.depth[1];
+    float pixelDepth[4] = {0, triangle.depthStepX, triangle.depthStepY, triangle.depthStepX + triangle.depthStepY};
+    const int allSamples = (1 << samples) - 1;
+    // Change of depth from the pixel centers to the farthest samples
+    float depthSpread = (std::abs(triangle.depthStepX) + std::abs(triangle.depthStepY)) * sampleRadius / SUBPIXEL_ONE;
+
+    uint64_t passed = 0, occluded = 0;
+    bool lowered = false;
+    // Blocks and quads are aligned to the tile origin
+    for (int by = tile.y + (y0 - tile.y) / BLOCK_SIZE * BLOCK_SIZE; by <= y1; by += BLOCK_SIZE) {
+      for (int bx = tile.x + (x0 - tile.x) / BLOCK_SIZE * BLOCK_SIZE; bx <= x1; bx += BLOCK_SIZE) {
+        int qx0 = bx + (std::max(x0, bx) - bx) / 2 * 2, qx1 = std::min(x1, bx + BLOCK_SIZE - 1);
+        int qy0 = by + (std::max(y0, by) - by) / 2 * 2, qy1 = std::min(y1, by + BLOCK_SIZE - 1);
+        auto blockCoverage = coverage(triangle, qx0, qy0, qx1, qy1);
+        if (blockCoverage == Coverage::None) continue;
+        bool full = blockCoverage == Coverage::Full;
+
+        // Edge functions and depth at the center of the first pixel of the block
+        int64_t row[3];
+        evaluate(triangle, qx0, qy0, row);
+        float zRow = triangle.z2 + (float) row[0] * triangle.depth[0] + (float) row[1] * triangle.depth[1];
+
+        // Depth range of the triangle plane over the block, linear so its extremes are in the corners
+        bool depthTest = true;
+        auto block = (size_t) ((bx - tile.x) / BLOCK_SIZE + (by - tile.y) / BLOCK_SIZE * buffer.blocksX);
+        float zNear = 0, zFar = 0;
+        if (hierarchicalDepth) {
+          float dx = triangle.depthStepX * (qx1 - qx0), dy = triangle.depthStepY * (qy1 - qy0);
+          zNear = std::max(zRow + std::min(dx, 0.0f) + std::min(dy, 0.0f) - depthSpread, triangle.zMin) - DEPTH_EPSILON;
+          zFar = std::min(zRow + std::max(dx, 0.0f) + std::max(dy, 0.0f) + depthSpread, triangle.zMax) + DEPTH_EPSILON;
+          // A stale range is recomputed only when it could not reject the block
+          if (zNear <= buffer.blockMax[block] && buffer.blockStale[block]) {
+            updateBlock(tile, buffer, bx, by);
+            buffer.blockStale[block] = 0;
+            lowered = true;
+          }
+          if (zNear > buffer.blockMax[block]) {
+            occluded++;
+            continue;
+          }
+          depthTest = zFar > buffer.blockMin[block];
+        }
+
+        uint64_t blockPassed = 0;
+        for (int y = qy0; y <= qy1; y += 2) {
+          int64_t e[3] = {row[0], row[1], row[2]};
+          float z = zRow;
+          // Pixels of the quads outside of the clamped bounds are masked out
+          int rowMask = y < qy1 ? 0xF : 0x3;
+          for (int x = qx0; x <= qx1; x += 2) {
+            int64_t quad[4][3];
+            evaluateQuad(triangle, e, quad);
+            int mask = rowMask & (x < qx1 ? 0xF : 0x5);
+
+            // Samples of each pixel that are covered and pass the depth test
+            auto index = (size_t) ((x - tile.x) + (y - tile.y) * tile.width);
+            size_t offsets[4] = {0, 1, (size_t) tile.width, (size_t) tile.width + 1};
+            int passedMask = 0, sampleMasks[4] = {0, 0, 0, 0};
+            for (int q = 0; q < 4; ++q) {
+              if (!(mask & (1 << q))) continue;
+              // Only pixels crossed by an edge test their samples one by one
+              int covered = allSamples;
+              if (!full) {
+                auto &center = quad[q];
+                if (center[0] < -sampleOutside[0] || center[1] < -sampleOutside[1] || center[2] < -sampleOutside[2])
+                  continue;
+                if (center[0] < sampleInside[0] || center[1] < sampleInside[1] || center[2] < sampleInside[2]) {
+                  covered = 0;
+                  for (int j = 0; j < samples; ++j) {
+                    int64_t e0 = center[0] + sampleSteps[j][0], e1 = center[1] + sampleSteps[j][1];
+                    if ((e0 | e1 | (center[2] + sampleSteps[j][2])) >= 0) covered |= 1 << j;
+                  }
+                }
+              }
+              sampleMasks[q] = setDepth(buffer.depth + (index + offsets[q]) * samples, z + pixelDepth[q], sampleDepth,
+                                        covered, depthTest);
+              if (sampleMasks[q]) {
+                passedMask |= 1 << q;
+                blockPassed++;
+              }
+            }
+
+            // Pixels that passed are shaded together or in the depth prepass their samples remember the triangle
+            if (passedMask && settings.depthPrepass) {
+              for (int q = 0; q < 4; ++q)
+                for (int j = 0; j < samples; ++j)
+                  if (sampleMasks[q] & (1 << j)) buffer.visible[(index + offsets[q]) * samples + j] = id;
+            } else if (passedMask) {
+              shade(triangle, x, y, quad, passedMask, sampleMasks, tile, buffer);
+            }
+            for (int i = 0; i < 3; ++i) e[i] += 2 * stepX[i];
+            z += 2 * triangle.depthStepX;
+          }
+          for (int i = 0; i < 3; ++i) row[i] += 2 * stepY[i];
+          zRow += 2 * triangle.depthStepY;
+        }
+
+        // A block covered entirely without depth test takes the range of the triangle, other blocks keep a range
+        // that still encloses their depth and are marked stale
+        if (blockPassed && hierarchicalDepth) {
+          bool wholeBlock = qx0 == bx && qy0 == by && qx1 == std::min(bx + BLOCK_SIZE, tile.x + tile.width) - 1 &&
+                            qy1 == std::min(by + BLOCK_SIZE, tile.y + tile.height) - 1;
+          if (full && !depthTest && wholeBlock) {
+            buffer.blockMin[block] = zNear;
+            buffer.blockMax[block] = zFar;
+            buffer.blockStale[block] = 0;
+            lowered = true;
+          } else {
+            buffer.blockMin[block] = std::min(buffer.blockMin[block], zNear);
+            buffer.blockStale[block] = 1;
+          }
+        }
+        passed += blockPassed;
+      }
+    }
+
+    if (lowered)
+      buffer.tileMax = *max_element(buffer.blockMax.begin(), buffer.blockMax.end());
+    occludedBlocks += occluded;
+    return passed;
+  }
+
+  /*!
+   * Shade the pixels of a tile covered in the depth prepass, the pixels of a quad covered by the same triangle are
+   * shaded together and pixels with samples of several triangles are shaded once for each of them
+   * @param tile Tile to shade
+   * @param buffer Depth, color and covering triangles of the tile
+   * @return Number of shaded fragments
+   */
+  uint64_t shadeVisible(const Tile &tile, TileBuffer &buffer) {
+    uint64_t shaded = 0;
+    for (int y = tile.y; y < tile.y + tile.height; y += 2)
+      for (int x = tile.x; x < tile.x + tile.width; x += 2) {
+        // Quads of odd sized tiles stick out over the right or bottom edge
+        auto index = (size_t) ((x - tile.x) + (y - tile.y) * tile.width);
+        uint32_t ids[4][MAX_SAMPLES];
+        int remaining[4] = {0, 0, 0, 0};
+        for (int q = 0; q < 4; ++q) {
+          if (x + (q & 1) >= tile.x + tile.width || y + (q >> 1) >= tile.y + tile.height) continue;
+          auto pixel = (index + (q & 1) + (q >> 1) * tile.width) * samples;
+          for (int j = 0; j < samples; ++j) {
+            ids[q][j] = buffer.visible[pixel + j];
+            if (ids[q][j] != NO_TRIANGLE) remaining[q] |= 1 << j;
+          }
+        }
+
+        for (int first = 0; first < 4; ++first)
+          while (remaining[first]) {
+            int sample = 0;
+            while (!(remaining[first] & (1 << sample))) sample++;
+            uint32_t id = ids[first][sample];
+            int mask = 0, sampleMasks[4] = {0, 0, 0, 0};
+            for (int q = first; q < 4; ++q) {
+              for (int j = 0; j < samples; ++j)
+                if ((remaining[q] & (1 << j)) && ids[q][j] == id) sampleMasks[q] |= 1 << j;
+              if (!sampleMasks[q]) continue;
+              mask |= 1 << q;
+              remaining[q] &= ~sampleMasks[q];
+              shaded++;
+            }
+
+            // Same edge functions as in the prepass so the colors do not depend on it
+            auto &triangle = triangles[id];
+            int64_t e[3], quad[4][3];
+            evaluate(triangle, x, y, e);
+            evaluateQuad(triangle, e, quad);
+            shade(triangle, x, y, quad, mask, sampleMasks, tile, buffer);
+          }
+      }
+    return shaded;
   }
 
 public:
   /*!
    * Initialize the rasterizer
-   * @param image Image to render to
-   * @param program Program to use for rendering
+   * @param target Render target to draw to, its tiles have to match the scheduler
+   * @param program Program to use for rendering, its uniforms are captured by each draw call
+   * @param scheduler Scheduler that runs the stages in parallel, its tile size is used for binning
    */
-  Rasterizer(Image &image, Program &program) : program{program}, image{image} {
+  Rasterizer(RenderTarget &target, P &program, TileScheduler &scheduler) : program{program}, target{target}, scheduler{scheduler} {
+    int tileSize = scheduler.getTileSize();
+    if (target.getTileSize() != tileSize)
+      throw runtime_error("Render target tiles do not match the scheduler");
+
+    // Standard sample patterns of Direct3D in 1/16 of a pixel, spread so that no two samples share a row or column
+    static const int pattern4[4][2] = {{-2, -6}, {6, -2}, {-6, 2}, {2, 6}};
+    static const int pattern8[8][2] = {{1, -3}, {-1, 3}, {5, 1}, {-3, -5}, {-5, 5}, {-7, -1}, {3, 7}, {7, -7}};
+    samples = target.getSamples();
+    if (samples != 1 && samples != 4 && samples != 8)
+      throw runtime_error("Rasterizer supports 1, 4 or 8 samples per pixel, not " + to_string(samples));
+    sampleRadius = 0;
+    for (int i = 0; i < samples; ++i) {
+      auto &offset = samples == 4 ? pattern4[i] : pattern8[i];
+      sampleOffsets[i] = samples == 1 ? ivec2{0} : ivec2{offset[0], offset[1]} * (int) (SUBPIXEL_ONE / 16);
+      sampleRadius = std::max({sampleRadius, std::abs(sampleOffsets[i].x), std::abs(sampleOffsets[i].y)});
+    }
+    tilesX = (target.width + tileSize - 1) / tileSize;
+    tilesY = (target.height + tileSize - 1) / tileSize;
+    bins.resize(scheduler.getThreadCount());
+    for (auto &threadBins : bins)
+      threadBins.resize((size_t) (tilesX * tilesY));
+    guardBand = {1.0f + 2.0f * GUARD_BAND / target.width, 1.0f + 2.0f * GUARD_BAND / target.height};
+    tileBuffers.resize(scheduler.getThreadCount());
+    for (auto &buffer : tileBuffers) {
+      buffer.visible.resize((size_t) (tileSize * tileSize * samples));
+      buffer.blocksX = (tileSize + BLOCK_SIZE - 1) / BLOCK_SIZE;
+      buffer.blockMin.resize((size_t) (buffer.blocksX * buffer.blocksX));
+      buffer.blockMax.resize((size_t) (buffer.blocksX * buffer.blocksX));
+      buffer.blockStale.resize((size_t) (buffer.blocksX * buffer.blocksX));
+    }
     clear();
   };
 
   /*!
-   * Clear depth buffer and image
+   * Clear depth and color of the render target
    */
   void clear() {
-    // Clear the depth buffer
-    depthBuffer = vector<float>((unsigned long) (image.width * image.height), numeric_limits<float>::max());
-    // Clear the image
-    image.clear({128,128,128});
+    target.clear({128,128,128});
+  }
+
+  /*!
+   * Queue the indexed triangles of a mesh for rendering with the current program uniforms, call finish to rasterize them
+   * The attribute streams are read in place from the mapped mesh file, missing normals or texture coordinates are zero
+   * @param mesh Shape with three floats of position and normal and two of texture coordinates per vertex and three
+   * indices per triangle
+   */
+  void draw(const MeshFile::Shape &mesh) {
+    auto drawIndex = (uint32_t) draws.size();
+    draws.push_back(program);
+
+    // Vertex stage, every vertex is shaded once no matter how many triangles share it
+    auto positions = mesh.positions, normals = mesh.normals, texCoords = mesh.texCoords;
+    auto indices = mesh.indices;
+    auto vertexCount = mesh.vertexCount;
+    transformed.resize(vertexCount);
+    projected.resize(vertexCount);
+    outcodes.resize(vertexCount);
+    scheduler.runRange((int) vertexCount, CHUNK_SIZE, [&](const Tile &chunk, unsigned int) {
+      for (size_t i = (size_t) chunk.x; i < (size_t) (chunk.x + chunk.width); ++i) {
+        Vertex vertex{{positions[3 * i], positions[3 * i + 1], positions[3 * i + 2], 1},
+                      normals ? vec3{normals[3 * i], normals[3 * i + 1], normals[3 * i + 2]} : vec3{},
+                      texCoords ? vec2{texCoords[2 * i], texCoords[2 * i + 1]} : vec2{}};
+        transformed[i] = program.vertexShader(vertex);
+        projected[i] = toViewport(transformed[i]);
+        outcodes[i] = outcode(transformed[i].position);
+      }
+    });
+
+    // Triangle assembly reads the shaded vertices from the post-transform buffer
+    auto first = triangles.size(), count = mesh.indexCount / 3;
+    auto chunks = (count + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    triangles.resize(first + count);
+    accepted.resize(first + count);
+    clippedTriangles.resize(std::max(clippedTriangles.size(), chunks));
+    chunkStatistics.assign(chunks, Statistics{});
+    scheduler.runRange((int) count, CHUNK_SIZE, [&](const Tile &chunk, unsigned int) {
+      auto &extra = clippedTriangles[chunk.x / CHUNK_SIZE];
+      auto &stats = chunkStatistics[chunk.x / CHUNK_SIZE];
+      extra.clear();
+      for (size_t i = (size_t) chunk.x; i < (size_t) (chunk.x + chunk.width); ++i) {
+        auto &triangle = triangles[first + i];
+        triangle.draw = drawIndex;
+        accepted[first + i] = assemble(indices[3 * i], indices[3 * i + 1], indices[3 * i + 2], triangle, extra, stats);
+      }
+    });
+    statistics.vertices += vertexCount;
+    statistics.triangles += count;
+
+    // Pieces of clipped triangles follow the triangles of the draw call in chunk order
+    for (size_t chunk = 0; chunk < chunks; ++chunk) {
+      auto &stats = chunkStatistics[chunk];
+      statistics.outside += stats.outside;
+      statistics.backfacing += stats.backfacing;
+      statistics.clipped += stats.clipped;
+      auto &extra = clippedTriangles[chunk];
+      triangles.insert(triangles.end(), extra.begin(), extra.end());
+      accepted.insert(accepted.end(), extra.size(), 1);
+    }
+
+    // Sort triangles into the tiles their bounds overlap, chunks are binned in parallel into the bins of the thread
+    // that takes them and finish merges the bins of a tile back into submission order
+    int tileSize = scheduler.getTileSize();
+    atomic<uint64_t> rasterized{0};
+    scheduler.runRange((int) (triangles.size() - first), CHUNK_SIZE, [&](const Tile &chunk, unsigned int thread) {
+      auto &threadBins = bins[thread];
+      uint64_t binned = 0;
+      for (auto i = (uint32_t) (first + chunk.x); i < (uint32_t) (first + chunk.x + chunk.width); ++i) {
+        if (!accepted[i]) continue;
+        binned++;
+        auto &triangle = triangles[i];
+        for (int ty = triangle.minY / tileSize; ty <= triangle.maxY / tileSize; ++ty)
+          for (int tx = triangle.minX / tileSize; tx <= triangle.maxX / tileSize; ++tx) {
+            // Long thin triangles have large bounds but touch only a few of the tiles in them
+            int x = tx * tileSize, y = ty * tileSize;
+            if (coverage(triangle, x, y, std::min(x + tileSize, target.width) - 1, std::min(y + tileSize, target.height) - 1) != Coverage::None)
+              threadBins[tx + ty * tilesX].push_back(i);
+          }
+      }
+      rasterized += binned;
+    });
+    statistics.rasterized += rasterized;
+  }
+
+  /*!
+   * Rasterize all queued triangles into the render target, returns once all tiles are done
+   */
+  void finish() {
+    int tileSize = scheduler.getTileSize();
+    scheduler.run(target.width, target.height, [&](const Tile &tile, unsigned int thread) {
+      // Gather the triangles every thread binned for the tile, each thread bins whole chunks in increasing order but
+      // chunks are stolen between threads, so the bin is sorted by triangle index when several threads contributed
+      auto &buffer = tileBuffers[thread];
+      auto &bin = buffer.bin;
+      auto tileIndex = (size_t) (tile.x / tileSize + tile.y / tileSize * tilesX);
+      bin.clear();
+      int sources = 0;
+      for (auto &threadBins : bins) {
+        auto &source = threadBins[tileIndex];
+        if (source.empty()) continue;
+        bin.insert(bin.end(), source.begin(), source.end());
+        source.clear();
+        sources++;
+      }
+      if (sources > 1) sort(bin.begin(), bin.end());
+      if (bin.empty()) return;
+
+      // Draw straight into the render target, the scratch buffers belong to this thread
+      bool cleared = target.getTile(tile, buffer.depth, buffer.color);
+
+      // Depth range of the blocks, blocks of edge tiles that are outside of the image stay empty
+      if (settings.hierarchicalDepth) {
+        fill(buffer.blockMin.begin(), buffer.blockMin.end(), numeric_limits<float>::max());
+        fill(buffer.blockMax.begin(), buffer.blockMax.end(), -numeric_limits<float>::max());
+        fill(buffer.blockStale.begin(), buffer.blockStale.end(), 0);
+        for (int by = tile.y; by < tile.y + tile.height; by += BLOCK_SIZE)
+          for (int bx = tile.x; bx < tile.x + tile.width; bx += BLOCK_SIZE) {
+            auto block = (size_t) ((bx - tile.x) / BLOCK_SIZE + (by - tile.y) / BLOCK_SIZE * buffer.blocksX);
+            if (cleared)
+              buffer.blockMin[block] = buffer.blockMax[block] = target.getClearDepth();
+            else
+              updateBlock(tile, buffer, bx, by);
+          }
+        buffer.tileMax = *max_element(buffer.blockMax.begin(), buffer.blockMax.end());
+      }
+
+      if (settings.depthPrepass) {
+        fill_n(buffer.visible.begin(), tile.width * tile.height * samples, NO_TRIANGLE);
+        for (auto index : bin)
+          rasterize(triangles[index], index, tile, buffer);
+        fragments += shadeVisible(tile, buffer);
+      } else {
+        uint64_t shaded = 0;
+        for (auto index : bin)
+          shaded += rasterize(triangles[index], index, tile, buffer);
+        fragments += shaded;
+      }
+    });
+
+    triangles.clear();
+    accepted.clear();
+    draws.clear();
   }
 
   /*!
-   * Render a face into the image
-   * @param face Face to render
+   * Number of shaded vertices, submitted and rasterized triangles and shaded fragments since the last reset
    */
-  void render(const Face &face) {
-    // transform vertices
-    Vertex t0 = toViewport(program.vertexShader(face.v0));
-    Vertex t1 = toViewport(program.vertexShader(face.v1));
-    Vertex t2 = toViewport(program.vertexShader(face.v2));
-    // Sort the vertices
-    if (t0.position.y > t1.position.y) swap(t0, t1);
-    if (t0.position.y > t2.position.y) swap(t0, t2);
-    if (t1.position.y > t2.position.y) swap(t1, t2);
-    // Split the triangle into top/bottom sections
-    float t = t0.position.y >= t2.position.y ? 0 : (t1.position.y - t0.position.y) / (t2.position.y - t0.position.y);
-    Vertex tm = lerp(t0, t2, t);
+  Statistics getStatistics() const {
+    Statistics result = statistics;
+    result.fragments = fragments;
+    result.occludedTriangles = occludedTriangles;
+    result.occludedBlocks = occludedBlocks;
+    return result;
+  }
 
-    // Render
-    renderTopTriangle(t0, tm, t1);
-    renderBottomTriangle(t1, tm, t2);
+  /*!
+   * Clear the statistics
+   */
+  void resetStatistics() {
+    statistics = {};
+    fragments = 0;
+    occludedTriangles = 0;
+    occludedBlocks = 0;
   }
 };
 
 /*!
- * Load Wavefront obj file data as vector of faces for simplicity
- * @return vector of Faces that can be rendered
+ * Create the scene rendered by this example, the textured corsair
+ * @return Scene description
  */
-vector<Face> loadObjFile(const string filename) {
-  // Using tiny obj loader from ppgso lib
-  vector<tinyobj::shape_t> shapes;
-  vector<tinyobj::material_t> materials;
-  string err = tinyobj::LoadObj(shapes, materials, filename.c_str());
-
-  // Will only convert 1st shape to Faces
-  auto &mesh = shapes[0].mesh;
-
-  // Collect data in vectors
-  vector<vec4> positions;
-  for (int i = 0; i < (int) mesh.positions.size() / 3; ++i)
-    positions.emplace_back(mesh.positions[3 * i], mesh.positions[3 * i + 1], mesh.positions[3 * i + 2], 1);
-
-  vector<vec4> normals;
-  for (int i = 0; i < (int) mesh.normals.size() / 3; ++i)
-    normals.emplace_back(mesh.normals[3 * i], mesh.normals[3 * i + 1], mesh.normals[3 * i + 2], 1);
-
-  vector<vec2> texcoords;
-  for (int i = 0; i < (int) mesh.texcoords.size() / 2; ++i)
-    texcoords.emplace_back(mesh.texcoords[2 * i], mesh.texcoords[2 * i + 1]);
-
-  // Fill the vector of Faces with data
-  vector<Face> faces(mesh.indices.size() / 3);
-  for (int i = 0; i < (int) faces.size(); i++) {
-    faces[i] = Face{
-        {
-            positions[mesh.indices[i * 3]],
-            normals[mesh.indices[i * 3]],
-            texcoords[mesh.indices[i * 3]],
-            {1, 1, 1, 1}
-        }, {
-            positions[mesh.indices[i * 3 + 1]],
-            normals[mesh.indices[i * 3 + 1]],
-            texcoords[mesh.indices[i * 3 + 1]],
-            {1, 1, 1, 1}
-        }, {
-            positions[mesh.indices[i * 3 + 2]],
-            normals[mesh.indices[i * 3 + 2]],
-            texcoords[mesh.indices[i * 3 + 2]],
-            {1, 1, 1, 1}
-        }
+scene::Description defaultScene() {
+  scene::Description description;
+  description.camera.position = {0, .7, .7};
+  description.camera.target = {0, 0, 0};
+  description.camera.up = {.5, .5, 0};
+  description.camera.fov = 60;
+  description.camera.near = .1;
+  description.camera.far = 15;
+
+  scene::Material material;
+  material.name = "corsair";
+  material.texture = "corsair.bmp";
+  description.materials.push_back(material);
+  description.meshes.push_back({"corsair.obj", orientate4(vec3{0, .4, .8}), 0});
+  return description;
+}
+
+/*!
+ * Mesh with its geometry and texture loaded once, so sequences only pay for loading in the first frame
+ */
+struct SceneMesh {
+  MeshFile geometry;
+  RasterTexture texture;
+  mat4 transform;
+  double spin;
+};
+
+/*!
+ * Load the geometry and textures of all meshes in a scene, spheres and lights are skipped as the rasterizer only draws textured triangles
+ * @param description Scene to load
+ * @return Meshes ready to render
+ */
+vector<SceneMesh> loadMeshes(const scene::Description &description) {
+  vector<SceneMesh> meshes;
+  for (auto &mesh : description.meshes) {
+    // Image to use as texture in the shader program, untextured materials use their diffuse color
+    auto &material = description.materials[mesh.material];
+    Image texture{1, 1};
+    if (material.texture.empty())
+      texture.setPixel(0, 0, (float) material.diffuse.r, (float) material.diffuse.g, (float) material.diffuse.b);
+    else
+      texture = image::loadBMP(material.texture);
+
+    // Indexed geometry mapped from the binary cache of the Wavefront obj file, the loader already merged vertices
+    // with equal position, normal and texture coordinates so the rasterizer can draw the streams as they are
+    meshes.push_back({MeshFile::load(mesh.file), RasterTexture{texture}, mesh.transform, mesh.spin});
+  }
+
+  if (!description.spheres.empty())
+    cout << "Skipping " << description.spheres.size() << " spheres, raw4_raster only renders meshes" << endl;
+  return meshes;
+}
+
+/*!
+ * Render a frame of the scene, meshes with spin turn around their vertical axis in each frame
+ * The rasterizer is kept between frames so its buffers are only allocated for the first one
+ * @tparam P Program to shade the meshes with
+ * @param rasterizer Rasterizer drawing into the render target with the program
+ * @param program Program of the rasterizer, its uniforms are set for each mesh
+ * @param camera Camera to render the scene from
+ * @param meshes Meshes to render
+ * @param frame Frame of the sequence
+ * @param target Render target of the rasterizer
+ * @param image Image of the size of the target to resolve the frame to
+ * @param scheduler Scheduler of the rasterizer, also resolves the target
+ * @return Work done by the rasterizer in this frame
+ */
+template<typename P>
+RasterizerBase::Statistics render(Rasterizer<P> &rasterizer, P &program, const scene::Camera &camera,
+                                  vector<SceneMesh> &meshes, unsigned int frame, RenderTarget &target, Image &image,
+                                  TileScheduler &scheduler) {
+  program.viewMatrix = lookAt(vec3{camera.position}, vec3{camera.target}, vec3{camera.up});
+  program.projectionMatrix = perspective(radians((float) camera.fov), (float) target.width / (float) target.height,
+                                         (float) camera.near, (float) camera.far);
+  rasterizer.resetStatistics();
+  rasterizer.clear();
+
+  for (auto &mesh : meshes) {
+    // Set program uniforms
+    program.texture = &mesh.texture;
+    program.modelMatrix = scene::turntable(mesh.transform, mesh.spin, frame);
+
+    // Queue all triangles of the mesh
+    for (auto &shape : mesh.geometry.getShapes())
+      rasterizer.draw(shape);
+  }
+  rasterizer.finish();
+  target.resolve(image, scheduler);
+  return rasterizer.getStatistics();
+}
+
+/*!
+ * Create a scene with copies of the corsair stacked towards the camera, every pixel they cover is drawn many times
+ * @param layers Number of copies
+ * @param frontToBack Submit the nearest copy first instead of last
+ * @return Scene description
+ */
+scene::Description overdrawScene(int layers, bool frontToBack) {
+  auto description = defaultScene();
+  auto corsair = description.meshes.front();
+  description.meshes.clear();
+  for (int layer = 0; layer < layers; ++layer) {
+    int step = frontToBack ? layers - 1 - layer : layer;
+    auto mesh = corsair;
+    mesh.transform = translate(mat4{1.0f}, vec3{description.camera.position} * (.04f * step)) * corsair.transform;
+    description.meshes.push_back(mesh);
+  }
+  return description;
+}
+
+/*!
+ * Create a Wavefront obj mesh of a grid, every vertex has its own position, normal and texture coordinate and is
+ * shared by up to six triangles like in a smooth scanned or sculpted asset
+ * @param size Number of quads along each side, the grid has 2 * size * size triangles
+ * @return Contents of the obj file
+ */
+string gridObj(int size) {
+  string obj;
+  char line[128];
+  auto add = [&](int length) { obj.append(line, (size_t) length); };
+  for (int y = 0; y <= size; ++y)
+    for (int x = 0; x <= size; ++x) {
+      float u = (float) x / size, v = (float) y / size;
+      add(snprintf(line, sizeof(line), "v %f %f %f\n", u - .5f, v - .5f, .1f * sin(10 * u) * cos(10 * v)));
+      add(snprintf(line, sizeof(line), "vt %f %f\n", u, v));
+      add(snprintf(line, sizeof(line), "vn %f %f %f\n", 0.0f, 0.0f, 1.0f));
+    }
+  for (int y = 0; y < size; ++y)
+    for (int x = 0; x < size; ++x) {
+      // Obj indices start at 1
+      int i = x + y * (size + 1) + 1, j = i + 1, k = i + size + 1, l = k + 1;
+      add(snprintf(line, sizeof(line), "f %d/%d/%d %d/%d/%d %d/%d/%d\n", i, i, i, j, j, j, l, l, l));
+      add(snprintf(line, sizeof(line), "f %d/%d/%d %d/%d/%d %d/%d/%d\n", i, i, i, l, l, l, k, k, k));
+    }
+  return obj;
+}
+
+/*!
+ * Measure triangle and fragment throughput of the rasterizer on the built in corsair scene, the cost of lighting and
+ * multisampling, the benefit of hierarchical depth and the depth prepass on a scene with high overdraw and the time
+ * to load large meshes
+ * @param options Options that select the number of threads and the tile size
+ */
+void benchmark(const RenderOptions &options) {
+  TileScheduler scheduler{options.threads, options.tileSize};
+
+  auto measure = [&](const string &name, const scene::Description &description, vector<SceneMesh> &meshes,
+                     ivec2 size, int samples, const RasterizerBase::Settings &settings, unsigned int frames,
+                     bool lit = false) {
+    Image image{size.x, size.y};
+    RenderTarget target{size.x, size.y, scheduler.getTileSize(), samples};
+    RasterizerBase::Statistics total;
+    double time = 0;
+    // The program is passed by value only to select the rasterizer type
+    auto renderFrames = [&](auto program) {
+      Rasterizer<decltype(program)> rasterizer{target, program, scheduler};
+      rasterizer.settings = settings;
+      // Warm up caches, the thread pool and the buffers of the rasterizer
+      render(rasterizer, program, description.camera, meshes, 0, target, image, scheduler);
+
+      auto begin = chrono::steady_clock::now();
+      for (unsigned int frame = 0; frame < frames; ++frame) {
+        auto statistics = render(rasterizer, program, description.camera, meshes, 0, target, image, scheduler);
+        total.vertices += statistics.vertices;
+        total.triangles += statistics.triangles;
+        total.outside += statistics.outside;
+        total.backfacing += statistics.backfacing;
+        total.clipped += statistics.clipped;
+        total.rasterized += statistics.rasterized;
+        total.occludedTriangles += statistics.occludedTriangles;
+        total.occludedBlocks += statistics.occludedBlocks;
+        total.fragments += statistics.fragments;
+      }
+      time = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
     };
+    if (lit)
+      renderFrames(LitProgram{});
+    else
+      renderFrames(TextureProgram{});
+
+    cout << name << " " << size.x << "x" << size.y << (samples > 1 ? " " + to_string(samples) + "x MSAA" : "") << ": "
+         << time * 1000 / frames << " ms/frame, "
+         << total.triangles / time / 1e6 << " Mtris/s, "
+         << total.fragments / time / 1e6 << " Mfrags/s, "
+         << total.fragments / frames << " fragments shaded" << endl
+         << "  " << total.triangles / frames << " triangles: " << total.outside / frames << " outside, "
+         << total.backfacing / frames << " back facing, " << total.clipped / frames << " clipped, "
+         << total.rasterized / frames << " rasterized, " << total.vertices / frames << " vertices shaded, "
+         << total.occludedTriangles / frames << " tiles and " << total.occludedBlocks / frames << " blocks occluded" << endl;
+  };
+
+  cout << scheduler.getThreadCount() << " threads, " << scheduler.getTileSize() << " px tiles" << endl;
+  auto description = defaultScene();
+  auto meshes = loadMeshes(description);
+  measure("Corsair", description, meshes, {512, 512}, 1, {}, 50);
+  measure("Corsair", description, meshes, {3840, 2160}, 1, {}, 10);
+  // The lit program interpolates normals in addition to the texture coordinates of the texture program
+  measure("Corsair lit", description, meshes, {512, 512}, 1, {}, 50, true);
+  measure("Corsair lit", description, meshes, {3840, 2160}, 1, {}, 10, true);
+  // Multisampling shades once per pixel, compare with the fragments of supersampling 1920x1080 at 3840x2160
+  for (int samples : {1, 4, 8})
+    measure("Corsair", description, meshes, {1920, 1080}, samples, {}, 10);
+  // Cost of clearing and resolving a frame with nothing drawn
+  vector<SceneMesh> empty;
+  measure("Empty", description, empty, {3840, 2160}, 1, {}, 50);
+  measure("Empty", description, empty, {1920, 1080}, 8, {}, 50);
+
+  // Overdraw pays off only when triangles are rejected before shading
+  RasterizerBase::Settings noHierarchicalDepth, prepass;
+  noHierarchicalDepth.hierarchicalDepth = false;
+  prepass.depthPrepass = true;
+  for (bool frontToBack : {false, true}) {
+    auto overdraw = overdrawScene(16, frontToBack);
+    auto overdrawMeshes = loadMeshes(overdraw);
+    string name = frontToBack ? "Overdraw front to back" : "Overdraw back to front";
+    measure(name + ", depth test", overdraw, overdrawMeshes, {1920, 1080}, 1, noHierarchicalDepth, 10);
+    measure(name + ", hierarchical depth", overdraw, overdrawMeshes, {1920, 1080}, 1, {}, 10);
+    measure(name + ", depth prepass", overdraw, overdrawMeshes, {1920, 1080}, 1, prepass, 10);
+  }
+
+  // Loading merges the vertices that faces share, large assets spend most of their load time there. The file is
+  // parsed by all threads from memory, the stream loader reads it line by line on one thread
+  string gridFile = "raw4_raster_benchmark.obj", gridCache = MeshFile::cachePath(gridFile);
+  for (int size : {100, 1000}) {
+    string obj = gridObj(size);
+    ofstream{gridFile, ios::binary}.write(obj.data(), (streamsize) obj.size());
+    for (bool parallel : {false, true}) {
+      vector<tinyobj::shape_t> shapes;
+      vector<tinyobj::material_t> materials;
+      tinyobj::MaterialFileReader reader{""};
+      ifstream stream{gridFile, ios::binary};
+      auto begin = chrono::steady_clock::now();
+      string err = parallel ? tinyobj::LoadObjParallel(shapes, materials, gridFile.c_str())
+                            : tinyobj::LoadObj(shapes, materials, stream, reader);
+      double time = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+      if (!err.empty() || shapes.empty()) {
+        remove(gridFile.c_str());
+        throw runtime_error("Failed to load the grid: " + err);
+      }
+
+      auto &mesh = shapes.front().mesh;
+      cout << "Load grid obj" << (parallel ? ", mapped in parallel, " : ", stream, ") << obj.size() / 1e6 << " MB: "
+           << time * 1000 << " ms, " << mesh.indices.size() / 3 / time / 1e6 << " Mtris/s, "
+           << mesh.indices.size() / 3 << " triangles, " << mesh.positions.size() / 3 << " vertices" << endl;
+    }
+
+    // The first load converts the obj file and writes its binary cache, the next start maps the cache. Mapping reads
+    // the index buffers to check them, the vertex streams are paged in when they are first drawn
+    remove(gridCache.c_str());
+    for (bool cached : {false, true}) {
+      auto begin = chrono::steady_clock::now();
+      auto file = MeshFile::load(gridFile);
+      double time = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+      auto &mesh = file.getShapes().front();
+      cout << (cached ? "Load grid mesh, mapped from cache, " : "Load grid obj, converted to cache, ")
+           << file.size() / 1e6 << " MB: " << time * 1000 << " ms, " << mesh.indexCount / 3 / time / 1e6
+           << " Mtris/s, " << mesh.indexCount / 3 << " triangles, " << mesh.vertexCount << " vertices" << endl;
+    }
+  }
+  remove(gridFile.c_str());
+  remove(gridCache.c_str());
+}
+
+int main(int argc, char *argv[]) {
+  RenderOptions defaults;
+  defaults.output = "raw4_raster.bmp";
+  defaults.tileSize = 64;
+  defaults.samples = 1;
+  defaults.sampleCounts = {1, 4, 8};
+  defaults.accepted = {"--scene", "--output", "--size", "--spp", "--threads", "--tile", "--frames", "--first-frame"};
+  const vector<pair<string, string>> flags = {
+      {"--no-cull", "Draw back faces of meshes that are not closed"},
+      {"--prepass", "Resolve visibility before shading so each pixel is shaded once"},
+      {"--lit", "Light the textured meshes with a directional light"},
+      {"--benchmark", "Measure triangle and fragment throughput at 512x512 and 3840x2160 and mesh load time"},
+  };
+
+  RenderOptions options;
+  try {
+    options = parseOptions(argc, argv, defaults, {"--no-cull", "--prepass", "--lit", "--benchmark"});
+  } catch (const runtime_error &e) {
+    cerr << e.what() << endl;
+    printOptions(cerr, argv[0], defaults, flags);
+    return EXIT_FAILURE;
+  }
+  if (options.flag("--help")) {
+    printOptions(cout, argv[0], defaults, flags);
+    return EXIT_SUCCESS;
+  }
+
+  if (options.flag("--benchmark")) {
+    try {
+      benchmark(options);
+    } catch (const runtime_error &e) {
+      cerr << e.what() << endl;
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
   }
-  return faces;
-};
 
-int main() {
   // Image to store the rendering to
-  Image image{512, 512};
-  // Vector of faces loaded from Wavefront obj file
-  auto faces = loadObjFile("corsair.obj");
-  // Image to use as texture in the shader program
-  Image texture{image::loadBMP("corsair.bmp")};
-  // Shader program to use
-  Program program{texture};
-  // Set program uniforms
-  program.modelMatrix = orientate4(vec3{0,0.4,.8});
-  program.viewMatrix = lookAt(vec3{0,.7,.7}, vec3{0,0,0}, vec3{.5, .5, 0});
-  program.projectionMatrix = perspective((PI / 180.f) * 60.0f, (float)image.width / (float)image.height, 1.0f, 15.0f);
-
-  // Rasterizer instance
-  Rasterizer rasterizer{image, program};
-
-  // Render all faces
-  for (auto &face : faces)
-    rasterizer.render(face);
-
-  // Save the image
-  image::saveBMP(image, "raw4_raster.bmp");
+  Image image{options.width, options.height};
+
+  // Render the built in scene or the scene file selected on the command line, frames are saved in the background
+  try {
+    auto description = options.scene.empty() ? defaultScene() : scene::load(options.scene);
+    auto meshes = loadMeshes(description);
+    TileScheduler scheduler{options.threads, options.tileSize};
+    RenderTarget target{options.width, options.height, scheduler.getTileSize(), (int) options.samples};
+    RasterizerBase::Settings settings;
+    settings.cullBackFaces = !options.flag("--no-cull");
+    settings.depthPrepass = options.flag("--prepass");
+    ImageWriter writer;
+    // One rasterizer renders all frames, the program is passed by value only to select its type
+    auto renderFrames = [&](auto program) {
+      Rasterizer<decltype(program)> rasterizer{target, program, scheduler};
+      rasterizer.settings = settings;
+      for (unsigned int frame = options.firstFrame; frame < options.firstFrame + options.frames; ++frame) {
+        render(rasterizer, program, description.camera, meshes, frame, target, image, scheduler);
+        writer.save(image, options.frameOutput(frame));
+      }
+    };
+    if (options.flag("--lit"))
+      renderFrames(LitProgram{});
+    else
+      renderFrames(TextureProgram{});
+    writer.finish();
+  } catch (const runtime_error &e) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
 
   cout << "Done." << endl;
   return EXIT_SUCCESS;